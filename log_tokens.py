@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""
+Host tool for the tokenized logging (-DMYLOG_DEFERRED=1 -DMYLOG_TOKENIZED=1)
+
+Create the token table from the sources:
+    python log_tokens.py table src tokens.json
+Decode the binary log frames from a serial port (needs pyserial) or a file:
+    python log_tokens.py decode tokens.json COM8
+    python log_tokens.py decode tokens.json capture.bin
+
+The hash must match myLogHash() in src/Log/my-log_defer.h
+"""
+
+import json
+import os
+import re
+import struct
+import sys
+
+TOKEN_SYNC = 0xA5
+CALL = re.compile(r'myLog_[vdiwen]\(\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+SPEC = re.compile(r'%[-+ #0]*\d*(?:\.\d+)?(?:hh|h|ll|l|z|j|t)?([diouxXcsp%])')
+ESCAPES = {'n': '\n', 'r': '\r', 't': '\t', '0': '\0', '\\': '\\', '"': '"', "'": "'"}
+
+
+def unescape(text):
+    """Resolve the escape sequences of a C string literal"""
+    out = ''
+    idx = 0
+    while idx < len(text):
+        c = text[idx]
+        if c == '\\' and idx + 1 < len(text):
+            n = text[idx + 1]
+            if n == 'x':
+                m = re.match(r'[0-9a-fA-F]+', text[idx + 2:])
+                out += chr(int(m.group(0), 16))
+                idx += 2 + len(m.group(0))
+                continue
+            out += ESCAPES.get(n, n)
+            idx += 2
+            continue
+        out += c
+        idx += 1
+    return out
+
+
+def fnv1a(data):
+    """32 bit FNV-1a hash"""
+    value = 2166136261
+    for b in data:
+        value = ((value ^ b) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def build_table(src_dir):
+    """Collect the format strings of all myLog_x calls"""
+    table = {0: {'format': '%lu log records dropped', 'locations': []}}
+    for root, _, files in os.walk(src_dir):
+        for name in sorted(files):
+            if not name.endswith(('.c', '.cpp', '.h')):
+                continue
+            path = os.path.join(root, name)
+            with open(path, encoding='utf-8', errors='replace') as f:
+                text = f.read()
+            for call in CALL.finditer(text):
+                fmt = ''.join(unescape(lit) for lit in LITERAL.findall(call.group(1)))
+                token = fnv1a(fmt.encode('utf-8'))
+                line = text.count('\n', 0, call.start()) + 1
+                entry = table.setdefault(token, {'format': fmt, 'locations': []})
+                if entry['format'] != fmt:
+                    print('Token collision %08X: "%s" and "%s"' % (token, entry['format'], fmt), file=sys.stderr)
+                entry['locations'].append('%s:%d' % (os.path.relpath(path, src_dir), line))
+    return table
+
+
+def format_message(fmt, args, text):
+    """printf style formatting with the raw 32 bit arguments"""
+    values = []
+    arg = 0
+    for spec in SPEC.finditer(fmt):
+        conv = spec.group(1)
+        if conv == '%':
+            continue
+        raw = args[arg] if arg < len(args) else 0
+        arg += 1
+        if conv == 's':
+            values.append(text)
+            text = '...'
+        elif conv in 'di':
+            values.append(raw - (1 << 32) if raw & 0x80000000 else raw)
+        else:
+            values.append(raw)
+    pyfmt = SPEC.sub(lambda m: m.group(0)[:-1].rstrip('hljzt') + {'u': 'd', 'p': 'X', 'i': 'd'}.get(m.group(1), m.group(1)), fmt)
+    try:
+        return pyfmt % tuple(values)
+    except (TypeError, ValueError):
+        return '%s %s' % (fmt, args)
+
+
+def decode(table, stream, out):
+    """Decode binary frames, other bytes are passed through as text"""
+    buf = b''
+    while True:
+        chunk = stream.read(64)
+        if not chunk:
+            break
+        buf += chunk
+        while buf:
+            if buf[0] != TOKEN_SYNC:
+                end = buf.find(bytes([TOKEN_SYNC]))
+                end = len(buf) if end < 0 else end
+                out.write(buf[:end].decode('utf-8', errors='replace'))
+                buf = buf[end:]
+                continue
+            if len(buf) < 2 or len(buf) < buf[1] + 3:
+                break
+            size = buf[1]
+            payload = buf[2:2 + size]
+            check = 0
+            for b in payload:
+                check ^= b
+            if size < 10 or check != buf[2 + size]:
+                # Not a frame, pass the sync byte through
+                out.write(buf[:1].decode('latin-1'))
+                buf = buf[1:]
+                continue
+            token, time, level, num = struct.unpack_from('<IIcB', payload)
+            args = list(struct.unpack_from('<%dI' % num, payload, 10))
+            text = payload[10 + num * 4:].decode('utf-8', errors='replace')
+            entry = table.get(token)
+            if entry is None:
+                msg = 'Unknown token %08X %s' % (token, args)
+                where = ''
+            else:
+                msg = format_message(entry['format'], args, text)
+                where = entry['locations'][0] if entry['locations'] else ''
+            out.write('%d [%s][%s] %s\n' % (time, level.decode('latin-1'), where, msg))
+            buf = buf[3 + size:]
+        out.flush()
+
+
+def main():
+    if len(sys.argv) == 4 and sys.argv[1] == 'table':
+        table = build_table(sys.argv[2])
+        with open(sys.argv[3], 'w') as f:
+            json.dump({'%08X' % k: v for k, v in sorted(table.items())}, f, indent=1)
+        print('%d tokens' % len(table))
+    elif len(sys.argv) == 4 and sys.argv[1] == 'decode':
+        with open(sys.argv[2]) as f:
+            table = {int(k, 16): v for k, v in json.load(f).items()}
+        if os.path.isfile(sys.argv[3]):
+            stream = open(sys.argv[3], 'rb')
+        else:
+            import serial
+            stream = serial.Serial(sys.argv[3], 115200)
+        decode(table, stream, sys.stdout)
+    else:
+        print(__doc__)
+
+
+if __name__ == '__main__':
+    main()
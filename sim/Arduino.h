@@ -0,0 +1,78 @@
+#ifndef __SIM_ARDUINO_H__
+#define __SIM_ARDUINO_H__
+
+/**
+ * Arduino shim for the native build
+ * Only the part of the Arduino API that is used by the mesh sources.
+ * Time is the host time since the start of the program.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define RISING 3
+#define LED_BUILTIN 0
+
+#define IRAM_ATTR
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+void attachInterrupt(uint32_t pin, void (*isr)(void), uint32_t mode);
+void simInterrupt(uint32_t pin);
+
+/**
+ * Serial on stdin and stdout
+ */
+class SimSerial
+{
+public:
+	void begin(unsigned long baud) {}
+	void end(void) {}
+	operator bool() { return true; }
+	int available(void);
+	int read(void);
+	size_t write(uint8_t c);
+	size_t write(const uint8_t *data, size_t len);
+	size_t print(const char *text);
+	size_t println(const char *text = "");
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+	void flush(void);
+};
+
+extern SimSerial Serial;
+
+/**
+ * Minimal String, only for the display prototypes in main.h
+ */
+class String : public std::string
+{
+public:
+	String(const char *text = "") : std::string(text) {}
+	const char *c_str(void) const { return std::string::c_str(); }
+};
+
+#include "FreeRTOS.h"
+
+#endif /* __SIM_ARDUINO_H__ */
@@ -0,0 +1,3 @@
+/**
+ * SPI shim for the native build, the simulated radio needs no SPI
+ */
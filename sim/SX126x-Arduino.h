@@ -0,0 +1,159 @@
+#ifndef __SIM_SX126X_ARDUINO_H__
+#define __SIM_SX126X_ARDUINO_H__
+
+/**
+ * SX126x-Arduino shim for the native build
+ * Same Radio API as the library, the radio is simulated in sim/sx126x.cpp.
+ * Events are raised on the DIO1 interrupt that was attached with
+ * attachInterrupt() and the callbacks are called from Radio.IrqProcess(),
+ * like on the real hardware.
+ */
+
+#include <stdint.h>
+
+typedef enum
+{
+	MODEM_FSK = 0,
+	MODEM_LORA,
+} RadioModems_t;
+
+typedef enum
+{
+	RF_IDLE = 0,
+	RF_RX_RUNNING,
+	RF_TX_RUNNING,
+	RF_CAD,
+} RadioState_t;
+
+typedef enum
+{
+	LORA_CAD_01_SYMBOL = 0x00,
+	LORA_CAD_02_SYMBOL = 0x01,
+	LORA_CAD_04_SYMBOL = 0x02,
+	LORA_CAD_08_SYMBOL = 0x03,
+	LORA_CAD_16_SYMBOL = 0x04,
+} RadioLoRaCadSymbols_t;
+
+typedef enum
+{
+	LORA_CAD_ONLY = 0x00,
+	LORA_CAD_RX = 0x01,
+	LORA_CAD_LBT = 0x10,
+} RadioCadExitModes_t;
+
+typedef struct
+{
+	void (*TxDone)(void);
+	void (*TxTimeout)(void);
+	void (*RxDone)(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
+	void (*RxTimeout)(void);
+	void (*RxError)(void);
+	void (*FhssChangeChannel)(uint8_t currentChannel);
+	void (*CadDone)(bool channelActivityDetected);
+	void (*PreAmpDetect)(void);
+} RadioEvents_t;
+
+struct Radio_s
+{
+	void (*Init)(RadioEvents_t *events);
+	RadioState_t (*GetStatus)(void);
+	void (*SetChannel)(uint32_t freq);
+	uint32_t (*Random)(void);
+	void (*SetRxConfig)(RadioModems_t modem, uint32_t bandwidth, uint32_t datarate, uint8_t coderate,
+						uint32_t bandwidthAfc, uint16_t preambleLen, uint16_t symbTimeout, bool fixLen,
+						uint8_t payloadLen, bool crcOn, bool freqHopOn, uint8_t hopPeriod, bool iqInverted,
+						bool rxContinuous);
+	void (*SetTxConfig)(RadioModems_t modem, int8_t power, uint32_t fdev, uint32_t bandwidth, uint32_t datarate,
+						uint8_t coderate, uint16_t preambleLen, bool fixLen, bool crcOn, bool freqHopOn,
+						uint8_t hopPeriod, bool iqInverted, uint32_t timeout);
+	void (*Send)(uint8_t *buffer, uint8_t size);
+	void (*Sleep)(void);
+	void (*Standby)(void);
+	void (*Rx)(uint32_t timeout);
+	void (*SetCadParams)(uint8_t cadSymbolNum, uint8_t cadDetPeak, uint8_t cadDetMin, uint8_t cadExitMode,
+						 uint32_t cadTimeout);
+	void (*StartCad)(void);
+	void (*IrqProcess)(void);
+	void (*SetRxDutyCycle)(uint32_t rxTime, uint32_t sleepTime);
+};
+
+extern const struct Radio_s Radio;
+
+typedef struct
+{
+	uint8_t CHIP_TYPE;
+	int PIN_LORA_RESET;
+	int PIN_LORA_NSS;
+	int PIN_LORA_SCLK;
+	int PIN_LORA_MISO;
+	int PIN_LORA_DIO_1;
+	int PIN_LORA_BUSY;
+	int PIN_LORA_MOSI;
+	int RADIO_TXEN;
+	int RADIO_RXEN;
+	bool USE_DIO2_ANT_SWITCH;
+	bool USE_DIO3_TCXO;
+	bool USE_DIO3_ANT_SWITCH;
+	bool USE_LDO;
+	bool USE_RXEN_ANT_PWR;
+} hw_config;
+
+extern hw_config _hwConfig;
+
+#define SX1262_CHIP 1
+
+void RadioOnDioIrq(void);
+
+/**
+ * Start the simulated radio
+ * @param index
+ * 		Index of this node, 0 .. count - 1
+ * @param count
+ * 		Number of simulated nodes
+ * @param links
+ * 		File with the links between the nodes, NULL if every node hears every node
+ * @return bool
+ * 		True if the radio could be started
+ */
+bool simRadioInit(uint8_t index, uint8_t count, const char *links);
+
+/**
+ * Get the number of commands that changed the state of the simulated radio
+ * Status reads and the interrupt handling are not counted.
+ * @return uint32_t
+ * 		Number of commands since the start
+ */
+uint32_t simRadioCommands(void);
+
+/**
+ * Start a simulated peer for host tests, after simRadioInit()
+ * The peer is a node without mesh that sends and receives raw packages
+ * @param index
+ * 		Index of the peer, must not be the index of this node
+ * @return bool
+ * 		True if the peer could be started
+ */
+bool simPeerInit(uint8_t index);
+
+/**
+ * Send a package from the peer on the rendezvous channel with the common rate
+ * Returns at the end of the time on air
+ * @param buffer
+ * 		Package
+ * @param size
+ * 		Size of the package
+ */
+void simPeerSend(uint8_t *buffer, uint8_t size);
+
+/**
+ * Receive a package sent to the peer, returns at the end of its time on air
+ * @param buffer
+ * 		Buffer for the package, 256 bytes
+ * @param timeout
+ * 		Max time to wait [ms]
+ * @return int16_t
+ * 		Size of the package, -1 after the timeout
+ */
+int16_t simPeerReceive(uint8_t *buffer, uint32_t timeout);
+
+#endif /* __SIM_SX126X_ARDUINO_H__ */
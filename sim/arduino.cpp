@@ -0,0 +1,147 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+#include <thread>
+
+/**
+ * Arduino shim for the native build
+ */
+
+SimSerial Serial;
+
+/** Start time of the program */
+static const std::chrono::steady_clock::time_point simStart = std::chrono::steady_clock::now();
+
+/** Random numbers, seed with randomSeed() for reproducible runs */
+static std::minstd_rand simRandom(1);
+
+/** Max number of interrupt pins */
+#define SIM_PINS 64
+/** Interrupt handlers per pin */
+static void (*simIsr[SIM_PINS])(void);
+
+unsigned long millis(void)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - simStart).count();
+}
+
+unsigned long micros(void)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - simStart).count();
+}
+
+void delay(unsigned long ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+long random(long max)
+{
+	return random(0, max);
+}
+
+long random(long min, long max)
+{
+	if (max <= min)
+	{
+		return min;
+	}
+	return min + (long)(simRandom() % (unsigned long)(max - min));
+}
+
+void randomSeed(unsigned long seed)
+{
+	simRandom.seed(seed);
+}
+
+void pinMode(uint32_t pin, uint32_t mode)
+{
+}
+
+void digitalWrite(uint32_t pin, uint32_t value)
+{
+}
+
+int digitalRead(uint32_t pin)
+{
+	return LOW;
+}
+
+void attachInterrupt(uint32_t pin, void (*isr)(void), uint32_t mode)
+{
+	if (pin < SIM_PINS)
+	{
+		simIsr[pin] = isr;
+	}
+}
+
+/**
+ * Raise an interrupt, called by the simulated hardware
+ * @param pin
+ * 		Pin of the interrupt
+ */
+void simInterrupt(uint32_t pin)
+{
+	if ((pin < SIM_PINS) && (simIsr[pin] != NULL))
+	{
+		simIsr[pin]();
+	}
+}
+
+int SimSerial::available(void)
+{
+	struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+	return ((poll(&fd, 1, 0) > 0) && ((fd.revents & POLLIN) != 0)) ? 1 : 0;
+}
+
+int SimSerial::read(void)
+{
+	uint8_t c;
+	if ((available() == 0) || (::read(STDIN_FILENO, &c, 1) != 1))
+	{
+		return -1;
+	}
+	return c;
+}
+
+size_t SimSerial::write(uint8_t c)
+{
+	return fwrite(&c, 1, 1, stdout);
+}
+
+size_t SimSerial::write(const uint8_t *data, size_t len)
+{
+	return fwrite(data, 1, len, stdout);
+}
+
+size_t SimSerial::print(const char *text)
+{
+	return fputs(text, stdout) < 0 ? 0 : strlen(text);
+}
+
+size_t SimSerial::println(const char *text)
+{
+	return print(text) + print("\n");
+}
+
+size_t SimSerial::printf(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int len = vprintf(format, args);
+	va_end(args);
+	return len < 0 ? 0 : len;
+}
+
+void SimSerial::flush(void)
+{
+	fflush(stdout);
+}
@@ -0,0 +1,313 @@
+#include <Arduino.h>
+#include <pthread.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * FreeRTOS shim for the native build
+ */
+
+struct simTask
+{
+	TaskFunction_t code;
+	void *parameters;
+	uint32_t stackDepth;
+	std::mutex lock;
+	std::condition_variable notified;
+	uint32_t notifyCount = 0;
+};
+
+struct simQueue
+{
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<std::vector<uint8_t>> items;
+	/** Task holding a recursive mutex and the number of takes */
+	simTask *owner = NULL;
+	UBaseType_t depth = 0;
+};
+
+/** Task of the calling thread, created on first use for threads not started by xTaskCreate */
+static thread_local simTask *currentTask = NULL;
+
+/** Lock of the critical sections */
+static std::recursive_mutex criticalLock;
+
+/**
+ * Wait on a condition with a timeout in ticks
+ * @return bool
+ * 		Result of the predicate
+ */
+template <typename Predicate>
+static bool simWait(std::condition_variable &cond, std::unique_lock<std::mutex> &lock, TickType_t ticks, Predicate pred)
+{
+	if (ticks == portMAX_DELAY)
+	{
+		cond.wait(lock, pred);
+		return true;
+	}
+	return cond.wait_for(lock, std::chrono::milliseconds(ticks), pred);
+}
+
+static void *simTaskStart(void *arg)
+{
+	simTask *task = (simTask *)arg;
+	currentTask = task;
+	task->code(task->parameters);
+	return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters,
+					   UBaseType_t priority, TaskHandle_t *createdTask)
+{
+	simTask *task = new simTask;
+	task->code = code;
+	task->parameters = parameters;
+	task->stackDepth = stackDepth;
+	if (createdTask != NULL)
+	{
+		*createdTask = task;
+	}
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, simTaskStart, task) != 0)
+	{
+		if (createdTask != NULL)
+		{
+			*createdTask = NULL;
+		}
+		delete task;
+		return pdFAIL;
+	}
+	pthread_detach(thread);
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+	if ((task == NULL) || (task == currentTask))
+	{
+		pthread_exit(NULL);
+	}
+	// Other tasks can not be stopped, they keep running
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	delay(ticks);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return millis();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	if (currentTask == NULL)
+	{
+		currentTask = new simTask;
+		currentTask->code = NULL;
+		currentTask->parameters = NULL;
+		currentTask->stackDepth = 0;
+	}
+	return currentTask;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+	// The stack use of host threads is not measured
+	return 0;
+}
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+	std::lock_guard<std::mutex> guard(task->lock);
+	task->notifyCount++;
+	task->notified.notify_one();
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken)
+{
+	xTaskNotifyGive(task);
+	if (higherPriorityTaskWoken != NULL)
+	{
+		*higherPriorityTaskWoken = pdFALSE;
+	}
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+	simTask *task = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> lock(task->lock);
+	simWait(task->notified, lock, ticksToWait, [task] { return task->notifyCount != 0; });
+	uint32_t count = task->notifyCount;
+	if (count != 0)
+	{
+		task->notifyCount = clearCountOnExit ? 0 : count - 1;
+	}
+	return count;
+}
+
+void taskENTER_CRITICAL(void)
+{
+	criticalLock.lock();
+}
+
+void taskEXIT_CRITICAL(void)
+{
+	criticalLock.unlock();
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+	simQueue *queue = new simQueue;
+	queue->length = length;
+	queue->itemSize = itemSize;
+	return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+	std::unique_lock<std::mutex> lock(queue->lock);
+	if (!simWait(queue->changed, lock, ticksToWait, [queue] { return queue->items.size() < queue->length; }))
+	{
+		return errQUEUE_FULL;
+	}
+	const uint8_t *data = (const uint8_t *)item;
+	queue->items.emplace_back(data, data + queue->itemSize);
+	queue->changed.notify_all();
+	return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higherPriorityTaskWoken)
+{
+	if (higherPriorityTaskWoken != NULL)
+	{
+		*higherPriorityTaskWoken = pdFALSE;
+	}
+	return xQueueSend(queue, item, 0);
+}
+
+/**
+ * Read the first item of a queue
+ * @param remove
+ * 		True to take the item out of the queue
+ */
+static BaseType_t simQueueRead(QueueHandle_t queue, void *item, TickType_t ticksToWait, bool remove)
+{
+	std::unique_lock<std::mutex> lock(queue->lock);
+	if (!simWait(queue->changed, lock, ticksToWait, [queue] { return !queue->items.empty(); }))
+	{
+		return pdFALSE;
+	}
+	if (queue->itemSize != 0)
+	{
+		memcpy(item, queue->items.front().data(), queue->itemSize);
+	}
+	if (remove)
+	{
+		queue->items.pop_front();
+		queue->changed.notify_all();
+	}
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait)
+{
+	return simQueueRead(queue, item, ticksToWait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticksToWait)
+{
+	return simQueueRead(queue, item, ticksToWait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	std::lock_guard<std::mutex> guard(queue->lock);
+	return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+	std::lock_guard<std::mutex> guard(queue->lock);
+	return queue->length - queue->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	// Created empty, like FreeRTOS
+	return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	// Created available, like FreeRTOS
+	SemaphoreHandle_t semaphore = xQueueCreate(1, 0);
+	xSemaphoreGive(semaphore);
+	return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+	return xSemaphoreCreateMutex();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait)
+{
+	return xQueueReceive(semaphore, NULL, ticksToWait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+	return xQueueSend(semaphore, NULL, 0);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higherPriorityTaskWoken)
+{
+	return xQueueSendFromISR(semaphore, NULL, higherPriorityTaskWoken);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticksToWait)
+{
+	simTask *task = xTaskGetCurrentTaskHandle();
+	{
+		std::lock_guard<std::mutex> guard(mutex->lock);
+		if (mutex->owner == task)
+		{
+			mutex->depth++;
+			return pdTRUE;
+		}
+	}
+	if (xSemaphoreTake(mutex, ticksToWait) != pdTRUE)
+	{
+		return pdFALSE;
+	}
+	std::lock_guard<std::mutex> guard(mutex->lock);
+	mutex->owner = task;
+	mutex->depth = 1;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+	{
+		std::lock_guard<std::mutex> guard(mutex->lock);
+		if (mutex->owner != xTaskGetCurrentTaskHandle())
+		{
+			return pdFALSE;
+		}
+		if (--mutex->depth != 0)
+		{
+			return pdTRUE;
+		}
+		mutex->owner = NULL;
+	}
+	return xSemaphoreGive(mutex);
+}
@@ -0,0 +1,332 @@
+#include "main.h"
+
+// The unit tests have their own main()
+#ifndef PIO_UNIT_TESTING
+
+/**
+ * Mesh node on the host
+ * Usage: node <index> <count> [links]
+ * Starts node <index> of <count> simulated nodes, see sim/sx126x.cpp for
+ * the links file. Commands are read line by line from stdin:
+ * send <id> <text>  send text to a node, ID in hex
+ * bcast <text>      broadcast text, up to SIM_BROADCAST_HOPS hops
+ * burst <n> <text>  n broadcasts "<text> <i>" to the direct nodes, back to back
+ * tsend <id> <n> <text>
+ *                   n transport messages "<text> <i>" to a node, back to back
+ * frag <id> <size>  message of size bytes "frag <size> abc..." to a node, in fragments
+ * load <id> <n> <size>
+ *                   n packages of size bytes "load <i> <random letters>" to a node, back to back
+ * slow <ms>         time the data callback takes, a busy application
+ * nodes             print the node map
+ * stats, trace, prof, telemetry
+ *                   print the CSV of the mesh counters
+ * stats reset       reset the statistics counters
+ * ping <id>         round trip time to a node, ID in hex
+ * traceroute <id>   round trip time and path to a node, ID in hex
+ * mark <text>       print the text, marks the end of the previous output
+ * quit              stop the node
+ * At the end of stdin the node keeps running, so it still relays.
+ */
+
+/** Max number of hops of a broadcast */
+#define SIM_BROADCAST_HOPS 8
+
+/** Structure for the mesh callbacks */
+static MeshEvents_t meshEvents;
+/** Time the data callback takes [ms] */
+static uint32_t dataDelay = 0;
+/** Message of the frag command, must stay valid until it is sent */
+static uint8_t fragMsg[FRAGMENT_MAX_SIZE];
+
+/**
+ * Callback for received data
+ */
+static void onDataAvailable(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	Serial.printf("Data from %08lX rssi %d snr %d: %.*s\n", (unsigned long)fromID, rssi, snr, size, (char *)payload);
+	Serial.flush();
+	if (dataDelay != 0)
+	{
+		delay(dataDelay);
+	}
+}
+
+/**
+ * Callback for finished transport messages
+ */
+static void onTransportDone(uint32_t nodeId, uint16_t msgId, bool delivered)
+{
+	Serial.printf("Transport to %08lX #%d %s\n", (unsigned long)nodeId, msgId, delivered ? "delivered" : "failed");
+	Serial.flush();
+}
+
+/**
+ * Callback for changes of the node map
+ */
+static void onNodesListChange(void)
+{
+	Serial.printf("Node map changed, %d nodes\n", numOfNodes());
+	Serial.flush();
+}
+
+/**
+ * Print the output of a CSV function in chunks
+ */
+static void printCsv(uint16_t (*csv)(char *, uint16_t, uint8_t &))
+{
+	char buffer[256];
+	uint8_t next = 0;
+	uint16_t len;
+	while ((len = csv(buffer, 240, next)) != 0)
+	{
+		Serial.write((uint8_t *)buffer, len);
+	}
+}
+
+/**
+ * Print the node map
+ */
+static void printNodes(void)
+{
+	if (nodeListTake(portMAX_DELAY) != pdTRUE)
+	{
+		return;
+	}
+	uint8_t count = numOfNodes();
+	for (uint8_t idx = 0; idx < count; idx++)
+	{
+		uint32_t nodeId, firstHop;
+		uint8_t hops;
+		if (getNode(idx, nodeId, firstHop, hops))
+		{
+			Serial.printf("%08lX hop %08lX hops %d\n", (unsigned long)nodeId, (unsigned long)firstHop, hops);
+		}
+	}
+	nodeListGive();
+}
+
+/**
+ * Send a ping or traceroute and wait for the result
+ */
+static void echo(uint32_t nodeId, bool route)
+{
+	if (!echoSend(nodeId, route))
+	{
+		Serial.printf("Cannot send echo to %08lX\n", (unsigned long)nodeId);
+		return;
+	}
+	echoResult result;
+	echoState state;
+	while ((state = echoGetResult(&result)) == ECHO_PENDING)
+	{
+		delay(10);
+	}
+	if (state != ECHO_DONE)
+	{
+		Serial.printf("No echo reply\n");
+		return;
+	}
+	Serial.printf("Reply from %08lX #%d rtt %lu ms\n", (unsigned long)result.nodeId, result.seq,
+				  (unsigned long)result.rtt);
+	printCsv(echoCsv);
+}
+
+/**
+ * Handle a command line
+ * @return bool
+ * 		False to stop the node
+ */
+static bool handleCommand(char *cmd)
+{
+	char *arg = strchr(cmd, ' ');
+	if (arg != NULL)
+	{
+		*arg++ = 0;
+	}
+
+	if ((strcmp(cmd, "send") == 0) && (arg != NULL))
+	{
+		char *text;
+		uint32_t nodeId = strtoul(arg, &text, 16);
+		text += strspn(text, " ");
+		if (!sendToNode(nodeId, (uint8_t *)text, strlen(text), 0))
+		{
+			Serial.printf("Cannot send to %08lX\n", (unsigned long)nodeId);
+		}
+	}
+	else if ((strcmp(cmd, "bcast") == 0) && (arg != NULL))
+	{
+		if (!sendBroadcast((uint8_t *)arg, strlen(arg), SIM_BROADCAST_HOPS))
+		{
+			Serial.printf("Cannot send broadcast\n");
+		}
+	}
+	else if ((strcmp(cmd, "burst") == 0) && (arg != NULL))
+	{
+		char *text;
+		int count = strtol(arg, &text, 10);
+		text += strspn(text, " ");
+		for (int idx = 0; idx < count; idx++)
+		{
+			char msg[200];
+			int len = snprintf(msg, sizeof(msg), "%.180s %d", text, idx);
+			// Wait for room in the send queue
+			while (!sendBroadcast((uint8_t *)msg, len, 1))
+			{
+				delay(10);
+			}
+		}
+	}
+	else if ((strcmp(cmd, "tsend") == 0) && (arg != NULL))
+	{
+		char *text;
+		uint32_t nodeId = strtoul(arg, &text, 16);
+		int count = strtol(text, &text, 10);
+		text += strspn(text, " ");
+		for (int idx = 0; idx < count; idx++)
+		{
+			char msg[TRANSPORT_MAX_PAYLOAD];
+			int len = snprintf(msg, sizeof(msg), "%.180s %d", text, idx);
+			// Wait for room in the window
+			while (!transportSend(nodeId, (uint8_t *)msg, len, NULL))
+			{
+				delay(10);
+			}
+		}
+	}
+	else if ((strcmp(cmd, "load") == 0) && (arg != NULL))
+	{
+		char *text;
+		uint32_t nodeId = strtoul(arg, &text, 16);
+		int count = strtol(text, &text, 10);
+		uint16_t size = strtoul(text, NULL, 10);
+		uint8_t msg[DATA_MAX_SIZE];
+		size = size > sizeof(msg) ? sizeof(msg) : size;
+		for (int idx = 0; idx < count; idx++)
+		{
+			int len = snprintf((char *)msg, sizeof(msg), "load %d ", idx);
+			// Random letters, the package is not made smaller by the compression
+			for (int pos = len; pos < size; pos++)
+			{
+				msg[pos] = 'a' + random(0, 26);
+			}
+			// Wait for room in the send queue
+			while (!sendToNode(nodeId, msg, size > len ? size : len, 0))
+			{
+				delay(10);
+			}
+		}
+	}
+	else if ((strcmp(cmd, "frag") == 0) && (arg != NULL))
+	{
+		char *text;
+		uint32_t nodeId = strtoul(arg, &text, 16);
+		uint16_t size = strtoul(text, NULL, 10);
+		size = size > sizeof(fragMsg) ? sizeof(fragMsg) : size;
+		int len = snprintf((char *)fragMsg, sizeof(fragMsg), "frag %d ", size);
+		for (int idx = len; idx < size; idx++)
+		{
+			fragMsg[idx] = 'a' + idx % 26;
+		}
+		if (fragmentBusy() || !fragmentSend(nodeId, fragMsg, size))
+		{
+			Serial.printf("Cannot send fragments to %08lX\n", (unsigned long)nodeId);
+		}
+	}
+	else if ((strcmp(cmd, "slow") == 0) && (arg != NULL))
+	{
+		dataDelay = strtoul(arg, NULL, 10);
+	}
+	else if (strcmp(cmd, "nodes") == 0)
+	{
+		printNodes();
+	}
+	else if ((strcmp(cmd, "stats") == 0) && (arg != NULL) && (strcmp(arg, "reset") == 0))
+	{
+		meshStatsReset();
+		Serial.printf("Statistics reset\n");
+	}
+	else if (strcmp(cmd, "stats") == 0)
+	{
+		printCsv(meshStatsCsv);
+	}
+	else if (strcmp(cmd, "trace") == 0)
+	{
+		printCsv(traceCsv);
+	}
+	else if (strcmp(cmd, "prof") == 0)
+	{
+		printCsv(profileCsv);
+	}
+	else if (strcmp(cmd, "telemetry") == 0)
+	{
+		printCsv(telemetryCsv);
+	}
+	else if (((strcmp(cmd, "ping") == 0) || (strcmp(cmd, "traceroute") == 0)) && (arg != NULL))
+	{
+		echo(strtoul(arg, NULL, 16), cmd[0] == 't');
+	}
+	else if (strcmp(cmd, "mark") == 0)
+	{
+		Serial.printf("%s\n", arg != NULL ? arg : "");
+	}
+	else if (strcmp(cmd, "quit") == 0)
+	{
+		return false;
+	}
+	else if (cmd[0] != 0)
+	{
+		Serial.printf("Unknown command %s\n", cmd);
+	}
+	Serial.flush();
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		fprintf(stderr, "Usage: %s <index> <count> [links]\n", argv[0]);
+		return 1;
+	}
+	uint8_t index = atoi(argv[1]);
+	uint8_t count = atoi(argv[2]);
+
+	// Node IDs with unique broadcast IDs (upper 24 bits) and short addresses
+	deviceID = 0x5A000000 | ((uint32_t)(index + 1) << 8) | (index + 1);
+	randomSeed(deviceID);
+
+#if MYLOG_DEFERRED > 0
+	// Start the task that prints the deferred log records
+	myLogInit();
+#endif
+
+	if (!simRadioInit(index, count, argc > 3 ? argv[3] : NULL))
+	{
+		return 1;
+	}
+	Serial.printf("Mesh NodeId = %08lX\n", (unsigned long)deviceID);
+	Serial.flush();
+
+	meshEvents.DataAvailable = onDataAvailable;
+	meshEvents.NodesListChanged = onNodesListChange;
+	meshEvents.TransportDone = onTransportDone;
+	initMesh(&meshEvents, 48);
+
+	char line[256];
+	while (fgets(line, sizeof(line), stdin) != NULL)
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		if (!handleCommand(line))
+		{
+			return 0;
+		}
+	}
+
+	// No more commands, keep relaying
+	while (true)
+	{
+		delay(1000);
+	}
+}
+#endif
@@ -0,0 +1,471 @@
+#!/usr/bin/env python3
+"""
+Scenarios on simulated mesh networks
+Usage: python3 sim/scenarios.py [--list] [group or scenario ...]
+Runs the scenarios of the regression group without arguments. A scenario
+raises an exception if a check fails, the exit code is the number of
+failed scenarios. Measurements are printed as "name: value" lines.
+The simulation runs in real time, the radio timing is the LoRa time on
+air of the simulated SX126x (sim/sx126x.cpp).
+"""
+
+import re
+import sys
+import time
+import traceback
+
+from simnet import Net, hex_id
+
+SCENARIOS = []
+
+
+def scenario(*groups):
+    """Register a scenario function in groups"""
+    def register(func):
+        SCENARIOS.append((func.__name__, groups, func))
+        return func
+    return register
+
+
+def check(condition, text):
+    if not condition:
+        raise AssertionError(text)
+
+
+def report(name, value):
+    print('  %s: %s' % (name, value), flush=True)
+
+
+def chain(count):
+    """Links of a chain, node n hears node n - 1 and n + 1"""
+    return [(idx, idx + 1) for idx in range(count - 1)]
+
+
+def grid(size):
+    """Links of a size x size grid, a node hears its 8 neighbours"""
+    links = []
+    for row in range(size):
+        for col in range(size):
+            for drow, dcol in ((0, 1), (1, -1), (1, 0), (1, 1)):
+                if 0 <= row + drow < size and 0 <= col + dcol < size:
+                    links.append((row * size + col, (row + drow) * size + col + dcol))
+    return links
+
+
+@scenario('regression')
+def chain_delivery():
+    """Unicast and broadcast over a 3 node chain"""
+    with Net(3, chain(3)) as net:
+        check(net.wait_routes(), 'maps did not settle')
+        check(net[0].routes()[net[2].id] == 1, 'node 2 is not reached through node 1')
+
+        start = net[2].mark()
+        net[0].cmd('send %s hello over two hops' % hex_id(2))
+        check(net[2].wait('^Data from %s .*: hello over two hops$' % hex_id(0), 10, start), 'unicast not delivered')
+
+        starts = [node.mark() for node in net.nodes]
+        net[2].cmd('bcast hello everybody')
+        for idx in (0, 1):
+            check(net[idx].wait('^Data from %s .*: hello everybody$' % hex_id(2), 10, starts[idx]),
+                  'broadcast not delivered to node %d' % idx)
+        time.sleep(2)
+        check(net[2].count('hello everybody', starts[2]) == 0, 'own broadcast delivered')
+        check(net[0].count('hello everybody', starts[0]) == 1, 'broadcast delivered twice')
+
+        for node in net.nodes:
+            stats = node.stats()
+            check(stats['rx_invalid'] == 0, 'invalid packages at node %d' % node.index)
+            check(stats['tx_stuck'] == 0, 'TX stuck at node %d' % node.index)
+
+
+@scenario('regression')
+def echo_chain():
+    """Ping and traceroute over a 4 node chain"""
+    with Net(4, chain(4)) as net:
+        check(net.wait_routes(), 'maps did not settle')
+        target = hex_id(3)
+
+        lines = net[0].query('ping %s' % target, 30)
+        replies = [re.match(r'^Reply from %s #\d+ rtt (\d+) ms$' % target, line) for line in lines]
+        replies = [match for match in replies if match]
+        check(len(replies) == 1, 'no ping reply: %s' % lines)
+        report('ping rtt 3 hops [ms]', replies[0].group(1))
+
+        lines = net[0].query('traceroute %s' % target, 30)
+        check(any(re.match(r'^Reply from %s ' % target, line) for line in lines), 'no traceroute reply: %s' % lines)
+        hops = [line.split(',') for line in lines if re.match(r'^\d+,[0-9A-F]{8},\w+,-?\d+$', line)]
+        path = [(hop[1], hop[2]) for hop in hops]
+        expected = [(hex_id(1), 'to'), (hex_id(2), 'to'), (target, 'target'), (hex_id(2), 'back'), (hex_id(1), 'back')]
+        check(path == expected, 'wrong path %s' % path)
+        # Relays measure the round trip from their own records, the target and the way back have none
+        rtts = [int(hop[3]) for hop in hops]
+        check(rtts[1] > 0 and rtts[0] > rtts[1] and rtts[2:] == [0, -1, -1], 'wrong round trip times %s' % rtts)
+        report('traceroute rtt per hop [ms]', ' '.join(str(rtt) for rtt in rtts))
+
+        lines = net[0].query('ping %08X' % 0x5A00FFFF, 30)
+        check(any(line.startswith('Cannot send echo') for line in lines), 'echo to unknown node sent: %s' % lines)
+
+
+@scenario('measure')
+def rx_ring_burst():
+    """Bursts to a node with a slow application, RX ring of 1 and 4 packages"""
+    senders = (1, 2, 3)
+    count = 6
+    delivered = {}
+    for ring in (1, 4):
+        with Net(4, flags=['-DRX_RING_SIZE=%d' % ring]) as net:
+            check(net.wait_routes(), 'maps did not settle')
+            net[0].cmd('slow 300')
+            start = net[0].mark()
+            for idx in senders:
+                # Senders that start together collide on every package
+                net[idx].cmd('burst %d burst from %d' % (count, idx))
+                time.sleep(0.15)
+            time.sleep(count * len(senders) * 0.3 + 6)
+            delivered[ring] = net[0].count('^Data from .*: burst from', start)
+            stats = net[0].stats()
+            report('ring %d delivered' % ring, '%d of %d' % (delivered[ring], count * len(senders)))
+            report('ring %d rx_ring_drop' % ring, stats['rx_ring_drop'])
+    check(delivered[4] > delivered[1], 'larger RX ring did not deliver more')
+
+
+@scenario('measure')
+def hop_latency():
+    """Latency of a small unicast over 1 to 4 hops of a chain"""
+    count = 5
+    latency = {}
+    with Net(5, chain(5)) as net:
+        check(net.wait_routes(), 'maps did not settle')
+        for hops in range(1, 5):
+            times = []
+            for idx in range(count):
+                start = net[hops].mark()
+                sent = time.time()
+                net[0].cmd('send %s latency %d' % (hex_id(hops), idx))
+                received = net[hops].wait_time('^Data from %s .*: latency %d$' % (hex_id(0), idx), 10, start)
+                check(received is not None, 'not delivered over %d hops' % hops)
+                times.append((received - sent) * 1000)
+                time.sleep(0.5)
+            latency[hops] = sorted(times)[count // 2]
+            report('%d hops median [ms]' % hops, '%.0f' % latency[hops])
+    per_hop = (latency[4] - latency[1]) / 3
+    report('per hop [ms]', '%.0f' % per_hop)
+    # A polling mesh task would add up to its poll interval per hop
+    check(per_hop < 100, 'per hop latency too high')
+
+
+@scenario('measure')
+def lossy_link():
+    """Unicast over a 3 node chain with 20 % package loss per link, with and without link ACKs"""
+    count = 20
+    loss = 20
+    delivered = {}
+    for ack in (0, 1):
+        with Net(3, [(0, 1, -60, 9, loss), (1, 2, -60, 9, loss)], flags=['-DLINK_ACK=%d' % ack]) as net:
+            check(net.wait_routes(), 'maps did not settle')
+            start = net[2].mark()
+            for idx in range(count):
+                net[0].cmd('send %s lossy %d' % (hex_id(2), idx))
+                time.sleep(1.5)
+            time.sleep(2)
+            delivered[ack] = net[2].count('^Data from %s .*: lossy \\d+$' % hex_id(0), start)
+            sent = net[0].stats()['tx_done'] + net[1].stats()['tx_done']
+            report('link ACK %d delivered' % ack, '%d of %d' % (delivered[ack], count))
+            report('link ACK %d transmissions of node 0 and 1, with maps and ACKs' % ack, sent)
+            if ack:
+                report('link ACK 1 give ups', net[0].stats()['link_give_up'] + net[1].stats()['link_give_up'])
+    check(delivered[1] > delivered[0], 'link ACKs did not deliver more')
+
+
+@scenario('measure')
+def transport_hops():
+    """Transport messages over 3 to 5 hops of a chain, window of 1 and 4 messages"""
+    count = 10
+    text = 'transport message with forty bytes of it'
+    for window in (1, 4):
+        with Net(6, chain(6), flags=['-DTRANSPORT_WINDOW=%d' % window]) as net:
+            check(net.wait_routes(), 'maps did not settle')
+            for hops in (3, 4, 5):
+                start = net[0].mark()
+                dest_start = net[hops].mark()
+                sent = time.time()
+                net[0].cmd('tsend %s %d %s' % (hex_id(hops), count, text))
+                end = time.time() + 120
+                while time.time() < end and net[0].count('^Transport to %s ' % hex_id(hops), start) < count:
+                    time.sleep(0.1)
+                elapsed = time.time() - sent
+                done = net[0].count('^Transport to %s .* delivered$' % hex_id(hops), start)
+                check(done == count, '%d of %d delivered over %d hops' % (done, count, hops))
+                first = net[hops].wait_time('^Data from %s .*: %s 0$' % (hex_id(0), text), 1, dest_start)
+                name = 'window %d, %d hops' % (window, hops)
+                report('%s first message [ms]' % name, '%.0f' % ((first - sent) * 1000))
+                report('%s throughput [byte/s]' % name, '%.0f' % (count * (len(text) + 2) / elapsed))
+                time.sleep(2)
+            stats = [node.stats() for node in net.nodes]
+            report('window %d collisions' % window, sum(stat['rx_crc_error'] for stat in stats))
+            report('window %d link give ups' % window, sum(stat['link_give_up'] for stat in stats))
+
+
+@scenario('measure')
+def fragment_size():
+    """Messages of 1 to 8 KB in fragments over 1 and 2 hops"""
+    # Max message size of ESP32 and nRF52840, the host build has the one of nRF52832
+    with Net(3, chain(3), flags=['-DFRAGMENT_MAX_SIZE=8192']) as net:
+        check(net.wait_routes(), 'maps did not settle')
+        for hops in (1, 2):
+            for size in (1024, 2048, 4096, 8192):
+                start = net[hops].mark()
+                sent = time.time()
+                net[0].cmd('frag %s %d' % (hex_id(hops), size))
+                received = net[hops].wait_time('^Data from %s .*: frag %d [a-z]+$' % (hex_id(0), size), 120, start)
+                check(received is not None, '%d bytes not delivered over %d hops' % (size, hops))
+                report('%d hops %d bytes' % (hops, size),
+                       '%.1f s, %.0f byte/s' % (received - sent, size / (received - sent)))
+                time.sleep(2)
+        stats = [node.stats() for node in net.nodes]
+        report('link give ups', sum(stat['link_give_up'] for stat in stats))
+
+
+def saturate(net, flows, count, size, timeout=5):
+    """
+    Start load commands for (source, destination) flows at once and wait until all are delivered
+    or nothing was delivered for timeout seconds
+    Returns the start time and the delivery times per flow
+    """
+    starts = {flow: net[flow[1]].mark() for flow in flows}
+    patterns = {flow: '^Data from %s .*: load \\d+ [a-z]+$' % hex_id(flow[0]) for flow in flows}
+    sent = time.time()
+    for src, dest in flows:
+        net[src].cmd('load %s %d %d' % (hex_id(dest), count, size))
+    last = sent
+    stamps = {}
+    while time.time() < last + timeout:
+        time.sleep(0.5)
+        for flow in flows:
+            with net[flow[1]].cond:
+                stamps[flow] = [stamp for stamp, line in net[flow[1]].lines[starts[flow]:]
+                                if re.search(patterns[flow], line)]
+        last = max([sent] + sum(stamps.values(), []))
+        if all(len(stamps[flow]) == count for flow in flows):
+            break
+    return sent, stamps
+
+
+@scenario('measure')
+def channels_throughput():
+    """Saturated unicast between 4 pairs of nodes in range of each other, 1 to 8 channels"""
+    pairs = ((0, 1), (2, 3), (4, 5), (6, 7))
+    count = 15
+    size = 150
+    for channels in (1, 2, 4, 8):
+        with Net(8, flags=['-DMESH_CHANNELS=%d' % channels]) as net:
+            check(net.wait_routes(), 'maps did not settle')
+            sent, stamps = saturate(net, pairs, count, size)
+            delivered = sum(len(times) for times in stamps.values())
+            last = max([sent] + sum(stamps.values(), []))
+            # Sum of the throughput of the pairs, each from the start to its last package
+            pair_sum = sum(len(times) * size / (max(times) - sent) for times in stamps.values() if times)
+            stats = [node.stats() for node in net.nodes]
+            name = '%d channels' % channels
+            report('%s delivered' % name, '%d of %d in %.1f s' % (delivered, count * len(pairs), last - sent))
+            report('%s throughput [byte/s]' % name, '%.0f' % (delivered * size / (last - sent)))
+            report('%s sum of the pairs [byte/s]' % name, '%.0f' % pair_sum)
+            report('%s collisions' % name, sum(stat['rx_crc_error'] for stat in stats))
+            report('%s give ups (link, CAD)' % name, '%d, %d' % (sum(stat['link_give_up'] for stat in stats),
+                                                                 sum(stat['cad_give_up'] for stat in stats)))
+
+
+@scenario('measure')
+def tdma_saturation():
+    """Saturated unicast with slotted channel access and CSMA, all nodes in range and hidden nodes"""
+    count = 6
+    size = 150
+    topologies = (('4 nodes in range', 4, None, ((0, 1), (1, 2), (2, 3), (3, 0))),
+                  ('hidden nodes', 3, chain(3), ((0, 1), (2, 1))))
+    for name, nodes, links, flows in topologies:
+        for tdma in (0, 1):
+            with Net(nodes, links, flags=['-DMESH_TDMA=%d' % tdma]) as net:
+                check(net.wait_routes(), 'maps did not settle')
+                # Let the slots and the mesh time settle with a few more maps
+                time.sleep(10 if tdma else 0)
+                sent, stamps = saturate(net, flows, count, size, 10)
+                delivered = sum(len(times) for times in stamps.values())
+                elapsed = max([sent] + sum(stamps.values(), [])) - sent
+                stats = [node.stats() for node in net.nodes]
+                mode = 'TDMA' if tdma else 'CSMA'
+                report('%s, %s delivered' % (name, mode), '%d of %d in %.1f s, %.0f byte/s' %
+                       (delivered, count * len(flows), elapsed, delivered * size / elapsed))
+                report('%s, %s collisions' % (name, mode), sum(stat['rx_crc_error'] for stat in stats))
+                report('%s, %s link give ups' % (name, mode), sum(stat['link_give_up'] for stat in stats))
+
+
+@scenario('measure')
+def adr_links():
+    """Saturated unicast over a chain with short and long links, fixed SF10 and per link data rate"""
+    count = 10
+    size = 150
+    # SNR 9 and -5 allow SF7 and SF9 with ADR_SNR_MARGIN, -12 only the common SF10
+    links = [(0, 1, -60, 9), (1, 2, -100, -5), (2, 3, -115, -12)]
+    flows = ((0, 3),)
+    results = {}
+    for adr in (0, 1):
+        with Net(4, links, flags=['-DLORA_SPREADING_FACTOR=10', '-DMESH_ADR=%d' % adr]) as net:
+            check(net.wait_routes(), 'maps did not settle')
+            for node in net.nodes:
+                node.query('stats reset')
+            sent, stamps = saturate(net, flows, count, size, 60)
+            delivered = sum(len(times) for times in stamps.values())
+            elapsed = max([sent] + sum(stamps.values(), [])) - sent
+            stats = [node.stats() for node in net.nodes]
+            mode = 'ADR' if adr else 'fixed SF10'
+            results[mode] = delivered
+            report('%s delivered' % mode, '%d of %d in %.1f s, %.0f byte/s' %
+                   (delivered, count * len(flows), elapsed, delivered * size / elapsed if elapsed else 0))
+            report('%s TX time of all nodes [s]' % mode, '%.1f' % (sum(stat['radio_tx_ms'] for stat in stats) / 1000))
+            report('%s collisions' % mode, sum(stat['rx_crc_error'] for stat in stats))
+            report('%s link give ups' % mode, sum(stat['link_give_up'] for stat in stats))
+    check(results['ADR'] >= results['fixed SF10'], 'ADR delivered fewer packages than the fixed SF')
+
+
+@scenario('measure')
+def flood_dense():
+    """Broadcasts with full flooding and counter based suppression, a chain and dense networks"""
+    count = 5
+    topologies = (('chain of 5', 5, chain(5)), ('grid 3x3', 9, grid(3)), ('8 nodes in range', 8, None))
+    variants = (('flooding', ['-DMESH_FLOOD_COUNTER=0']),
+                ('counter 3 copies, 4 packages', ['-DMESH_FLOOD_COUNTER=1', '-DFLOOD_COUNT_THRESHOLD=3',
+                                                  '-DFLOOD_RAD_PACKAGES=4']),
+                ('counter default', ['-DMESH_FLOOD_COUNTER=1']))
+    for name, nodes, links in topologies:
+        results = {}
+        for mode, flags in variants:
+            with Net(nodes, links, flags=flags) as net:
+                check(net.wait_routes(), 'maps did not settle')
+                before = [node.stats() for node in net.nodes]
+                starts = [node.mark() for node in net.nodes]
+                for idx in range(count):
+                    net[0].cmd('bcast flood %d' % idx)
+                    time.sleep(3)
+                time.sleep(2)
+                after = [node.stats() for node in net.nodes]
+                reached = sum(net[idx].count('^Data from %s .*: flood \\d+$' % hex_id(0), starts[idx])
+                              for idx in range(1, nodes))
+                rebroadcasts = sum(a['flood_rebroadcast'] - b['flood_rebroadcast'] for a, b in zip(after, before))
+                results[mode] = (reached, rebroadcasts)
+                report('%s, %s reached' % (name, mode), '%d of %d' % (reached, count * (nodes - 1)))
+                report('%s, %s rebroadcasts per broadcast' % (name, mode), '%.1f' % (rebroadcasts / count))
+        check(results['counter default'][0] >= results['flooding'][0],
+              '%s: the counter reached fewer nodes than flooding' % name)
+        check(results['counter default'][1] < results['flooding'][1],
+              '%s: the counter did not save rebroadcasts' % name)
+
+
+@scenario('measure')
+def rx_duty_idle():
+    """Time in RX and current of idle nodes, energy and latency of periodic packages, 8 and 32 symbol preambles"""
+    idle = 30
+    count = 6
+    periods = (3, 15)
+    for preamble in (8, 32):
+        with Net(2, flags=['-DLORA_PREAMBLE_LENGTH=%d' % preamble]) as net:
+            check(net.wait_routes(), 'maps did not settle')
+            # Maps are no traffic, wait until RX_ACTIVE_TIME is over after the start
+            time.sleep(6)
+            net[0].query('stats reset')
+            time.sleep(idle)
+            stats = net[0].stats()
+            modes = ('radio_tx_ms', 'radio_rx_ms', 'radio_rx_duty_ms', 'radio_cad_ms', 'radio_standby_ms')
+            total = sum(stats[mode] for mode in modes)
+            name = 'preamble %d' % preamble
+            # The simulated radio listens continuously in the duty cycle, the share of the
+            # listen window follows from RX_DUTY_RX_SYMBOLS and RX_DUTY_SLEEP_SYMBOLS
+            listen = 2 / (2 + preamble - 2 * 2 - 1)
+            report('%s time in RX duty cycle, continuous RX, TX' % name, '%.1f %%, %.1f %%, %.2f %%' %
+                   (stats['radio_rx_duty_ms'] * 100 / total, stats['radio_rx_ms'] * 100 / total,
+                    stats['radio_tx_ms'] * 100 / total))
+            report('%s listen window of the duty cycle' % name, '%.1f %%' % (listen * 100))
+            report('%s time in RX' % name, '%.1f %%' % ((stats['radio_rx_duty_ms'] * listen + stats['radio_rx_ms']) *
+                                                       100 / total))
+            report('%s average current [uA]' % name, stats['radio_uah_per_hour'])
+
+            # Periodic traffic, the charge of both nodes includes the time between the packages.
+            # Within RX_ACTIVE_TIME the nodes listen continuously, the duty cycle runs only between
+            # packages further apart.
+            for period in periods:
+                for node in net.nodes:
+                    node.query('stats reset')
+                start = net[1].mark()
+                latencies = []
+                for idx in range(count):
+                    sent = time.time()
+                    net[0].cmd('send %s duty %d' % (hex_id(1), idx))
+                    received = net[1].wait_time('^Data from %s .*: duty %d$' % (hex_id(0), idx), period, start)
+                    if received is not None:
+                        latencies.append(received - sent)
+                    time.sleep(max(0, sent + period - time.time()))
+                stats = [node.stats() for node in net.nodes]
+                traffic = '%s, one package every %d s' % (name, period)
+                check(len(latencies) > 0, '%s: no package delivered' % traffic)
+                # uA * ms * mV = 1e-12 J
+                energy = sum(stat['radio_uah_per_hour'] * sum(stat[mode] for mode in modes)
+                             for stat in stats) * 3300 / 1e9
+                report('%s delivered' % traffic, '%d of %d' % (len(latencies), count))
+                report('%s energy of both nodes per delivered package [mJ]' % traffic,
+                       '%.1f' % (energy / len(latencies)))
+                report('%s latency, average and max [ms]' % traffic, '%.0f, %.0f' %
+                       (sum(latencies) * 1000 / len(latencies), max(latencies) * 1000))
+                report('%s TX time per package [ms]' % traffic,
+                       '%.1f' % (stats[0]['radio_tx_ms'] / stats[0]['tx_done']))
+
+
+@scenario('measure')
+def log_volume():
+    """Bytes written to Serial by a 3 node chain with the debug log as text, deferred and tokenized"""
+    count = 10
+    variants = (('text', []), ('deferred', ['-DMYLOG_DEFERRED=1']),
+                ('tokenized', ['-DMYLOG_DEFERRED=1', '-DMYLOG_TOKENIZED=1']))
+    results = {}
+    for mode, flags in variants:
+        with Net(3, chain(3), flags=['-UMYLOG_LOG_LEVEL', '-DMYLOG_LOG_LEVEL=MYLOG_LOG_LEVEL_DEBUG'] + flags) as net:
+            check(net.wait_routes(), 'maps did not settle')
+            start = net[2].mark()
+            before = sum(node.serial_bytes for node in net.nodes)
+            sent = time.time()
+            for idx in range(count):
+                net[0].cmd('send %s log %d' % (hex_id(2), idx))
+                time.sleep(1)
+            time.sleep(2)
+            elapsed = time.time() - sent
+            written = sum(node.serial_bytes for node in net.nodes) - before
+            delivered = net[2].count('^Data from %s .*: log \\d+$' % hex_id(0), start)
+            results[mode] = written
+            report('%s delivered' % mode, '%d of %d' % (delivered, count))
+            report('%s bytes written to Serial' % mode, '%d in %.0f s, %.0f byte/s per node' %
+                   (written, elapsed, written / elapsed / len(net.nodes)))
+    check(results['tokenized'] < results['text'], 'the tokenized log wrote more than the text log')
+
+
+def main(args):
+    if '--list' in args:
+        for name, groups, func in SCENARIOS:
+            print('%-24s %-12s %s' % (name, ','.join(groups), func.__doc__.strip()))
+        return 0
+    selected = args or ['regression']
+    failed = 0
+    for name, groups, func in SCENARIOS:
+        if (name not in selected) and not any(group in selected for group in groups):
+            continue
+        print('%s: %s' % (name, func.__doc__.strip()), flush=True)
+        start = time.time()
+        try:
+            func()
+            print('  passed in %.0f s' % (time.time() - start), flush=True)
+        except Exception:
+            traceback.print_exc()
+            print('  FAILED', flush=True)
+            failed += 1
+    return failed
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
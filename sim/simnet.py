@@ -0,0 +1,289 @@
+"""
+Simulated mesh networks on the host
+Builds the node program of the native environment with g++ and runs one
+process per node, see README.md. Used by scenarios.py.
+"""
+
+import configparser
+import hashlib
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BUILD_DIR = os.path.join(REPO, 'sim', 'build')
+
+# Sources of the native environment, see build_src_filter in platformio.ini
+SOURCE_DIRS = ['src/Mesh', 'src/Log', 'sim']
+SOURCE_EXCLUDE = ['src/Mesh/lora.cpp']
+
+# Faster map syncing, the maps of a few hops settle in seconds
+FAST_SYNC = ['-DINIT_SYNCTIME=5000', '-DDEFAULT_SYNCTIME=10000']
+
+sys.path.insert(0, REPO)
+import log_tokens  # noqa: E402
+
+# Token table of the tokenized log (-DMYLOG_TOKENIZED=1)
+TOKENS = log_tokens.build_table(os.path.join(REPO, 'src'))
+
+
+def native_flags():
+    """Build flags of the native environment from platformio.ini"""
+    config = configparser.ConfigParser(inline_comment_prefixes=(';',))
+    config.read(os.path.join(REPO, 'platformio.ini'))
+    flags = []
+    for line in config['env:native']['build_flags'].splitlines():
+        line = line.split(';')[0].strip()
+        if line:
+            flags.append(line)
+    return flags
+
+
+def sources():
+    files = []
+    for folder in SOURCE_DIRS:
+        for name in sorted(os.listdir(os.path.join(REPO, folder))):
+            path = folder + '/' + name
+            if name.endswith('.cpp') and path not in SOURCE_EXCLUDE:
+                files.append(path)
+    return files
+
+
+def build(flags=()):
+    """
+    Build the node program with extra compiler flags
+    Returns the path of the program, builds are kept in sim/build
+    """
+    flags = native_flags() + ['-Isrc', '-O1'] + list(flags)
+    variant = hashlib.sha1(' '.join(flags).encode()).hexdigest()[:10]
+    out = os.path.join(BUILD_DIR, variant)
+    program = os.path.join(out, 'node')
+    os.makedirs(out, exist_ok=True)
+
+    headers = []
+    for folder in SOURCE_DIRS + ['src']:
+        headers += [os.path.join(REPO, folder, name) for name in os.listdir(os.path.join(REPO, folder))
+                    if name.endswith('.h')]
+    newest_header = max(os.path.getmtime(name) for name in headers)
+
+    def compile_one(source):
+        obj = os.path.join(out, source.replace('/', '_') + '.o')
+        if (os.path.exists(obj) and os.path.getmtime(obj) > newest_header and
+                os.path.getmtime(obj) > os.path.getmtime(os.path.join(REPO, source))):
+            return obj
+        cmd = ['g++', '-std=gnu++17', '-c', source, '-o', obj] + flags
+        result = subprocess.run(cmd, cwd=REPO, capture_output=True, text=True)
+        if result.returncode != 0:
+            raise RuntimeError('Build of %s failed\n%s' % (source, result.stderr))
+        return obj
+
+    with ThreadPoolExecutor(max_workers=os.cpu_count()) as pool:
+        objs = list(pool.map(compile_one, sources()))
+    if not os.path.exists(program) or any(os.path.getmtime(obj) > os.path.getmtime(program) for obj in objs):
+        subprocess.run(['g++', '-pthread', '-o', program] + objs, check=True)
+    return program
+
+
+def node_id(index):
+    """Node ID of a simulated node, see sim/main.cpp"""
+    return 0x5A000000 | ((index + 1) << 8) | (index + 1)
+
+
+def hex_id(index):
+    return '%08X' % node_id(index)
+
+
+class NodeOutput:
+    """
+    Output of a node for log_tokens.decode, frames of the tokenized log are
+    decoded into text lines. Counts the bytes the node wrote to Serial.
+    """
+
+    def __init__(self, node):
+        self.node = node
+        self.pending = ''
+
+    def read(self, size):
+        chunk = self.node.proc.stdout.read1(4096)
+        with self.node.cond:
+            self.node.serial_bytes += len(chunk)
+        return chunk
+
+    def write(self, text):
+        lines = (self.pending + text).split('\n')
+        self.pending = lines.pop()
+        with self.node.cond:
+            for line in lines:
+                self.node.lines.append((time.time(), line))
+            self.node.cond.notify_all()
+
+    def flush(self):
+        pass
+
+
+class Node:
+    """One node process, the output lines are collected with time stamps"""
+
+    def __init__(self, program, index, count, links):
+        self.index = index
+        self.id = node_id(index)
+        self.lines = []
+        self.cond = threading.Condition()
+        self.marks = 0
+        self.serial_bytes = 0
+        self.proc = subprocess.Popen([program, str(index), str(count), links], stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        threading.Thread(target=self._reader, daemon=True).start()
+
+    def _reader(self):
+        output = NodeOutput(self)
+        log_tokens.decode(TOKENS, output, output)
+
+    def cmd(self, text):
+        self.proc.stdin.write((text + '\n').encode())
+        self.proc.stdin.flush()
+
+    def wait(self, pattern, timeout, start=0):
+        """
+        Wait for an output line matching the regular expression
+        Only lines from index start on are checked
+        Returns the match or None after the timeout
+        """
+        regex = re.compile(pattern)
+        end = time.time() + timeout
+        with self.cond:
+            while True:
+                for stamp, line in self.lines[start:]:
+                    match = regex.search(line)
+                    if match:
+                        return match
+                start = len(self.lines)
+                left = end - time.time()
+                if left <= 0:
+                    return None
+                self.cond.wait(left)
+
+    def wait_time(self, pattern, timeout, start=0):
+        """Like wait(), returns the time the line was printed or None after the timeout"""
+        regex = re.compile(pattern)
+        if self.wait(pattern, timeout, start) is None:
+            return None
+        with self.cond:
+            for stamp, line in self.lines[start:]:
+                if regex.search(line):
+                    return stamp
+
+    def count(self, pattern, start=0):
+        """Number of output lines matching the regular expression"""
+        regex = re.compile(pattern)
+        with self.cond:
+            return sum(1 for stamp, line in self.lines[start:] if regex.search(line))
+
+    def mark(self):
+        """Index of the next output line"""
+        with self.cond:
+            return len(self.lines)
+
+    def query(self, text, timeout=10):
+        """Run a command and return its output lines"""
+        self.marks += 1
+        tag = 'end-of-output-%d' % self.marks
+        start = self.mark()
+        self.cmd(text)
+        self.cmd('mark ' + tag)
+        if self.wait('^' + tag + '$', timeout, start) is None:
+            raise RuntimeError('Node %d did not answer %s' % (self.index, text))
+        with self.cond:
+            lines = [line for stamp, line in self.lines[start:]]
+        return lines[:lines.index(tag)]
+
+    def csv(self, text):
+        """Run a command that prints name,value lines and return them as dict"""
+        values = {}
+        for line in self.query(text):
+            match = re.match(r'^(\w+),(-?\d+)$', line)
+            if match:
+                values[match.group(1)] = int(match.group(2))
+        return values
+
+    def stats(self):
+        return self.csv('stats')
+
+    def routes(self):
+        """Node map as dict node ID -> number of relays, 0 for direct nodes"""
+        routes = {}
+        for line in self.query('nodes'):
+            match = re.match(r'^([0-9A-F]{8}) hop ([0-9A-F]{8}) hops (\d+)$', line)
+            if match:
+                routes[int(match.group(1), 16)] = int(match.group(3))
+        return routes
+
+    def stop(self):
+        if self.proc.poll() is None:
+            self.proc.kill()
+            self.proc.wait()
+
+
+class Net:
+    """
+    A simulated network
+    links is a list of (node, node), (node, node, rssi, snr) or
+    (node, node, rssi, snr, loss percentage) tuples, None
+    lets every node hear every node. The nodes are started stagger seconds
+    apart, else they send their first maps at the same time.
+    """
+
+    def __init__(self, count, links=None, flags=(), stagger=1.5):
+        self.count = count
+        self.links = links
+        self.flags = list(flags)
+        self.stagger = stagger
+        self.nodes = []
+        self.linksFile = None
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *args):
+        self.stop()
+
+    def start(self):
+        program = build(FAST_SYNC + self.flags)
+        handle, self.linksFile = tempfile.mkstemp(prefix='simlinks')
+        with os.fdopen(handle, 'w') as links:
+            if self.links is None:
+                for a in range(self.count):
+                    for b in range(a + 1, self.count):
+                        links.write('%d %d\n' % (a, b))
+            else:
+                for link in self.links:
+                    links.write(' '.join(str(value) for value in link) + '\n')
+        for index in range(self.count):
+            if index != 0:
+                time.sleep(self.stagger)
+            self.nodes.append(Node(program, index, self.count, self.linksFile))
+
+    def stop(self):
+        for node in self.nodes:
+            node.stop()
+        if self.linksFile is not None:
+            os.unlink(self.linksFile)
+            self.linksFile = None
+
+    def __getitem__(self, index):
+        return self.nodes[index]
+
+    def wait_routes(self, timeout=60):
+        """Wait until every node has a route to every other node"""
+        end = time.time() + timeout
+        while time.time() < end:
+            if all(len(node.routes()) == self.count - 1 for node in self.nodes):
+                return True
+            time.sleep(1)
+        return False
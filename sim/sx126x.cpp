@@ -0,0 +1,725 @@
+#include "main.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+/**
+ * Simulated SX126x
+ * Every node is one process. A package is sent as UDP datagram on the
+ * loopback interface to the ports of all other nodes, with the channel,
+ * the spreading factor and the time on air. A receiver treats the
+ * datagram as the start of the package on air:
+ * - RX done after the time on air, if the receiver listened on the same
+ *   channel and spreading factor during the whole package
+ * - RX error if another package on the same channel overlapped (no
+ *   capture effect)
+ * - CAD reports busy if a package on the channel and spreading factor
+ *   overlapped the 8 CAD symbols
+ * - a node that sends does not receive
+ * TX done is raised after the time on air. After every event the radio
+ * is in standby, like the SX126x. The RX duty cycle is simulated as
+ * continuous RX.
+ * The links between the nodes come from a file with lines
+ * "node node [rssi snr [loss]]" (node indexes, links are both ways, loss
+ * is the percentage of packages the receiver does not hear, # starts a
+ * comment). Without a file every node hears every node. A package with
+ * a link SNR below the SNR its spreading factor needs is not heard.
+ */
+
+/** UDP port of node 0, node n uses SIM_PORT + n */
+#ifndef SIM_PORT
+#define SIM_PORT 47000
+#endif
+/** Max number of simulated nodes */
+#define SIM_MAX_NODES 64
+/** RSSI and SNR of a link without values in the links file */
+#define SIM_RSSI -60
+#define SIM_SNR 9
+/** Pin of the DIO1 interrupt */
+#define SIM_PIN_DIO1 1
+/** Datagram header: magic, sender, sf, bw, cr, spare, frequency, time on air */
+#define SIM_HEADER_SIZE 14
+#define SIM_MAGIC 0x5A
+
+hw_config _hwConfig = {SX1262_CHIP, 0, 0, 0, 0, SIM_PIN_DIO1, 0, 0, -1, -1, false, false, false, false, false};
+
+enum simMode
+{
+	SIM_STANDBY = 0,
+	SIM_SLEEP,
+	SIM_RX,
+	SIM_TX,
+	SIM_CAD
+};
+
+enum simEventType
+{
+	SIM_TX_DONE = 0,
+	SIM_RX_DONE,
+	SIM_RX_ERROR,
+	SIM_CAD_DONE
+};
+
+struct simEvent
+{
+	simEventType type;
+	bool busy;
+	int16_t rssi;
+	int8_t snr;
+	std::vector<uint8_t> payload;
+};
+
+/** Package on air heard by this node */
+struct simAir
+{
+	uint64_t start;
+	uint64_t end;
+	uint32_t freq;
+	uint8_t sf;
+	int16_t rssi;
+	int8_t snr;
+	bool collided;
+	bool done;
+	std::vector<uint8_t> payload;
+};
+
+/** Index of this node */
+static uint8_t simIndex = 0;
+/** Number of nodes */
+static uint8_t simCount = 0;
+/** Links to the other nodes */
+static bool simLinked[SIM_MAX_NODES];
+static int16_t simRssi[SIM_MAX_NODES];
+static int8_t simSnr[SIM_MAX_NODES];
+static uint8_t simLoss[SIM_MAX_NODES];
+/** Random numbers for the lost packages, separate from the random numbers of the mesh */
+static std::minstd_rand simLossRandom;
+/** UDP socket */
+static int simSocket = -1;
+/** Pipe that wakes up the radio thread when the mesh starts TX or CAD */
+static int simWakePipe[2] = {-1, -1};
+
+/** Lock of the radio state, the radio thread and the mesh task use it */
+static std::mutex simLock;
+static RadioEvents_t *simEvents = NULL;
+static simMode mode = SIM_STANDBY;
+static uint32_t freq = RF_FREQUENCY;
+static uint8_t txSf = LORA_SPREADING_FACTOR;
+static uint8_t rxSf = LORA_SPREADING_FACTOR;
+static uint8_t bandwidth = LORA_BANDWIDTH;
+static uint8_t codingRate = LORA_CODINGRATE;
+static uint16_t preamble = LORA_PREAMBLE_LENGTH;
+/** Time RX was started [us] */
+static uint64_t rxSince = 0;
+/** End of the own transmission [us] */
+static uint64_t txEnd = 0;
+/** Start and end of the CAD [us] */
+static uint64_t cadStart = 0;
+static uint64_t cadEnd = 0;
+/** Packages on air */
+static std::vector<simAir> simOnAir;
+/** Events waiting for Radio.IrqProcess() */
+static std::vector<simEvent> simPending;
+/** Number of commands that change the state of the radio, each is an SPI transaction on the SX126x */
+static uint32_t simCommands = 0;
+
+/** Start time of the radio */
+static const std::chrono::steady_clock::time_point simEpoch = std::chrono::steady_clock::now();
+
+/** Time [us] */
+static uint64_t simNow(void)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - simEpoch).count();
+}
+
+/**
+ * Read the links file
+ * @return bool
+ * 		False if the file can not be read
+ */
+static bool simReadLinks(const char *links)
+{
+	for (int idx = 0; idx < SIM_MAX_NODES; idx++)
+	{
+		simLinked[idx] = (links == NULL);
+		simRssi[idx] = SIM_RSSI;
+		simSnr[idx] = SIM_SNR;
+		simLoss[idx] = 0;
+	}
+	if (links == NULL)
+	{
+		return true;
+	}
+	FILE *file = fopen(links, "r");
+	if (file == NULL)
+	{
+		return false;
+	}
+	char line[128];
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		int nodeA, nodeB, rssi = SIM_RSSI, snr = SIM_SNR, loss = 0;
+		if ((line[0] == '#') || (sscanf(line, "%d %d %d %d %d", &nodeA, &nodeB, &rssi, &snr, &loss) < 2))
+		{
+			continue;
+		}
+		int other = nodeA == simIndex ? nodeB : (nodeB == simIndex ? nodeA : -1);
+		if ((other >= 0) && (other < SIM_MAX_NODES))
+		{
+			simLinked[other] = true;
+			simRssi[other] = rssi;
+			simSnr[other] = snr;
+			simLoss[other] = loss;
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+/**
+ * Queue an event, the radio is in standby afterwards
+ * Must be called with simLock held
+ */
+static void simRaise(simEventType type, bool busy = false, const simAir *air = NULL)
+{
+	simEvent event;
+	event.type = type;
+	event.busy = busy;
+	event.rssi = air != NULL ? air->rssi : 0;
+	event.snr = air != NULL ? air->snr : 0;
+	if ((air != NULL) && (type == SIM_RX_DONE))
+	{
+		event.payload = air->payload;
+	}
+	simPending.push_back(event);
+	mode = SIM_STANDBY;
+}
+
+/**
+ * A datagram from another node, a package starts on air
+ * Must be called with simLock held
+ */
+static void simStartAir(uint8_t *data, ssize_t len)
+{
+	if ((len < SIM_HEADER_SIZE) || (data[0] != SIM_MAGIC) || (data[1] >= SIM_MAX_NODES) || !simLinked[data[1]])
+	{
+		return;
+	}
+	if ((simLoss[data[1]] != 0) && ((simLossRandom() % 100) < simLoss[data[1]]))
+	{
+		return;
+	}
+	if (simSnr[data[1]] < loraRequiredSnr(data[2]))
+	{
+		return;
+	}
+	uint64_t now = simNow();
+	simAir air;
+	air.start = now;
+	air.end = now + (data[10] | (data[11] << 8) | (data[12] << 16) | ((uint32_t)data[13] << 24));
+	air.freq = data[6] | (data[7] << 8) | (data[8] << 16) | ((uint32_t)data[9] << 24);
+	air.sf = data[2];
+	air.rssi = simRssi[data[1]];
+	air.snr = simSnr[data[1]];
+	air.collided = false;
+	air.done = false;
+	air.payload.assign(data + SIM_HEADER_SIZE, data + len);
+	for (simAir &other : simOnAir)
+	{
+		if (!other.done && (other.freq == air.freq) && (other.end > now))
+		{
+			other.collided = true;
+			air.collided = true;
+		}
+	}
+	simOnAir.push_back(air);
+}
+
+/**
+ * Raise the events that are due
+ * Must be called with simLock held
+ * @return uint64_t
+ * 		Time of the next event [us], 0 if none
+ */
+static uint64_t simProcess(void)
+{
+	uint64_t now = simNow();
+	uint64_t next = 0;
+
+	if (mode == SIM_TX)
+	{
+		if (now >= txEnd)
+		{
+			simRaise(SIM_TX_DONE);
+		}
+		else
+		{
+			next = txEnd;
+		}
+	}
+
+	if (mode == SIM_CAD)
+	{
+		if (now >= cadEnd)
+		{
+			bool busy = false;
+			for (simAir &air : simOnAir)
+			{
+				if ((air.freq == freq) && (air.sf == rxSf) && (air.start < cadEnd) && (air.end > cadStart))
+				{
+					busy = true;
+				}
+			}
+			simRaise(SIM_CAD_DONE, busy);
+		}
+		else
+		{
+			next = cadEnd;
+		}
+	}
+
+	for (simAir &air : simOnAir)
+	{
+		if (air.done)
+		{
+			continue;
+		}
+		if (now < air.end)
+		{
+			next = ((next == 0) || (air.end < next)) ? air.end : next;
+			continue;
+		}
+		air.done = true;
+		// Only if the receiver listened during the whole package
+		if ((mode == SIM_RX) && (rxSince <= air.start) && (air.freq == freq) && (air.sf == rxSf))
+		{
+			simRaise(air.collided ? SIM_RX_ERROR : SIM_RX_DONE, false, &air);
+		}
+	}
+
+	// Keep finished packages for the CAD for a while
+	for (size_t idx = 0; idx < simOnAir.size();)
+	{
+		if (simOnAir[idx].done && ((simOnAir[idx].end + 1000000) < now))
+		{
+			simOnAir.erase(simOnAir.begin() + idx);
+		}
+		else
+		{
+			idx++;
+		}
+	}
+	return next;
+}
+
+/**
+ * Wake up the radio thread, it waits for the next event of the old mode
+ */
+static void simWake(void)
+{
+	uint8_t wake = 0;
+	if (write(simWakePipe[1], &wake, 1) < 0)
+	{
+		// The pipe is full, the radio thread wakes up anyway
+	}
+}
+
+/**
+ * Radio thread, receives the datagrams and raises the events
+ */
+static void simRadioThread(void)
+{
+	uint8_t data[SIM_HEADER_SIZE + 256];
+	while (true)
+	{
+		int timeout = 100;
+		{
+			std::lock_guard<std::mutex> guard(simLock);
+			uint64_t next = simProcess();
+			if (next != 0)
+			{
+				uint64_t now = simNow();
+				timeout = next > now ? (int)((next - now + 999) / 1000) : 0;
+				timeout = timeout > 100 ? 100 : timeout;
+			}
+		}
+
+		struct pollfd fds[2] = {{simSocket, POLLIN, 0}, {simWakePipe[0], POLLIN, 0}};
+		if (poll(fds, 2, timeout) > 0)
+		{
+			ssize_t len;
+			while ((len = recv(simSocket, data, sizeof(data), MSG_DONTWAIT)) > 0)
+			{
+				std::lock_guard<std::mutex> guard(simLock);
+				simStartAir(data, len);
+			}
+			while (read(simWakePipe[0], data, sizeof(data)) > 0)
+			{
+			}
+		}
+
+		bool raise;
+		{
+			std::lock_guard<std::mutex> guard(simLock);
+			simProcess();
+			raise = !simPending.empty();
+		}
+		if (raise)
+		{
+			simInterrupt(SIM_PIN_DIO1);
+		}
+	}
+}
+
+bool simRadioInit(uint8_t index, uint8_t count, const char *links)
+{
+	if ((index >= count) || (count > SIM_MAX_NODES))
+	{
+		return false;
+	}
+	simIndex = index;
+	simCount = count;
+	simLossRandom.seed(index + 1);
+	if (!simReadLinks(links))
+	{
+		fprintf(stderr, "Can not read links file %s\n", links);
+		return false;
+	}
+
+	simSocket = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(SIM_PORT + index);
+	if ((simSocket < 0) || (bind(simSocket, (struct sockaddr *)&addr, sizeof(addr)) != 0))
+	{
+		fprintf(stderr, "Can not bind UDP port %d\n", SIM_PORT + index);
+		return false;
+	}
+	if ((pipe(simWakePipe) != 0) || (fcntl(simWakePipe[0], F_SETFL, O_NONBLOCK) != 0) ||
+		(fcntl(simWakePipe[1], F_SETFL, O_NONBLOCK) != 0))
+	{
+		fprintf(stderr, "Can not create the wake up pipe\n");
+		return false;
+	}
+	std::thread(simRadioThread).detach();
+	return true;
+}
+
+void RadioOnDioIrq(void)
+{
+	// The events are queued by the radio thread already
+}
+
+static void simInit(RadioEvents_t *events)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	simEvents = events;
+	mode = SIM_STANDBY;
+}
+
+static RadioState_t simGetStatus(void)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	switch (mode)
+	{
+	case SIM_RX:
+		return RF_RX_RUNNING;
+	case SIM_TX:
+		return RF_TX_RUNNING;
+	case SIM_CAD:
+		return RF_CAD;
+	default:
+		return RF_IDLE;
+	}
+}
+
+static void simSetChannel(uint32_t frequency)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	simCommands++;
+	freq = frequency;
+}
+
+static uint32_t simRandom(void)
+{
+	return (uint32_t)random(0, 0x7FFFFFFF);
+}
+
+static void simSetRxConfig(RadioModems_t modem, uint32_t bw, uint32_t datarate, uint8_t coderate,
+						   uint32_t bandwidthAfc, uint16_t preambleLen, uint16_t symbTimeout, bool fixLen,
+						   uint8_t payloadLen, bool crcOn, bool freqHopOn, uint8_t hopPeriod, bool iqInverted,
+						   bool rxContinuous)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	simCommands++;
+	rxSf = datarate;
+}
+
+static void simSetTxConfig(RadioModems_t modem, int8_t power, uint32_t fdev, uint32_t bw, uint32_t datarate,
+						   uint8_t coderate, uint16_t preambleLen, bool fixLen, bool crcOn, bool freqHopOn,
+						   uint8_t hopPeriod, bool iqInverted, uint32_t timeout)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	simCommands++;
+	txSf = datarate;
+	bandwidth = bw;
+	codingRate = coderate;
+	preamble = preambleLen;
+}
+
+/**
+ * Write the datagram header
+ * @return uint32_t
+ * 		Time on air [us]
+ */
+static uint32_t simHeader(uint8_t *data, uint8_t sender, uint8_t size, uint8_t sf, uint8_t bw, uint8_t cr,
+						  uint16_t preambleLen, uint32_t frequency)
+{
+	uint32_t timeOnAir = loraTimeOnAirUs(size, sf, bw, cr, preambleLen);
+	data[0] = SIM_MAGIC;
+	data[1] = sender;
+	data[2] = sf;
+	data[3] = bw;
+	data[4] = cr;
+	data[5] = 0;
+	data[6] = frequency & 0xFF;
+	data[7] = (frequency >> 8) & 0xFF;
+	data[8] = (frequency >> 16) & 0xFF;
+	data[9] = (frequency >> 24) & 0xFF;
+	data[10] = timeOnAir & 0xFF;
+	data[11] = (timeOnAir >> 8) & 0xFF;
+	data[12] = (timeOnAir >> 16) & 0xFF;
+	data[13] = (timeOnAir >> 24) & 0xFF;
+	return timeOnAir;
+}
+
+/**
+ * Send a datagram to all other nodes, nodes that are not running drop it
+ */
+static void simBroadcast(int sock, uint8_t sender, uint8_t *data, size_t len)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for (int idx = 0; idx < simCount; idx++)
+	{
+		if (idx != sender)
+		{
+			addr.sin_port = htons(SIM_PORT + idx);
+			sendto(sock, data, len, 0, (struct sockaddr *)&addr, sizeof(addr));
+		}
+	}
+}
+
+static void simSend(uint8_t *buffer, uint8_t size)
+{
+	uint8_t data[SIM_HEADER_SIZE + 256];
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		simCommands++;
+		uint32_t timeOnAir = simHeader(data, simIndex, size, txSf, bandwidth, codingRate, preamble, freq);
+		mode = SIM_TX;
+		txEnd = simNow() + timeOnAir;
+	}
+	memcpy(&data[SIM_HEADER_SIZE], buffer, size);
+	simBroadcast(simSocket, simIndex, data, SIM_HEADER_SIZE + size);
+	simWake();
+}
+
+static void simSleep(void)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	simCommands++;
+	mode = SIM_SLEEP;
+}
+
+static void simStandby(void)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	simCommands++;
+	mode = SIM_STANDBY;
+}
+
+static void simRx(uint32_t timeout)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	simCommands++;
+	if (mode != SIM_RX)
+	{
+		mode = SIM_RX;
+		rxSince = simNow();
+	}
+}
+
+static void simSetCadParams(uint8_t cadSymbolNum, uint8_t cadDetPeak, uint8_t cadDetMin, uint8_t cadExitMode,
+							uint32_t cadTimeout)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	simCommands++;
+}
+
+static void simStartCad(void)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	simCommands++;
+	mode = SIM_CAD;
+	cadStart = simNow();
+	cadEnd = cadStart + 8 * loraSymbolTimeUs(rxSf, bandwidth);
+	simWake();
+}
+
+static void simIrqProcess(void)
+{
+	std::vector<simEvent> events;
+	RadioEvents_t *callbacks;
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		events.swap(simPending);
+		callbacks = simEvents;
+	}
+	if (callbacks == NULL)
+	{
+		return;
+	}
+	for (simEvent &event : events)
+	{
+		switch (event.type)
+		{
+		case SIM_TX_DONE:
+			if (callbacks->TxDone != NULL)
+			{
+				callbacks->TxDone();
+			}
+			break;
+		case SIM_RX_DONE:
+			if (callbacks->RxDone != NULL)
+			{
+				callbacks->RxDone(event.payload.data(), event.payload.size(), event.rssi, event.snr);
+			}
+			break;
+		case SIM_RX_ERROR:
+			if (callbacks->RxError != NULL)
+			{
+				callbacks->RxError();
+			}
+			break;
+		case SIM_CAD_DONE:
+			if (callbacks->CadDone != NULL)
+			{
+				callbacks->CadDone(event.busy);
+			}
+			break;
+		}
+	}
+}
+
+static void simSetRxDutyCycle(uint32_t rxTime, uint32_t sleepTime)
+{
+	// The preamble is long enough for the duty cycle, simulated as continuous RX
+	simRx(0);
+}
+
+uint32_t simRadioCommands(void)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	return simCommands;
+}
+
+const struct Radio_s Radio = {
+	simInit,
+	simGetStatus,
+	simSetChannel,
+	simRandom,
+	simSetRxConfig,
+	simSetTxConfig,
+	simSend,
+	simSleep,
+	simStandby,
+	simRx,
+	simSetCadParams,
+	simStartCad,
+	simIrqProcess,
+	simSetRxDutyCycle,
+};
+
+/**
+ * Simulated peer for the host tests
+ * A node without mesh, the test sends and receives raw packages with it.
+ * It sends on the rendezvous channel with the common rate and receives
+ * every package sent to it. Sending and receiving take the time on air.
+ */
+
+/** UDP socket of the peer */
+static int simPeerSocket = -1;
+/** Index of the peer */
+static uint8_t simPeerIndex = 0;
+
+bool simPeerInit(uint8_t index)
+{
+	if ((index >= simCount) || (index == simIndex))
+	{
+		return false;
+	}
+	simPeerIndex = index;
+	simPeerSocket = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(SIM_PORT + index);
+	if ((simPeerSocket < 0) || (bind(simPeerSocket, (struct sockaddr *)&addr, sizeof(addr)) != 0))
+	{
+		fprintf(stderr, "Can not bind UDP port %d\n", SIM_PORT + index);
+		return false;
+	}
+	return true;
+}
+
+void simPeerSend(uint8_t *buffer, uint8_t size)
+{
+	uint8_t data[SIM_HEADER_SIZE + 256];
+	uint32_t timeOnAir = simHeader(data, simPeerIndex, size, LORA_SPREADING_FACTOR, LORA_BANDWIDTH, LORA_CODINGRATE,
+								   LORA_PREAMBLE_LENGTH, RF_FREQUENCY);
+	memcpy(&data[SIM_HEADER_SIZE], buffer, size);
+	simBroadcast(simPeerSocket, simPeerIndex, data, SIM_HEADER_SIZE + size);
+	std::this_thread::sleep_for(std::chrono::microseconds(timeOnAir));
+}
+
+int16_t simPeerReceive(uint8_t *buffer, uint32_t timeout)
+{
+	uint8_t data[SIM_HEADER_SIZE + 256];
+	uint64_t end = simNow() + (uint64_t)timeout * 1000;
+	while (true)
+	{
+		uint64_t now = simNow();
+		if (now >= end)
+		{
+			return -1;
+		}
+		struct pollfd fd = {simPeerSocket, POLLIN, 0};
+		if (poll(&fd, 1, (int)((end - now + 999) / 1000)) <= 0)
+		{
+			continue;
+		}
+		ssize_t len = recv(simPeerSocket, data, sizeof(data), 0);
+		if ((len >= SIM_HEADER_SIZE) && (data[0] == SIM_MAGIC))
+		{
+			// Received after the time on air
+			std::this_thread::sleep_for(std::chrono::microseconds(
+				data[10] | (data[11] << 8) | (data[12] << 16) | ((uint32_t)data[13] << 24)));
+			memcpy(buffer, &data[SIM_HEADER_SIZE], len - SIM_HEADER_SIZE);
+			return len - SIM_HEADER_SIZE;
+		}
+	}
+}
@@ -115,4 +115,8 @@ extern "C"
 }
 #endif
 
+#if MYLOG_DEFERRED > 0
+#include "my-log_defer.h"
+#endif
+
 #endif /* __MY_LOG_H__ */
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include <Arduino.h>
+#ifdef ESP32
+#include "my-log.h"
+#else
+#include "my-log_nrf52.h"
+#endif
+
+#if MYLOG_DEFERRED > 0
+
+static_assert((MYLOG_DEFER_RECORDS & (MYLOG_DEFER_RECORDS - 1)) == 0, "MYLOG_DEFER_RECORDS must be a power of 2");
+
+/** Time the logger task sleeps if the ring buffer is empty [ms] */
+#define MYLOG_DEFER_PERIOD 20
+
+/** Ring buffer of log records */
+static myLogRecord logRing[MYLOG_DEFER_RECORDS];
+/** Counter of reserved records, free running */
+static volatile uint32_t logHead = 0;
+/** Counter of printed records, free running */
+static volatile uint32_t logTail = 0;
+/** Number of records dropped because the ring buffer was full */
+uint32_t myLogDrops = 0;
+
+/** Logger task handle */
+static TaskHandle_t logTaskHandle = NULL;
+
+/**
+ * Reserve a record in the ring buffer
+ * Lock free, can be called from any task
+ * @return myLogRecord*
+ * 		Record to fill, NULL if the ring buffer is full
+ */
+myLogRecord *myLogReserve(void)
+{
+	uint32_t head = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+	do
+	{
+		if ((head - __atomic_load_n(&logTail, __ATOMIC_ACQUIRE)) >= MYLOG_DEFER_RECORDS)
+		{
+			__atomic_fetch_add(&myLogDrops, 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+	} while (!__atomic_compare_exchange_n(&logHead, &head, head + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	myLogRecord *rec = &logRing[head % MYLOG_DEFER_RECORDS];
+	rec->time = millis();
+	rec->str[0] = 0;
+	return rec;
+}
+
+/**
+ * Hand a filled record over to the logger task
+ * @param rec
+ * 		Record returned by myLogReserve()
+ */
+void myLogCommit(myLogRecord *rec)
+{
+	__atomic_store_n(&rec->ready, 1, __ATOMIC_RELEASE);
+}
+
+#if MYLOG_TOKENIZED > 0
+/**
+ * Write a binary log frame to Serial
+ * @param token
+ * 		Token of the format string, 0 for dropped records
+ * @param time
+ * 		Time of the record [ms]
+ * @param level
+ * 		Level letter
+ * @param numArgs
+ * 		Number of arguments
+ * @param args
+ * 		Arguments
+ * @param str
+ * 		Copied string argument, empty if none
+ */
+static void myLogWriteFrame(uint32_t token, uint32_t time, char level, uint8_t numArgs, const uintptr_t *args, const char *str)
+{
+	uint8_t frame[2 + 10 + MYLOG_DEFER_ARGS * 4 + MYLOG_DEFER_STR + 1];
+	uint8_t len = 2;
+	for (int idx = 0; idx < 4; idx++)
+	{
+		frame[len++] = (token >> (idx * 8)) & 0xFF;
+	}
+	for (int idx = 0; idx < 4; idx++)
+	{
+		frame[len++] = (time >> (idx * 8)) & 0xFF;
+	}
+	frame[len++] = level;
+	frame[len++] = numArgs;
+	for (int arg = 0; arg < numArgs; arg++)
+	{
+		for (int idx = 0; idx < 4; idx++)
+		{
+			frame[len++] = ((uint32_t)args[arg] >> (idx * 8)) & 0xFF;
+		}
+	}
+	while (*str)
+	{
+		frame[len++] = *str++;
+	}
+	frame[0] = MYLOG_TOKEN_SYNC;
+	frame[1] = len - 2;
+	uint8_t check = 0;
+	for (int idx = 2; idx < len; idx++)
+	{
+		check ^= frame[idx];
+	}
+	frame[len++] = check;
+	Serial.write(frame, len);
+}
+
+/**
+ * Write a record as binary frame
+ * @param rec
+ * 		Record to print
+ */
+static void myLogPrint(myLogRecord *rec)
+{
+	myLogWriteFrame(rec->token, rec->time, rec->level, rec->numArgs, rec->args, rec->str);
+}
+#else
+/**
+ * Format and print a record
+ * @param rec
+ * 		Record to print
+ */
+static void myLogPrint(myLogRecord *rec)
+{
+	char msg[256];
+	snprintf(msg, sizeof(msg), rec->format, rec->args[0], rec->args[1], rec->args[2], rec->args[3]);
+#ifdef ESP32
+	log_printf("%lu [%c][%s:%u] %s(): %s\r\n", (unsigned long)rec->time, rec->level, pathToFileName(rec->file), rec->line, rec->func, msg);
+#else
+	PRINTF("%lu [%c][%s:%d]%s: %s\n", (unsigned long)rec->time, rec->level, pathToFileNameNRF(rec->file), rec->line, rec->func, msg);
+#endif
+}
+#endif
+
+/**
+ * Print all finished records
+ * Must only be called from one task, usually the logger task
+ * @return bool
+ * 		true if records were printed
+ */
+bool myLogFlush(void)
+{
+	uint32_t tail = logTail;
+	bool printed = false;
+	while (tail != __atomic_load_n(&logHead, __ATOMIC_ACQUIRE))
+	{
+		myLogRecord *rec = &logRing[tail % MYLOG_DEFER_RECORDS];
+		if (!__atomic_load_n(&rec->ready, __ATOMIC_ACQUIRE))
+		{
+			// Record is still written, records are printed in order
+			break;
+		}
+		myLogPrint(rec);
+		rec->ready = 0;
+		tail++;
+		__atomic_store_n(&logTail, tail, __ATOMIC_RELEASE);
+		printed = true;
+	}
+	return printed;
+}
+
+/**
+ * Logger task, prints the records with low priority
+ * @param pvParameters
+ * 		Unused
+ */
+static void myLogTask(void *pvParameters)
+{
+	uint32_t reportedDrops = 0;
+	while (1)
+	{
+		if (!myLogFlush())
+		{
+			vTaskDelay(MYLOG_DEFER_PERIOD / portTICK_PERIOD_MS);
+		}
+		if (myLogDrops != reportedDrops)
+		{
+			reportedDrops = myLogDrops;
+#if MYLOG_TOKENIZED > 0
+			uintptr_t drops = reportedDrops;
+			myLogWriteFrame(0, millis(), 'W', 1, &drops, "");
+#elif defined(ESP32)
+			log_printf("[W] %lu log records dropped\r\n", (unsigned long)reportedDrops);
+#else
+			PRINTF("[W] %lu log records dropped\n", (unsigned long)reportedDrops);
+#endif
+		}
+	}
+}
+
+/**
+ * Start the logger task
+ */
+void myLogInit(void)
+{
+	if (logTaskHandle != NULL)
+	{
+		return;
+	}
+	if (!xTaskCreate(myLogTask, "Log", 2048, NULL, tskIDLE_PRIORITY, &logTaskHandle))
+	{
+		logTaskHandle = NULL;
+	}
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef __MY_LOG_DEFER_H__
+#define __MY_LOG_DEFER_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+/**
+ * Deferred logging, enabled with -DMYLOG_DEFERRED=1
+ * The myLog_x macros do not format and print the message. The call site
+ * writes a fixed size binary record with the format string pointer as
+ * format ID, the source location and the raw arguments into a lock free
+ * ring buffer. The logger task formats and prints the records later with
+ * low priority, so logging from the mesh task costs only the copy.
+ * Supported are up to MYLOG_DEFER_ARGS integer, char or pointer arguments.
+ * The first %s string is copied into the record (max MYLOG_DEFER_STR - 1 chars),
+ * because the buffer it points to may be reused before the record is printed.
+ * Floating point and 64 bit arguments are not supported.
+ * If the ring buffer is full the record is dropped and counted in myLogDrops.
+ *
+ * Tokenized logging, enabled with -DMYLOG_TOKENIZED=1 on top of MYLOG_DEFERRED
+ * The format string is replaced by a 32 bit FNV-1a hash that is computed at
+ * compile time. Format strings, file and function names are not referenced
+ * and do not end up in flash. The logger task writes binary frames with the
+ * token and the raw arguments to Serial:
+ * [0] MYLOG_TOKEN_SYNC
+ * [1] payload size
+ * [2..5] token
+ * [6..9] time [ms]
+ * [10] level letter
+ * [11] number of arguments
+ * [12..] arguments, 4 bytes each, followed by the copied string if any
+ * [last] XOR of the payload bytes
+ * All values are little endian. Token 0 reports dropped records.
+ * log_tokens.py creates the token table from the sources and decodes the frames.
+ */
+
+/** Number of records in the ring buffer, must be a power of 2 */
+#ifndef MYLOG_DEFER_RECORDS
+#define MYLOG_DEFER_RECORDS 32
+#endif
+/** Max number of arguments of a log call */
+#define MYLOG_DEFER_ARGS 4
+/** Size of the string copy in a record */
+#define MYLOG_DEFER_STR 24
+
+/** Start of a binary log frame */
+#define MYLOG_TOKEN_SYNC 0xA5
+
+struct myLogRecord
+{
+#if MYLOG_TOKENIZED > 0
+	uint32_t token;
+#else
+	const char *format;
+	const char *file;
+	const char *func;
+	uint16_t line;
+#endif
+	uint32_t time;
+	char level;
+	uint8_t numArgs;
+	volatile uint8_t ready;
+	uintptr_t args[MYLOG_DEFER_ARGS];
+	char str[MYLOG_DEFER_STR];
+};
+
+myLogRecord *myLogReserve(void);
+void myLogCommit(myLogRecord *rec);
+void myLogInit(void);
+bool myLogFlush(void);
+extern uint32_t myLogDrops;
+
+/** Raw value of an integer or char argument */
+template <typename T>
+inline uintptr_t myLogArg(myLogRecord *rec, T value)
+{
+	static_assert(!std::is_floating_point<T>::value, "Deferred logging does not support floating point arguments");
+	return (uintptr_t)value;
+}
+
+/** Raw value of a pointer argument */
+template <typename T>
+inline uintptr_t myLogArg(myLogRecord *rec, T *value)
+{
+	return (uintptr_t)value;
+}
+
+/** Copy of a string argument */
+inline uintptr_t myLogArg(myLogRecord *rec, const char *value)
+{
+	if (rec->str[0] != 0)
+	{
+		// Only one string per record
+		return (uintptr_t) "...";
+	}
+	strncpy(rec->str, value, MYLOG_DEFER_STR - 1);
+	rec->str[MYLOG_DEFER_STR - 1] = 0;
+	return (uintptr_t)rec->str;
+}
+
+inline uintptr_t myLogArg(myLogRecord *rec, char *value)
+{
+	return myLogArg(rec, (const char *)value);
+}
+
+inline void myLogFill(myLogRecord *rec, uint8_t idx)
+{
+}
+
+template <typename T, typename... Args>
+inline void myLogFill(myLogRecord *rec, uint8_t idx, T value, Args... args)
+{
+	rec->args[idx] = myLogArg(rec, value);
+	myLogFill(rec, idx + 1, args...);
+}
+
+#if MYLOG_TOKENIZED > 0
+/**
+ * FNV-1a hash of a format string
+ * Must match the hash in log_tokens.py
+ */
+constexpr uint32_t myLogHash(const char *str, uint32_t hash = 2166136261UL)
+{
+	return (*str == 0) ? hash : myLogHash(str + 1, (hash ^ (uint8_t)*str) * 16777619UL);
+}
+
+/**
+ * Write a tokenized log record into the ring buffer
+ * @param level
+ * 		Level letter
+ * @param token
+ * 		Hash of the format string
+ * @param args
+ * 		Arguments
+ */
+template <typename... Args>
+inline void myLogDeferToken(char level, uint32_t token, Args... args)
+{
+	static_assert(sizeof...(Args) <= MYLOG_DEFER_ARGS, "Too many arguments for deferred logging");
+	myLogRecord *rec = myLogReserve();
+	if (rec == NULL)
+	{
+		return;
+	}
+	rec->level = level;
+	rec->token = token;
+	rec->numArgs = sizeof...(Args);
+	myLogFill(rec, 0, args...);
+	myLogCommit(rec);
+}
+
+// integral_constant forces the hash to be computed at compile time
+#define MYLOG_DEFER(level, format, ...) myLogDeferToken(level, std::integral_constant<uint32_t, myLogHash(format)>::value, ##__VA_ARGS__)
+#else
+/**
+ * Write a log record into the ring buffer
+ * @param level
+ * 		Level letter
+ * @param file
+ * 		Source file
+ * @param line
+ * 		Source line
+ * @param func
+ * 		Function name
+ * @param format
+ * 		Format string, must be a literal
+ * @param args
+ * 		Arguments
+ */
+template <typename... Args>
+inline void myLogDefer(char level, const char *file, uint16_t line, const char *func, const char *format, Args... args)
+{
+	static_assert(sizeof...(Args) <= MYLOG_DEFER_ARGS, "Too many arguments for deferred logging");
+	myLogRecord *rec = myLogReserve();
+	if (rec == NULL)
+	{
+		return;
+	}
+	rec->level = level;
+	rec->file = file;
+	rec->line = line;
+	rec->func = func;
+	rec->format = format;
+	rec->numArgs = sizeof...(Args);
+	myLogFill(rec, 0, args...);
+	myLogCommit(rec);
+}
+
+#define MYLOG_DEFER(level, ...) myLogDefer(level, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#endif
+
+#undef myLog_v
+#undef myLog_d
+#undef myLog_i
+#undef myLog_w
+#undef myLog_e
+#undef myLog_n
+
+#if MYLOG_LOG_LEVEL >= MYLOG_LOG_LEVEL_VERBOSE
+#define myLog_v(...) MYLOG_DEFER('V', __VA_ARGS__)
+#else
+#define myLog_v(...)
+#endif
+
+#if MYLOG_LOG_LEVEL >= MYLOG_LOG_LEVEL_DEBUG
+#define myLog_d(...) MYLOG_DEFER('D', __VA_ARGS__)
+#else
+#define myLog_d(...)
+#endif
+
+#if MYLOG_LOG_LEVEL >= MYLOG_LOG_LEVEL_INFO
+#define myLog_i(...) MYLOG_DEFER('I', __VA_ARGS__)
+#else
+#define myLog_i(...)
+#endif
+
+#if MYLOG_LOG_LEVEL >= MYLOG_LOG_LEVEL_WARN
+#define myLog_w(...) MYLOG_DEFER('W', __VA_ARGS__)
+#else
+#define myLog_w(...)
+#endif
+
+#if MYLOG_LOG_LEVEL >= MYLOG_LOG_LEVEL_ERROR
+#define myLog_e(...) MYLOG_DEFER('E', __VA_ARGS__)
+#else
+#define myLog_e(...)
+#endif
+
+#define myLog_n(...) MYLOG_DEFER('N', __VA_ARGS__)
+
+#endif /* __MY_LOG_DEFER_H__ */
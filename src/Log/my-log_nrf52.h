@@ -124,3 +124,7 @@ const char *pathToFileNameNRF(const char *path);
 #else
 #define myLog_n(format, ...)
 #endif
+
+#if MYLOG_DEFERRED > 0
+#include "my-log_defer.h"
+#endif
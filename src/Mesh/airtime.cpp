@@ -0,0 +1,108 @@
+#include "main.h"
+
+/**
+ * Airtime budget of this node.
+ * A token bucket holds the airtime in us the node may still use.
+ * It is refilled with MESH_DUTY_CYCLE / 1000 of the elapsed time and
+ * holds at most the airtime allowed in DUTY_CYCLE_WINDOW.
+ */
+
+// Reference values from the Semtech SX126x calculator
+static_assert(loraTimeOnAirUs(10, 7, 0, 1, 8) == 41216, "SF7 125 kHz 10 bytes");
+static_assert(loraTimeOnAirUs(10, 12, 0, 1, 8) == 991232, "SF12 125 kHz 10 bytes");
+static_assert(loraTimeOnAirUs(253, 7, 1, 1, 8) == 197248, "SF7 250 kHz 253 bytes");
+static_assert(loraTimeOnAirUs(51, 9, 0, 1, 8) == 328704, "SF9 125 kHz 51 bytes");
+static_assert(loraTimeOnAirUs(20, 10, 2, 4, 8) == 123392, "SF10 500 kHz CR4/8 20 bytes");
+
+/** Max airtime in the bucket in us */
+#define AIRTIME_BUCKET_SIZE ((int32_t)DUTY_CYCLE_WINDOW * MESH_DUTY_CYCLE)
+
+/** Airtime left in us */
+int32_t airtimeTokens = 0;
+/** Time the bucket was last refilled */
+time_t airtimeRefillTime = 0;
+/** Total airtime used in ms */
+uint32_t airtimeTotal = 0;
+/** Airtime used in us not yet added to airtimeTotal */
+uint32_t airtimeTotalUs = 0;
+
+/**
+ * Initialize the airtime budget with a full bucket
+ */
+void initAirtime(void)
+{
+	airtimeTokens = AIRTIME_BUCKET_SIZE;
+	airtimeRefillTime = millis();
+	airtimeTotal = 0;
+	airtimeTotalUs = 0;
+}
+
+#if MESH_DUTY_CYCLE > 0
+/**
+ * Refill the bucket for the time elapsed since the last refill
+ */
+static void airtimeRefill(void)
+{
+	uint32_t elapsed = millis() - airtimeRefillTime;
+	airtimeRefillTime += elapsed;
+	// 1 ms elapsed time gives MESH_DUTY_CYCLE us airtime
+	if (elapsed > (uint32_t)DUTY_CYCLE_WINDOW)
+	{
+		elapsed = DUTY_CYCLE_WINDOW;
+	}
+	airtimeTokens += elapsed * MESH_DUTY_CYCLE;
+	if (airtimeTokens > AIRTIME_BUCKET_SIZE)
+	{
+		airtimeTokens = AIRTIME_BUCKET_SIZE;
+	}
+}
+#endif
+
+/**
+ * Check if a package can be sent within the duty cycle limit
+ * @param timeOnAir
+ * 		Time on air of the package in us
+ * @return int32_t
+ * 		0 if the package can be sent, else the time in ms until it can be sent
+ */
+int32_t airtimeWait(uint32_t timeOnAir)
+{
+#if MESH_DUTY_CYCLE > 0
+	airtimeRefill();
+	if (airtimeTokens >= (int32_t)timeOnAir)
+	{
+		return 0;
+	}
+	return ((int32_t)timeOnAir - airtimeTokens) / MESH_DUTY_CYCLE + 1;
+#else
+	(void)timeOnAir;
+	return 0;
+#endif
+}
+
+/**
+ * Take the airtime of a package from the budget
+ * Link ACKs are sent without checking the budget, the bucket might go negative
+ * @param timeOnAir
+ * 		Time on air of the package in us
+ */
+void airtimeConsume(uint32_t timeOnAir)
+{
+	airtimeTotalUs += timeOnAir;
+	airtimeTotal += airtimeTotalUs / 1000;
+	airtimeTotalUs %= 1000;
+#if MESH_DUTY_CYCLE > 0
+	airtimeRefill();
+	airtimeTokens -= timeOnAir;
+#endif
+}
+
+/**
+ * Get the total airtime used since start
+ * @return uint32_t
+ * 		Airtime in ms
+ */
+uint32_t airtimeUsed(void)
+{
+	return airtimeTotal;
+}
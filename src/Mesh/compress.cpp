@@ -0,0 +1,184 @@
+#include "main.h"
+
+/**
+ * Lightweight LZ77 style compression for data packages.
+ * Works without heap, the only scratch memory is a small hash table
+ * on the stack. The compressed stream is a sequence of tokens:
+ * 0nnnnnnn             -> n + 1 literal bytes follow
+ * 1lllllll oooooooo    -> copy l + 3 bytes from o bytes back
+ */
+
+/** Number of bits of the match finder hash */
+#define COMPRESS_HASH_BITS 6
+/** Min length of a match */
+#define COMPRESS_MIN_MATCH 3
+/** Max length of a match */
+#define COMPRESS_MAX_MATCH (0x7F + COMPRESS_MIN_MATCH)
+/** Max number of literals in one token */
+#define COMPRESS_MAX_LITERALS 0x80
+
+/**
+ * Hash of the next COMPRESS_MIN_MATCH bytes
+ * @param data
+ * 		Pointer to the bytes
+ * @return uint8_t
+ * 		Index into the hash table
+ */
+static inline uint8_t compressHash(uint8_t *data)
+{
+	return (uint8_t)(((data[0] * 33 + data[1]) * 33 + data[2]) & ((1 << COMPRESS_HASH_BITS) - 1));
+}
+
+/**
+ * Write literals into the compressed stream
+ * @param in
+ * 		Pointer to the first literal
+ * @param num
+ * 		Number of literals
+ * @param out
+ * 		Output buffer
+ * @param outPos
+ * 		Current write position, will be updated
+ * @param outMax
+ * 		Size of the output buffer
+ * @return bool
+ * 		False if the output buffer is too small
+ */
+static bool compressLiterals(uint8_t *in, uint16_t num, uint8_t *out, uint16_t &outPos, uint16_t outMax)
+{
+	while (num != 0)
+	{
+		uint16_t chunk = num > COMPRESS_MAX_LITERALS ? COMPRESS_MAX_LITERALS : num;
+		if ((outPos + 1 + chunk) > outMax)
+		{
+			return false;
+		}
+		out[outPos++] = chunk - 1;
+		memcpy(&out[outPos], in, chunk);
+		outPos += chunk;
+		in += chunk;
+		num -= chunk;
+	}
+	return true;
+}
+
+/**
+ * Compress a data package payload
+ * @param in
+ * 		Data to be compressed, max 255 bytes
+ * @param inLen
+ * 		Size of the data
+ * @param out
+ * 		Buffer for the compressed data
+ * @param outMax
+ * 		Size of the buffer, compression fails if the result does not fit
+ * @return uint8_t
+ * 		Size of the compressed data, 0 if the data could not be compressed
+ */
+uint8_t meshCompress(uint8_t *in, uint8_t inLen, uint8_t *out, uint8_t outMax)
+{
+	// Positions + 1 of the last occurence of a hash, 0 = unused
+	uint8_t hashTable[1 << COMPRESS_HASH_BITS];
+	memset(hashTable, 0, sizeof(hashTable));
+
+	uint16_t outPos = 0;
+	uint16_t litStart = 0;
+	uint16_t pos = 0;
+
+	while ((pos + COMPRESS_MIN_MATCH) <= inLen)
+	{
+		uint8_t hash = compressHash(&in[pos]);
+		uint8_t candidate = hashTable[hash];
+		hashTable[hash] = pos + 1;
+
+		if (candidate != 0)
+		{
+			uint16_t ref = candidate - 1;
+			uint16_t len = 0;
+			while (((pos + len) < inLen) && (len < COMPRESS_MAX_MATCH) && (in[ref + len] == in[pos + len]))
+			{
+				len++;
+			}
+			if (len >= COMPRESS_MIN_MATCH)
+			{
+				if (!compressLiterals(&in[litStart], pos - litStart, out, outPos, outMax) ||
+					((outPos + 2) > outMax))
+				{
+					return 0;
+				}
+				out[outPos++] = 0x80 | (len - COMPRESS_MIN_MATCH);
+				out[outPos++] = pos - ref;
+				pos += len;
+				litStart = pos;
+				continue;
+			}
+		}
+		pos++;
+	}
+
+	if (!compressLiterals(&in[litStart], inLen - litStart, out, outPos, outMax))
+	{
+		return 0;
+	}
+	if (outPos >= inLen)
+	{
+		// No gain, send uncompressed
+		return 0;
+	}
+	return outPos;
+}
+
+/**
+ * Decompress a data package payload
+ * @param in
+ * 		Compressed data
+ * @param inLen
+ * 		Size of the compressed data
+ * @param out
+ * 		Buffer for the decompressed data
+ * @param outMax
+ * 		Size of the buffer
+ * @return int16_t
+ * 		Size of the decompressed data, -1 if the data is invalid
+ */
+int16_t meshDecompress(uint8_t *in, uint8_t inLen, uint8_t *out, uint16_t outMax)
+{
+	uint16_t inPos = 0;
+	uint16_t outPos = 0;
+
+	while (inPos < inLen)
+	{
+		uint8_t token = in[inPos++];
+		if ((token & 0x80) != 0)
+		{
+			uint16_t len = (token & 0x7F) + COMPRESS_MIN_MATCH;
+			if (inPos >= inLen)
+			{
+				return -1;
+			}
+			uint8_t offset = in[inPos++];
+			if ((offset == 0) || (offset > outPos) || ((outPos + len) > outMax))
+			{
+				return -1;
+			}
+			// Byte by byte, the match can overlap with the output
+			for (int idx = 0; idx < len; idx++)
+			{
+				out[outPos] = out[outPos - offset];
+				outPos++;
+			}
+		}
+		else
+		{
+			uint16_t num = token + 1;
+			if (((inPos + num) > inLen) || ((outPos + num) > outMax))
+			{
+				return -1;
+			}
+			memcpy(&out[outPos], &in[inPos], num);
+			inPos += num;
+			outPos += num;
+		}
+	}
+	return outPos;
+}
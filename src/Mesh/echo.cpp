@@ -0,0 +1,241 @@
+#include "main.h"
+
+/**
+ * Ping and traceroute
+ * echoSend() is called from the application, echoRx() from the mesh task
+ * for echo frames addressed to this node. The result of the pending echo
+ * is written by the mesh task and polled with echoGetResult().
+ */
+
+/** State of the last echo */
+static volatile uint8_t echoStatus = ECHO_IDLE;
+/** Result of the last echo, valid when echoStatus is ECHO_DONE */
+static echoResult echoLast;
+/** Time the pending echo was sent */
+static time_t echoStart = 0;
+/** Sequence number of the last echo */
+static uint8_t echoSeq = 0;
+
+/**
+ * Send an echo frame to the next hop towards the target
+ * @param frame
+ * 		Echo frame, dest and from are set here
+ * @param size
+ * 		Size of the frame
+ * @param target
+ * 		Final destination of the frame
+ * @return bool
+ * 		True if the frame was added to the send queue
+ */
+static bool echoForward(uint8_t *frame, uint16_t size, uint32_t target)
+{
+	nodesList route;
+	if (nodeListTake((TickType_t)1000) != pdTRUE)
+	{
+		myLog_e("Could not access map to send echo");
+		return false;
+	}
+	if (!getRoute(target, &route))
+	{
+		nodeListGive();
+		myLog_e("No route found for echo to %08X", target);
+		return false;
+	}
+	nodeListGive();
+
+	echoFrame<uint8_t> thisEcho(frame, size);
+	thisEcho.setDest(route.firstHop != 0 ? route.firstHop : route.nodeId);
+	thisEcho.setFrom(deviceID);
+	return addSendRequest((dataMsg *)frame, size);
+}
+
+/**
+ * Send an echo request
+ * @param nodeId
+ * 		Target node
+ * @param route
+ * 		True for traceroute, the forwarders add hop records
+ * @return bool
+ * 		True if the request was added to the send queue
+ * 		False if an echo is pending, the target is unknown or the queue is full
+ */
+bool echoSend(uint32_t nodeId, bool route)
+{
+	if ((echoStatus == ECHO_PENDING) && ((millis() - echoStart) < ECHO_REPLY_TIMEOUT))
+	{
+		myLog_w("Echo to %08X still pending", echoLast.nodeId);
+		return false;
+	}
+
+	dataMsg outMsg;
+	echoFrame<uint8_t> thisEcho((uint8_t *)&outMsg, DATA_HEADER_SIZE + ECHO_HEADER_SIZE);
+	echoSeq++;
+	thisEcho.setType(LORA_ECHO);
+	thisEcho.setOrig(deviceID);
+	thisEcho.setSeq(echoSeq);
+	thisEcho.setTarget(nodeId);
+	thisEcho.setFlags(route ? ECHO_FLAG_ROUTE : 0);
+	thisEcho.clearHops();
+
+	echoLast.nodeId = nodeId;
+	echoLast.seq = echoSeq;
+	echoStart = millis();
+	echoStatus = ECHO_PENDING;
+	if (!echoForward((uint8_t *)&outMsg, thisEcho.size(), nodeId))
+	{
+		echoStatus = ECHO_IDLE;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Handle an echo frame addressed to this node
+ * Forwards it to the next hop, answers a request for this node or
+ * finishes the pending echo with the reply
+ * @param frame
+ * 		Received frame, the buffer must have space for one more hop record
+ * @param size
+ * 		Size of the frame
+ */
+void echoRx(uint8_t *frame, uint16_t size)
+{
+	echoFrame<uint8_t> thisEcho(frame, size);
+	uint32_t rxTime = millis();
+	bool addHop = ((thisEcho.flags() & ECHO_FLAG_ROUTE) != 0) && (thisEcho.numHops() < ECHO_MAX_HOPS);
+
+	if (thisEcho.target() != deviceID)
+	{
+		// Forward towards the target
+		if (thisEcho.ttl() <= 1)
+		{
+			myLog_w("TTL of echo from %08X to %08X expired", thisEcho.orig(), thisEcho.target());
+			meshStatAdd(STAT_TTL_DROP);
+			return;
+		}
+		thisEcho.setTtl(thisEcho.ttl() - 1);
+		if (addHop)
+		{
+			thisEcho.addHop(deviceID, rxTime);
+		}
+		if (!echoForward(frame, thisEcho.size(), thisEcho.target()))
+		{
+			myLog_e("Cannot forward echo");
+		}
+		return;
+	}
+
+	if (thisEcho.msgType() == LORA_ECHO)
+	{
+		// Request for us, send it back as reply
+		myLog_d("Echo request #%d from %08X", thisEcho.seq(), thisEcho.orig());
+		if (addHop)
+		{
+			thisEcho.addHop(deviceID, rxTime);
+		}
+		thisEcho.setType(LORA_ECHO_REPLY);
+		thisEcho.setTarget(thisEcho.orig());
+		thisEcho.setOrig(deviceID);
+		thisEcho.setTtl(MESH_DEFAULT_TTL);
+		if (!echoForward(frame, thisEcho.size(), thisEcho.target()))
+		{
+			myLog_e("Cannot send echo reply");
+		}
+		return;
+	}
+
+	// Reply for us
+	if ((echoStatus != ECHO_PENDING) || (thisEcho.orig() != echoLast.nodeId) || (thisEcho.seq() != echoLast.seq))
+	{
+		myLog_d("Unexpected echo reply #%d from %08X", thisEcho.seq(), thisEcho.orig());
+		return;
+	}
+
+	echoLast.rtt = rxTime - echoStart;
+	echoLast.numHops = thisEcho.numHops();
+	// numHops if the target had no space left for its record
+	echoLast.targetIdx = echoLast.numHops;
+	for (int idx = 0; idx < echoLast.numHops; idx++)
+	{
+		echoLast.hops[idx].nodeId = thisEcho.hopId(idx);
+		echoLast.hops[idx].rtt = -1;
+		if ((echoLast.hops[idx].nodeId == echoLast.nodeId) && (echoLast.targetIdx == echoLast.numHops))
+		{
+			echoLast.targetIdx = idx;
+			echoLast.hops[idx].rtt = 0;
+		}
+	}
+	// A node on the way there and back gives its round trip time
+	for (int there = 0; there < echoLast.targetIdx; there++)
+	{
+		for (int back = echoLast.targetIdx + 1; back < echoLast.numHops; back++)
+		{
+			if (echoLast.hops[back].nodeId == echoLast.hops[there].nodeId)
+			{
+				echoLast.hops[there].rtt = thisEcho.hopTime(back) - thisEcho.hopTime(there);
+				break;
+			}
+		}
+	}
+	myLog_d("Echo reply #%d from %08X after %lu ms", echoLast.seq, echoLast.nodeId, (unsigned long)echoLast.rtt);
+	echoStatus = ECHO_DONE;
+}
+
+/**
+ * Get the state and the result of the last echo
+ * @param result
+ * 		Copy of the result if the echo is done
+ * @return echoState
+ * 		State of the last echo
+ */
+echoState echoGetResult(echoResult *result)
+{
+	if ((echoStatus == ECHO_PENDING) && ((millis() - echoStart) >= ECHO_REPLY_TIMEOUT))
+	{
+		echoStatus = ECHO_TIMEOUT;
+	}
+	if (echoStatus == ECHO_DONE)
+	{
+		memcpy(result, &echoLast, sizeof(echoResult));
+	}
+	return (echoState)echoStatus;
+}
+
+/**
+ * Write the hop records of the last traceroute as CSV lines
+ * index,node,direction (to, target, back),round trip time [ms] (-1 if unknown)
+ * Writes only complete lines, call again with the updated index until it returns 0
+ * @param buffer
+ * 		Buffer for the text
+ * @param size
+ * 		Size of the buffer
+ * @param next
+ * 		Index of the first hop to write, updated to the next hop
+ * @return uint16_t
+ * 		Length of the text
+ */
+uint16_t echoCsv(char *buffer, uint16_t size, uint8_t &next)
+{
+	uint16_t len = 0;
+	if (echoStatus != ECHO_DONE)
+	{
+		return 0;
+	}
+	while (next < echoLast.numHops)
+	{
+		const char *direction = next < echoLast.targetIdx ? "to" : (next == echoLast.targetIdx ? "target" : "back");
+		int lineLen = snprintf(&buffer[len], size - len, "%d,%08lX,%s,%ld\n", next, (unsigned long)echoLast.hops[next].nodeId,
+							   direction, (long)echoLast.hops[next].rtt);
+		if ((lineLen < 0) || (lineLen >= (size - len)))
+		{
+			break;
+		}
+		len += lineLen;
+		next++;
+	}
+	if (len < size)
+	{
+		buffer[len] = 0;
+	}
+	return len;
+}
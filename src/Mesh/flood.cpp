@@ -0,0 +1,225 @@
+#include "main.h"
+
+/**
+ * Counter based broadcast suppression.
+ * A new broadcast is not queued right away, it waits for a random
+ * assessment delay. Copies of the same broadcast that are heard during
+ * the delay are counted. If FLOOD_COUNT_THRESHOLD copies were heard the
+ * neighbors are most likely covered already and the rebroadcast is dropped.
+ * The nodes that sent a copy on their link have the broadcast. If all
+ * direct nodes of our map are among them, nobody needs our rebroadcast
+ * and it is dropped as well.
+ * Called only from the mesh task, no locking needed.
+ */
+
+/** Rebroadcast waiting for the assessment delay */
+struct floodPending
+{
+	boolean inUse;
+	uint8_t count;
+	uint8_t size;
+	time_t start;
+	uint32_t delay;
+	/** Broadcast ID, the dest field of the package */
+	uint32_t broadcastId;
+	/** Nodes that sent a copy on their link */
+	uint8_t numHeard;
+	uint32_t heard[FLOOD_HEARD_MAX];
+	dataMsg package;
+};
+
+/** Rebroadcasts waiting for the assessment delay */
+floodPending floodList[FLOOD_PENDING];
+
+/**
+ * Initialize the rebroadcast list
+ */
+void initFlood(void)
+{
+	for (int idx = 0; idx < FLOOD_PENDING; idx++)
+	{
+		floodList[idx].inUse = false;
+	}
+}
+
+/**
+ * Remember a node that sent a copy of a broadcast
+ * @param pending
+ * 		Rebroadcast waiting for the assessment delay
+ * @param hop
+ * 		Node that sent the copy, 0 if not known
+ */
+static void floodHeard(floodPending *pending, uint32_t hop)
+{
+	if ((hop == 0) || (pending->numHeard >= FLOOD_HEARD_MAX))
+	{
+		return;
+	}
+	for (int idx = 0; idx < pending->numHeard; idx++)
+	{
+		if (pending->heard[idx] == hop)
+		{
+			return;
+		}
+	}
+	pending->heard[pending->numHeard++] = hop;
+}
+
+/**
+ * Check if all direct nodes sent a copy of a broadcast
+ * @param pending
+ * 		Rebroadcast waiting for the assessment delay
+ * @return bool
+ * 		True if no direct node needs the rebroadcast
+ */
+static bool floodCovered(floodPending *pending)
+{
+	if (nodeListTake((TickType_t)10) != pdTRUE)
+	{
+		return false;
+	}
+	bool covered = true;
+	uint32_t nodeId;
+	uint32_t firstHop;
+	uint8_t numHops;
+	for (uint8_t node = 0; covered && getNode(node, nodeId, firstHop, numHops); node++)
+	{
+		if (firstHop != 0)
+		{
+			continue;
+		}
+		covered = false;
+		for (int idx = 0; idx < pending->numHeard; idx++)
+		{
+			if (pending->heard[idx] == nodeId)
+			{
+				covered = true;
+				break;
+			}
+		}
+	}
+	nodeListGive();
+	return covered;
+}
+
+/**
+ * Handle a new broadcast that should be rebroadcasted
+ * @param package
+ * 		Broadcast package with full header
+ * @param msgSize
+ * 		Size of the package
+ */
+void floodRx(uint8_t *package, uint8_t msgSize)
+{
+	dataFrame<uint8_t> frame(package, msgSize);
+	uint32_t broadcastId = frame.dest();
+#if MESH_FLOOD_COUNTER > 0
+	for (int idx = 0; idx < FLOOD_PENDING; idx++)
+	{
+		if (!floodList[idx].inUse)
+		{
+			floodList[idx].inUse = true;
+			floodList[idx].count = 1;
+			floodList[idx].size = msgSize;
+			floodList[idx].start = millis();
+			floodList[idx].delay = random(0, FLOOD_RAD_PACKAGES * meshTimeOnAirUs(msgSize) / 1000 + 1);
+			floodList[idx].broadcastId = broadcastId;
+			floodList[idx].numHeard = 0;
+			floodHeard(&floodList[idx], frame.hop());
+			if (floodCovered(&floodList[idx]))
+			{
+				// Our only direct node sent it to us
+				myLog_d("All direct nodes sent %08X, no rebroadcast", broadcastId);
+				floodList[idx].inUse = false;
+				meshStatAdd(STAT_FLOOD_SUPPRESSED);
+				return;
+			}
+			memcpy(&floodList[idx].package, package, msgSize);
+			myLog_v("Rebroadcast of %08X in %ld ms", broadcastId, floodList[idx].delay);
+			return;
+		}
+	}
+	myLog_w("Rebroadcast list full, forwarding %08X now", broadcastId);
+#endif
+	// Put broadcast into send queue
+	if (addSendRequest((dataMsg *)package, msgSize))
+	{
+		meshStatAdd(STAT_FLOOD_REBROADCAST);
+	}
+	else
+	{
+		myLog_e("Cannot forward broadcast because send queue is full");
+	}
+}
+
+/**
+ * Count a copy of a broadcast that was handled already
+ * @param broadcastID
+ * 		ID of the broadcast
+ * @param hop
+ * 		Node that sent the copy, 0 if not known
+ */
+void floodDuplicate(uint32_t broadcastID, uint32_t hop)
+{
+	for (int idx = 0; idx < FLOOD_PENDING; idx++)
+	{
+		if (floodList[idx].inUse && (floodList[idx].broadcastId == broadcastID))
+		{
+			floodList[idx].count++;
+			floodHeard(&floodList[idx], hop);
+			if (floodList[idx].count >= FLOOD_COUNT_THRESHOLD)
+			{
+				myLog_d("Heard %08X %d times, no rebroadcast", broadcastID, floodList[idx].count);
+				floodList[idx].inUse = false;
+				meshStatAdd(STAT_FLOOD_SUPPRESSED);
+			}
+			else if (floodCovered(&floodList[idx]))
+			{
+				myLog_d("All direct nodes sent %08X, no rebroadcast", broadcastID);
+				floodList[idx].inUse = false;
+				meshStatAdd(STAT_FLOOD_SUPPRESSED);
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * Queue the rebroadcasts whose assessment delay is over
+ * Called frequently by the mesh task
+ * @return int32_t
+ * 		Time in ms until the handler should be called again
+ */
+int32_t floodHandler(void)
+{
+	int32_t nextCheck = INT32_MAX;
+
+	for (int idx = 0; idx < FLOOD_PENDING; idx++)
+	{
+		if (!floodList[idx].inUse)
+		{
+			continue;
+		}
+		int32_t left = (int32_t)(floodList[idx].delay - (millis() - floodList[idx].start));
+		if (left > 0)
+		{
+			if (left < nextCheck)
+			{
+				nextCheck = left;
+			}
+			continue;
+		}
+		if (addSendRequest(&floodList[idx].package, floodList[idx].size))
+		{
+			myLog_d("Rebroadcast %08X after hearing it %d times", floodList[idx].broadcastId, floodList[idx].count);
+			floodList[idx].inUse = false;
+			meshStatAdd(STAT_FLOOD_REBROADCAST);
+		}
+		else
+		{
+			// Queue is full, try again later
+			nextCheck = 100;
+		}
+	}
+	return nextCheck;
+}
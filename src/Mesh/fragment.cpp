@@ -0,0 +1,300 @@
+#include "main.h"
+
+/**
+ * Fragmentation of messages that do not fit into one data package.
+ * The sender splits the message into fragments of FRAGMENT_DATA_SIZE
+ * bytes and queues them one by one from the mesh task.
+ * The receiver collects the fragments in one of FRAGMENT_BUFFERS fixed
+ * reassembly buffers and calls DataAvailable once for the whole message.
+ */
+
+/** Size of fragment header: message ID, fragment index, number of fragments, total size */
+#define FRAGMENT_HEADER_SIZE 5
+/** Max size of data in one fragment */
+#define FRAGMENT_DATA_SIZE (DATA_MAX_SIZE - FRAGMENT_HEADER_SIZE)
+/** Max number of fragments of a message */
+#define FRAGMENT_MAX_NUM ((FRAGMENT_MAX_SIZE + FRAGMENT_DATA_SIZE - 1) / FRAGMENT_DATA_SIZE)
+/** Time after the last received fragment before an incomplete message is dropped */
+#define FRAGMENT_TIMEOUT 30000
+/** Send queue slots the fragments leave free for other packages */
+#define FRAGMENT_QUEUE_RESERVE 1
+
+/** Message that is sent in fragments */
+struct fragmentTxMsg
+{
+	boolean active;
+	uint32_t nodeId;
+	uint8_t *data;
+	uint16_t size;
+	uint8_t msgId;
+	uint8_t nextFrag;
+	uint8_t numFrags;
+	time_t lastProgress;
+};
+
+/** Message that is reassembled */
+struct fragmentRxMsg
+{
+	boolean inUse;
+	uint32_t fromID;
+	uint8_t msgId;
+	uint8_t numFrags;
+	uint16_t size;
+	uint64_t received;
+	time_t lastFragment;
+	uint8_t data[FRAGMENT_MAX_SIZE];
+};
+
+/** Message that is sent */
+fragmentTxMsg fragTx;
+/** ID of the last fragmented message */
+uint8_t fragMsgId = 0;
+/** Reassembly buffers */
+fragmentRxMsg fragRx[FRAGMENT_BUFFERS];
+
+/** Mux used to enter critical code part (access to fragment buffers) */
+SemaphoreHandle_t accessFragment = NULL;
+
+/** Fragment callback variable */
+static MeshEvents_t *_FragmentEvents;
+
+/**
+ * Initialize the fragmentation
+ * @param events
+ * 		Structure of event callbacks, DataAvailable is used
+ */
+void initFragment(MeshEvents_t *events)
+{
+	_FragmentEvents = events;
+	memset(&fragTx, 0, sizeof(fragTx));
+	for (int idx = 0; idx < FRAGMENT_BUFFERS; idx++)
+	{
+		fragRx[idx].inUse = false;
+	}
+
+	// Create blocking semaphore for fragment buffers access
+	accessFragment = xSemaphoreCreateBinary();
+	xSemaphoreGive(accessFragment);
+}
+
+/**
+ * Send a message that is larger than one data package
+ * The message is sent in fragments by the mesh task,
+ * the data buffer must stay valid until fragmentBusy() returns false
+ * @param nodeId
+ * 		Destination node
+ * @param data
+ * 		Message to be sent
+ * @param size
+ * 		Size of the message, max FRAGMENT_MAX_SIZE
+ * @return bool
+ * 		True if the message was accepted
+ * 		False if another message is still being sent or the message is too large
+ */
+bool fragmentSend(uint32_t nodeId, uint8_t *data, uint16_t size)
+{
+	if ((accessFragment == NULL) || (size == 0) || (size > FRAGMENT_MAX_SIZE))
+	{
+		return false;
+	}
+
+	if (xSemaphoreTake(accessFragment, (TickType_t)1000) != pdTRUE)
+	{
+		myLog_e("Could not access fragment buffers");
+		return false;
+	}
+	if (fragTx.active)
+	{
+		myLog_w("Fragmented message to %08X still active", fragTx.nodeId);
+		xSemaphoreGive(accessFragment);
+		return false;
+	}
+
+	fragMsgId++;
+	fragTx.nodeId = nodeId;
+	fragTx.data = data;
+	fragTx.size = size;
+	fragTx.msgId = fragMsgId;
+	fragTx.nextFrag = 0;
+	fragTx.numFrags = (size + FRAGMENT_DATA_SIZE - 1) / FRAGMENT_DATA_SIZE;
+	fragTx.lastProgress = millis();
+	fragTx.active = true;
+	myLog_d("Sending msg #%d with %d bytes in %d fragments to %08X", fragTx.msgId, size, fragTx.numFrags, nodeId);
+	xSemaphoreGive(accessFragment);
+
+	// Wake up the mesh task to send the first fragment
+	meshWakeup();
+	return true;
+}
+
+/**
+ * Check if a fragmented message is still being sent
+ * @return bool
+ * 		True if the data buffer of the last fragmentSend() is still in use
+ */
+bool fragmentBusy(void)
+{
+	return fragTx.active;
+}
+
+/**
+ * Handle a received fragment
+ * Called by the mesh for packages with LORA_FLAG_FRAGMENT set
+ * @param fromID
+ * 		Node that sent the fragment
+ * @param payload
+ * 		Fragment
+ * @param size
+ * 		Size of the fragment
+ * @param rssi
+ * 		Signal strength while the package was received
+ * @param snr
+ * 		Signal to noise ratio while the package was received
+ */
+void fragmentRx(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	if ((accessFragment == NULL) || (size <= FRAGMENT_HEADER_SIZE))
+	{
+		myLog_e("Invalid fragment from %08X", fromID);
+		return;
+	}
+
+	uint8_t msgId = payload[0];
+	uint8_t fragIdx = payload[1];
+	uint8_t numFrags = payload[2];
+	uint16_t msgSize = payload[3] | (payload[4] << 8);
+	uint16_t fragSize = size - FRAGMENT_HEADER_SIZE;
+
+	// Check that the fragment fits into the message, only the last fragment is shorter
+	if ((msgSize > FRAGMENT_MAX_SIZE) || (numFrags > FRAGMENT_MAX_NUM) || (fragIdx >= numFrags) ||
+		((fragIdx < (numFrags - 1)) && (fragSize != FRAGMENT_DATA_SIZE)) ||
+		((fragIdx == (numFrags - 1)) && ((fragIdx * FRAGMENT_DATA_SIZE + fragSize) != msgSize)))
+	{
+		myLog_e("Invalid fragment %d/%d of %d bytes from %08X", fragIdx, numFrags, msgSize, fromID);
+		return;
+	}
+
+	if (xSemaphoreTake(accessFragment, (TickType_t)1000) != pdTRUE)
+	{
+		myLog_e("Could not access fragment buffers");
+		return;
+	}
+
+	// Find the reassembly buffer of the message or a free one
+	fragmentRxMsg *msg = NULL;
+	fragmentRxMsg *freeMsg = NULL;
+	for (int idx = 0; idx < FRAGMENT_BUFFERS; idx++)
+	{
+		if (fragRx[idx].inUse && (fragRx[idx].fromID == fromID) && (fragRx[idx].msgId == msgId))
+		{
+			msg = &fragRx[idx];
+			break;
+		}
+		if ((freeMsg == NULL) &&
+			(!fragRx[idx].inUse || ((millis() - fragRx[idx].lastFragment) > FRAGMENT_TIMEOUT)))
+		{
+			freeMsg = &fragRx[idx];
+		}
+	}
+	if (msg == NULL)
+	{
+		if (freeMsg == NULL)
+		{
+			myLog_e("No free reassembly buffer for msg #%d from %08X", msgId, fromID);
+			xSemaphoreGive(accessFragment);
+			return;
+		}
+		msg = freeMsg;
+		msg->inUse = true;
+		msg->fromID = fromID;
+		msg->msgId = msgId;
+		msg->numFrags = numFrags;
+		msg->size = msgSize;
+		msg->received = 0;
+	}
+
+	if ((msg->numFrags != numFrags) || (msg->size != msgSize))
+	{
+		myLog_e("Fragment %d does not match msg #%d from %08X", fragIdx, msgId, fromID);
+		xSemaphoreGive(accessFragment);
+		return;
+	}
+
+	memcpy(&msg->data[fragIdx * FRAGMENT_DATA_SIZE], &payload[FRAGMENT_HEADER_SIZE], fragSize);
+	msg->received |= ((uint64_t)1 << fragIdx);
+	msg->lastFragment = millis();
+	myLog_v("Got fragment %d/%d of msg #%d from %08X", fragIdx + 1, numFrags, msgId, fromID);
+
+	if (msg->received != ((numFrags == 64) ? ~(uint64_t)0 : (((uint64_t)1 << numFrags) - 1)))
+	{
+		// Message is not yet complete
+		xSemaphoreGive(accessFragment);
+		return;
+	}
+	xSemaphoreGive(accessFragment);
+
+	myLog_d("Msg #%d with %d bytes from %08X complete", msgId, msgSize, fromID);
+	if ((_FragmentEvents != NULL) && (_FragmentEvents->DataAvailable != NULL))
+	{
+		_FragmentEvents->DataAvailable(fromID, msg->data, msg->size, rssi, snr);
+	}
+	// Release the buffer after the callback used it
+	msg->inUse = false;
+}
+
+/**
+ * Queue the next fragment of the active message
+ * Called frequently by the mesh task
+ * @return int32_t
+ * 		Time in ms until the handler should be called again
+ */
+int32_t fragmentHandler(void)
+{
+	uint8_t pckg[DATA_MAX_SIZE];
+
+	if (!fragTx.active)
+	{
+		return FRAGMENT_TIMEOUT;
+	}
+
+	if (xSemaphoreTake(accessFragment, (TickType_t)10) != pdTRUE)
+	{
+		return 10;
+	}
+
+	uint16_t offset = fragTx.nextFrag * FRAGMENT_DATA_SIZE;
+	uint16_t fragSize = fragTx.size - offset;
+	if (fragSize > FRAGMENT_DATA_SIZE)
+	{
+		fragSize = FRAGMENT_DATA_SIZE;
+	}
+
+	pckg[0] = fragTx.msgId;
+	pckg[1] = fragTx.nextFrag;
+	pckg[2] = fragTx.numFrags;
+	pckg[3] = fragTx.size & 0xFF;
+	pckg[4] = fragTx.size >> 8;
+	memcpy(&pckg[FRAGMENT_HEADER_SIZE], &fragTx.data[offset], fragSize);
+
+	// Leave room in the send queue for maps, ACKs and forwarded packages
+	if ((uxQueueSpacesAvailable(sendQueue) > FRAGMENT_QUEUE_RESERVE) &&
+		sendToNode(fragTx.nodeId, pckg, FRAGMENT_HEADER_SIZE + fragSize, LORA_FLAG_FRAGMENT))
+	{
+		fragTx.nextFrag++;
+		fragTx.lastProgress = millis();
+		if (fragTx.nextFrag == fragTx.numFrags)
+		{
+			myLog_d("All fragments of msg #%d queued", fragTx.msgId);
+			fragTx.active = false;
+		}
+	}
+	else if ((millis() - fragTx.lastProgress) > FRAGMENT_TIMEOUT)
+	{
+		// No route or no room in the queue for too long
+		myLog_e("Giving up msg #%d to %08X at fragment %d", fragTx.msgId, fragTx.nodeId, fragTx.nextFrag);
+		fragTx.active = false;
+	}
+	// else try again after the next package was sent
+	xSemaphoreGive(accessFragment);
+	return 100;
+}
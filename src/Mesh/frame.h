@@ -0,0 +1,307 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <stddef.h>
+
+/**
+ * Views on frames in a byte buffer.
+ * All multi byte fields are little endian and are read and written byte by
+ * byte, so the wire format does not depend on struct padding, alignment
+ * or the endianness of the MCU.
+ * A view never copies the frame. valid() checks the length up front,
+ * the field accessors must only be used on a valid view.
+ * Byte is uint8_t for frames that are modified, const uint8_t for frames
+ * that are only read.
+ */
+
+/** Offsets of the fields shared by all frames */
+#define FRAME_TYPE 3
+#define FRAME_DEST 4
+#define FRAME_FROM 8
+/** Offsets of the data frame fields */
+#define FRAME_ORIG 12
+#define FRAME_HOP 16
+#define FRAME_SEQ 20
+#define FRAME_TTL 21
+/** Offsets of the link ACK and rate switch fields */
+#define FRAME_ACK_SEQ 12
+#define FRAME_RATE_SF 12
+#define FRAME_RATE_CHANNEL 13
+/** Offsets of the echo fields */
+#define FRAME_ECHO_TARGET DATA_HEADER_SIZE
+#define FRAME_ECHO_FLAGS (DATA_HEADER_SIZE + 4)
+#define FRAME_ECHO_HOPS (DATA_HEADER_SIZE + 5)
+/** Size of a node entry in the map */
+#define FRAME_MAP_ENTRY 5
+
+// The structs used to build frames must match the wire format
+static_assert(offsetof(dataMsg, type) == FRAME_TYPE, "dataMsg layout");
+static_assert(offsetof(dataMsg, dest) == FRAME_DEST, "dataMsg layout");
+static_assert(offsetof(dataMsg, from) == FRAME_FROM, "dataMsg layout");
+static_assert(offsetof(dataMsg, orig) == FRAME_ORIG, "dataMsg layout");
+static_assert(offsetof(dataMsg, hop) == FRAME_HOP, "dataMsg layout");
+static_assert(offsetof(dataMsg, seq) == FRAME_SEQ, "dataMsg layout");
+static_assert(offsetof(dataMsg, ttl) == FRAME_TTL, "dataMsg layout");
+static_assert(offsetof(dataMsg, data) == DATA_HEADER_SIZE, "dataMsg layout");
+static_assert(offsetof(mapMsg, nodes) == MAP_HEADER_SIZE, "mapMsg layout");
+static_assert(offsetof(ackMsg, seq) == FRAME_ACK_SEQ, "ackMsg layout");
+static_assert(offsetof(rateMsg, sf) == FRAME_RATE_SF, "rateMsg layout");
+static_assert(offsetof(rateMsg, channel) == FRAME_RATE_CHANNEL, "rateMsg layout");
+
+/**
+ * Common part of all frames: magic, type, dest and from
+ */
+template <typename Byte>
+class frameView
+{
+public:
+	frameView(Byte *data, uint16_t len) : _data(data), _len(len) {}
+
+	/** Size of the frame */
+	uint16_t size(void) const { return _len; }
+	/** Pointer to the frame */
+	Byte *buffer(void) const { return _data; }
+
+	/** Check the magic 'L','o','R' or 'L','o',DATA_MAGIC and the min size of the frame */
+	bool valid(uint16_t minSize) const
+	{
+		return (_len >= minSize) && (_len >= FRAME_FROM + 4) && (_data[0] == 'L') && (_data[1] == 'o') &&
+			   ((_data[2] == 'R') || (_data[2] == DATA_MAGIC));
+	}
+
+	/** Check the size and the third magic byte of a frame type */
+	bool valid(uint16_t minSize, uint8_t magic) const { return valid(minSize) && (_data[2] == magic); }
+
+	/** Type and flags */
+	uint8_t type(void) const { return _data[FRAME_TYPE]; }
+	/** Type without flags */
+	uint8_t msgType(void) const { return _data[FRAME_TYPE] & LORA_TYPE_MASK; }
+	uint32_t dest(void) const { return u32(FRAME_DEST); }
+	uint32_t from(void) const { return u32(FRAME_FROM); }
+
+	void setType(uint8_t type) { _data[FRAME_TYPE] = type; }
+	void setDest(uint32_t id) { setU32(FRAME_DEST, id); }
+	void setFrom(uint32_t id) { setU32(FRAME_FROM, id); }
+
+	/** Read a little endian 32 bit value */
+	uint32_t u32(uint16_t pos) const
+	{
+		return (uint32_t)_data[pos] | ((uint32_t)_data[pos + 1] << 8) |
+			   ((uint32_t)_data[pos + 2] << 16) | ((uint32_t)_data[pos + 3] << 24);
+	}
+
+	/** Write a little endian 32 bit value */
+	void setU32(uint16_t pos, uint32_t value)
+	{
+		_data[pos] = value & 0xFF;
+		_data[pos + 1] = (value >> 8) & 0xFF;
+		_data[pos + 2] = (value >> 16) & 0xFF;
+		_data[pos + 3] = (value >> 24) & 0xFF;
+	}
+
+protected:
+	Byte *_data;
+	uint16_t _len;
+};
+
+/**
+ * Direct, forward and broadcast frames
+ */
+template <typename Byte>
+class dataFrame : public frameView<Byte>
+{
+public:
+	dataFrame(Byte *data, uint16_t len) : frameView<Byte>(data, len) {}
+
+	bool valid(void) const { return frameView<Byte>::valid(DATA_HEADER_SIZE, DATA_MAGIC); }
+
+	uint32_t orig(void) const { return this->u32(FRAME_ORIG); }
+	uint8_t seq(void) const { return this->_data[FRAME_SEQ]; }
+	uint8_t ttl(void) const { return this->_data[FRAME_TTL]; }
+	/** Node that sent the package on this link */
+	uint32_t hop(void) const { return this->u32(FRAME_HOP); }
+	Byte *payload(void) const { return &this->_data[DATA_HEADER_SIZE]; }
+	uint16_t payloadSize(void) const { return this->_len - DATA_HEADER_SIZE; }
+
+	void setOrig(uint32_t id) { this->setU32(FRAME_ORIG, id); }
+	void setSeq(uint8_t seq) { this->_data[FRAME_SEQ] = seq; }
+	void setTtl(uint8_t ttl) { this->_data[FRAME_TTL] = ttl; }
+	void setHop(uint32_t id) { this->setU32(FRAME_HOP, id); }
+};
+
+/**
+ * Link ACK frames
+ */
+template <typename Byte>
+class ackFrame : public frameView<Byte>
+{
+public:
+	ackFrame(Byte *data, uint16_t len) : frameView<Byte>(data, len) {}
+
+	bool valid(void) const { return frameView<Byte>::valid(ACK_MSG_SIZE, 'R'); }
+
+	uint8_t seq(void) const { return this->_data[FRAME_ACK_SEQ]; }
+};
+
+/**
+ * Rate switch frames
+ */
+template <typename Byte>
+class rateFrame : public frameView<Byte>
+{
+public:
+	rateFrame(Byte *data, uint16_t len) : frameView<Byte>(data, len) {}
+
+	bool valid(void) const { return frameView<Byte>::valid(RATE_MSG_SIZE, 'R'); }
+
+	uint8_t sf(void) const { return this->_data[FRAME_RATE_SF]; }
+	uint8_t channel(void) const { return this->_data[FRAME_RATE_CHANNEL]; }
+};
+
+/**
+ * Echo request and reply frames
+ * Data frame header addressed hop by hop (dest = next hop, from = sender
+ * of this hop, orig = node that sent the request or reply), followed by
+ * the final destination, the flags, the number of hop records and the
+ * hop records of 4 bytes node ID and 4 bytes time stamp
+ */
+template <typename Byte>
+class echoFrame : public dataFrame<Byte>
+{
+public:
+	echoFrame(Byte *data, uint16_t len) : dataFrame<Byte>(data, len) {}
+
+	/** Check the size and the number of hop records */
+	bool valid(void) const
+	{
+		return frameView<Byte>::valid(DATA_HEADER_SIZE + ECHO_HEADER_SIZE, DATA_MAGIC) &&
+			   (this->_len == (DATA_HEADER_SIZE + ECHO_HEADER_SIZE + numHops() * ECHO_HOP_SIZE));
+	}
+
+	uint32_t target(void) const { return this->u32(FRAME_ECHO_TARGET); }
+	uint8_t flags(void) const { return this->_data[FRAME_ECHO_FLAGS]; }
+	uint8_t numHops(void) const { return this->_data[FRAME_ECHO_HOPS]; }
+	uint32_t hopId(uint8_t idx) const { return this->u32(hop(idx)); }
+	uint32_t hopTime(uint8_t idx) const { return this->u32(hop(idx) + 4); }
+
+	void setTarget(uint32_t id) { this->setU32(FRAME_ECHO_TARGET, id); }
+	void setFlags(uint8_t flags) { this->_data[FRAME_ECHO_FLAGS] = flags; }
+	void clearHops(void) { this->_data[FRAME_ECHO_HOPS] = 0; }
+
+	/** Append a hop record, the buffer must have space for it */
+	void addHop(uint32_t id, uint32_t time)
+	{
+		uint16_t pos = hop(numHops());
+		this->setU32(pos, id);
+		this->setU32(pos + 4, time);
+		this->_data[FRAME_ECHO_HOPS]++;
+		this->_len += ECHO_HOP_SIZE;
+	}
+
+private:
+	uint16_t hop(uint8_t idx) const { return DATA_HEADER_SIZE + ECHO_HEADER_SIZE + idx * ECHO_HOP_SIZE; }
+};
+
+/** Number of map entries of the slot and time trailer */
+#define FRAME_MAP_TRAILER (MESH_TDMA > 0 ? 1 : 0)
+/** Max number of map entries after the end marker */
+#define FRAME_MAP_MAX_TAIL (FRAME_MAP_TRAILER + (TELEMETRY_MAX_SIZE + FRAME_MAP_ENTRY - 1) / FRAME_MAP_ENTRY)
+
+/**
+ * Node map frames
+ * Node entries of 5 bytes (ID, hops), the end marker entry,
+ * with MESH_TDMA the slot and time trailer and an optional telemetry
+ * block padded to full entries
+ */
+template <typename Byte>
+class mapFrame : public frameView<Byte>
+{
+public:
+	mapFrame(Byte *data, uint16_t len) : frameView<Byte>(data, len) {}
+
+	/** Check the size, the entry alignment and the end marker */
+	bool valid(void) const
+	{
+		if (!frameView<Byte>::valid(MAP_HEADER_SIZE + FRAME_MAP_ENTRY, 'R') ||
+			(((this->_len - MAP_HEADER_SIZE) % FRAME_MAP_ENTRY) != 0))
+		{
+			return false;
+		}
+		return markerIndex() >= 0;
+	}
+
+	/** Number of node entries without end marker and trailer */
+	uint8_t numNodes(void) const { return markerIndex(); }
+	uint32_t nodeId(uint8_t idx) const { return this->u32(entry(idx)); }
+	uint8_t nodeHops(uint8_t idx) const { return this->_data[entry(idx) + 4]; }
+
+	/** Check if the map has a slot and time trailer */
+	bool hasTrailer(void) const { return (FRAME_MAP_TRAILER != 0) && (tailEntries(markerIndex()) != 0); }
+	/** Pointer to the slot and time trailer */
+	Byte *trailer(void) const { return &this->_data[entry(markerIndex() + 1)]; }
+
+	/** Check if the map has a telemetry block */
+	bool hasTelemetry(void) const { return tailEntries(markerIndex()) > FRAME_MAP_TRAILER; }
+	/** Pointer to the telemetry block */
+	Byte *telemetry(void) const { return &this->_data[entry(markerIndex() + 1 + FRAME_MAP_TRAILER)]; }
+	/** Size of the telemetry block */
+	uint8_t telemetrySize(void) const { return telemetry()[1]; }
+
+	/** Write the end marker */
+	void setEndMarker(uint8_t idx)
+	{
+		Byte *marker = &this->_data[entry(idx)];
+		marker[0] = 0xAA;
+		marker[1] = 0x55;
+		marker[2] = 0x00;
+		marker[3] = 0xFF;
+		marker[4] = 0xAA;
+	}
+
+private:
+	uint16_t entry(uint8_t idx) const { return MAP_HEADER_SIZE + idx * FRAME_MAP_ENTRY; }
+	int16_t numEntries(void) const { return (this->_len - MAP_HEADER_SIZE) / FRAME_MAP_ENTRY; }
+	/** Number of entries after the end marker */
+	int16_t tailEntries(int16_t marker) const { return numEntries() - 1 - marker; }
+
+	bool isEndMarker(int16_t idx) const
+	{
+		const Byte *marker = &this->_data[entry(idx)];
+		return (marker[0] == 0xAA) && (marker[1] == 0x55) && (marker[2] == 0x00) &&
+			   (marker[3] == 0xFF) && (marker[4] == 0xAA);
+	}
+
+	/** Check that the entries after the end marker are the trailer and a telemetry block */
+	bool validTail(int16_t marker) const
+	{
+		int16_t tail = tailEntries(marker);
+		if ((tail == 0) || (tail == FRAME_MAP_TRAILER))
+		{
+			return true;
+		}
+		if (tail < FRAME_MAP_TRAILER)
+		{
+			return false;
+		}
+		// The length of the telemetry block must match the padded rest of the frame
+		uint8_t size = this->_data[entry(marker + 1 + FRAME_MAP_TRAILER) + 1];
+		return (size >= TELEMETRY_MIN_SIZE) && (size <= TELEMETRY_MAX_SIZE) &&
+			   (((size + FRAME_MAP_ENTRY - 1) / FRAME_MAP_ENTRY) == (tail - FRAME_MAP_TRAILER));
+	}
+
+	/** Index of the end marker, searched backwards over the max tail, -1 if missing */
+	int16_t markerIndex(void) const
+	{
+		int16_t last = numEntries() - 1;
+		for (int16_t idx = last; (idx >= 0) && (idx >= (last - FRAME_MAP_MAX_TAIL)); idx--)
+		{
+			if (isEndMarker(idx) && validTail(idx))
+			{
+				return idx;
+			}
+		}
+		return -1;
+	}
+};
+
+#endif
@@ -0,0 +1,226 @@
+#include "main.h"
+
+/**
+ * Compact header for data packages.
+ * The full header (magic 'L','o',DATA_MAGIC, type, dest, from, orig, hop, seq,
+ * ttl) is 22 bytes. The compact header replaces the 3 byte magic with a 1 byte
+ * magic/version and the 32 bit IDs with 16 bit short addresses:
+ * [0] COMPACT_MAGIC
+ * [1] type and flags
+ * [2..3] dest short address
+ * [4..5] from short address
+ * [6..7] orig short address
+ * [8..9] hop short address
+ * [10] seq
+ * [11] ttl
+ * Short addresses are resolved through the nodes map of the receiver, it
+ * only takes packages that a direct node sent.
+ * The compact header is only used toward a direct node, for addresses that
+ * are unique in our map and known to the receiver: our own ID, its ID and
+ * the nodes of our map, which it learned from our node maps.
+ * Broadcasts, map and ACK packages always use the full header, as do
+ * retransmissions after a missing link ACK.
+ * Data packages of older firmware have the magic 'L','o','R' and a 16 byte
+ * header without hop, seq and ttl, they are converted on reception.
+ */
+
+/** Magic (upper nibble) and version (lower nibble) of the compact header */
+#define COMPACT_MAGIC 0xA3
+
+/**
+ * Check if a direct node can resolve the short address of a node
+ * Must be called while holding accessNodeList
+ * @param id
+ * 		Node ID
+ * @param neighbour
+ * 		Direct node that receives the package
+ * @return bool
+ * 		True if the short address is unique and the neighbour knows the node
+ */
+static bool isResolvableBy(uint32_t id, uint32_t neighbour)
+{
+	nodesList route;
+	if (!isShortAddressUnique(id))
+	{
+		return false;
+	}
+	return (id == deviceID) || (id == neighbour) || getRoute(id, &route);
+}
+
+/**
+ * Convert a data package with full header into a package with compact header
+ * Must not be called while holding accessNodeList
+ * @param in
+ * 		Package with full header
+ * @param inLen
+ * 		Size of the package
+ * @param out
+ * 		Buffer for the package with compact header
+ * @return uint16_t
+ * 		Size of the compact package, 0 if the full header has to be used
+ */
+uint16_t compactHeader(uint8_t *in, uint16_t inLen, uint8_t *out)
+{
+	dataFrame<const uint8_t> msg(in, inLen);
+	if (!msg.valid() || ((msg.msgType() != LORA_DIRECT) && (msg.msgType() != LORA_FORWARD)))
+	{
+		return 0;
+	}
+
+	if (nodeListTake((TickType_t)10) != pdTRUE)
+	{
+		return 0;
+	}
+	// Receiver must be a direct node that can resolve all addresses
+	nodesList route;
+	boolean resolvable = getRoute(msg.dest(), &route) && (route.firstHop == 0) &&
+						 isShortAddressUnique(msg.dest()) &&
+						 isResolvableBy(msg.from(), msg.dest()) &&
+						 isResolvableBy(msg.orig(), msg.dest()) &&
+						 isResolvableBy(msg.hop(), msg.dest());
+	nodeListGive();
+
+	if (!resolvable)
+	{
+		return 0;
+	}
+
+	uint16_t destShort = shortAddress(msg.dest());
+	uint16_t fromShort = shortAddress(msg.from());
+	uint16_t origShort = shortAddress(msg.orig());
+	uint16_t hopShort = shortAddress(msg.hop());
+	out[0] = COMPACT_MAGIC;
+	out[1] = msg.type();
+	out[2] = destShort & 0xFF;
+	out[3] = destShort >> 8;
+	out[4] = fromShort & 0xFF;
+	out[5] = fromShort >> 8;
+	out[6] = origShort & 0xFF;
+	out[7] = origShort >> 8;
+	out[8] = hopShort & 0xFF;
+	out[9] = hopShort >> 8;
+	out[10] = msg.seq();
+	out[11] = msg.ttl();
+	memcpy(&out[COMPACT_HEADER_SIZE], &in[DATA_HEADER_SIZE], inLen - DATA_HEADER_SIZE);
+	return inLen - DATA_HEADER_SIZE + COMPACT_HEADER_SIZE;
+}
+
+/**
+ * Convert a received package with compact header in place into a package with full header
+ * Must not be called while holding accessNodeList
+ * @param pckg
+ * 		Received package, buffer must have space for DATA_HEADER_SIZE - COMPACT_HEADER_SIZE more bytes
+ * @param len
+ * 		Size of the received package
+ * @return uint16_t
+ * 		Size of the package with full header
+ * 		len if the package has no compact header
+ * 		0 if the package is invalid, not for us, the short addresses are not known
+ * 		or the sender is not a direct node
+ */
+uint16_t expandHeader(uint8_t *pckg, uint16_t len)
+{
+	if (pckg[0] != COMPACT_MAGIC)
+	{
+		return len;
+	}
+	if ((len < COMPACT_HEADER_SIZE) || ((len + DATA_HEADER_SIZE - COMPACT_HEADER_SIZE) > 255))
+	{
+		return 0;
+	}
+
+	uint8_t type = pckg[1];
+	uint16_t destShort = pckg[2] | (pckg[3] << 8);
+	uint16_t fromShort = pckg[4] | (pckg[5] << 8);
+	uint16_t origShort = pckg[6] | (pckg[7] << 8);
+	uint16_t hopShort = pckg[8] | (pckg[9] << 8);
+	uint8_t seq = pckg[10];
+	uint8_t ttl = pckg[11];
+	uint32_t from = 0;
+	uint32_t orig = 0;
+	uint32_t hop = 0;
+
+	if (destShort != shortAddress(deviceID))
+	{
+		// Package is not for us
+		myLog_v("Compact package for %04X is not for us", destShort);
+		return 0;
+	}
+
+	if (nodeListTake((TickType_t)1000) != pdTRUE)
+	{
+		myLog_e("Could not access map to expand header");
+		return 0;
+	}
+	boolean known = getFullAddress(fromShort, from) && getFullAddress(origShort, orig) && getFullAddress(hopShort, hop);
+	// Short addresses are only unique in the map of the sender, a node out of its
+	// range with the same short address must not take the package
+	nodesList route;
+	boolean neighbour = known && getRoute(hop, &route) && (route.firstHop == 0);
+	nodeListGive();
+
+	if (!known)
+	{
+		myLog_w("Unknown short address in package from %04X", hopShort);
+		meshStatAdd(STAT_RX_UNRESOLVED);
+		return 0;
+	}
+	if (!neighbour)
+	{
+		myLog_w("Compact package from %08lX, not a direct node", (unsigned long)hop);
+		meshStatAdd(STAT_RX_NOT_NEIGHBOUR);
+		return 0;
+	}
+
+	// Make room for the full header
+	memmove(&pckg[DATA_HEADER_SIZE], &pckg[COMPACT_HEADER_SIZE], len - COMPACT_HEADER_SIZE);
+	len = len - COMPACT_HEADER_SIZE + DATA_HEADER_SIZE;
+	pckg[0] = 'L';
+	pckg[1] = 'o';
+	pckg[2] = DATA_MAGIC;
+	dataFrame<uint8_t> msg(pckg, len);
+	msg.setType(type);
+	msg.setDest(deviceID);
+	msg.setFrom(from);
+	msg.setOrig(orig);
+	msg.setHop(hop);
+	msg.setSeq(seq);
+	msg.setTtl(ttl);
+	return len;
+}
+
+/**
+ * Convert a received data package of older firmware in place into a package with full header
+ * The sender of the link is not known, hop is 0. The package has no TTL,
+ * it gets MESH_DEFAULT_TTL.
+ * @param pckg
+ * 		Received package, buffer must have space for DATA_HEADER_SIZE - LEGACY_HEADER_SIZE more bytes
+ * @param len
+ * 		Size of the received package
+ * @return uint16_t
+ * 		Size of the package with full header
+ * 		len if the package is not a data package of older firmware
+ * 		0 if the package is too large for the full header
+ */
+uint16_t expandLegacyHeader(uint8_t *pckg, uint16_t len)
+{
+	if ((len < LEGACY_HEADER_SIZE) || (pckg[0] != 'L') || (pckg[1] != 'o') || (pckg[2] != 'R') ||
+		((pckg[FRAME_TYPE] != LORA_DIRECT) && (pckg[FRAME_TYPE] != LORA_FORWARD) && (pckg[FRAME_TYPE] != LORA_BROADCAST)))
+	{
+		return len;
+	}
+	if ((len + DATA_HEADER_SIZE - LEGACY_HEADER_SIZE) > 255)
+	{
+		return 0;
+	}
+
+	memmove(&pckg[DATA_HEADER_SIZE], &pckg[LEGACY_HEADER_SIZE], len - LEGACY_HEADER_SIZE);
+	len = len - LEGACY_HEADER_SIZE + DATA_HEADER_SIZE;
+	pckg[2] = DATA_MAGIC;
+	dataFrame<uint8_t> msg(pckg, len);
+	msg.setHop(0);
+	msg.setSeq(0);
+	msg.setTtl(MESH_DEFAULT_TTL);
+	meshStatAdd(STAT_RX_LEGACY);
+	return len;
+}
@@ -10,6 +10,10 @@ volatile xQueueHandle meshMsgQueue;
 
 /** Counter for CAD retry */
 uint8_t channelFreeRetryNum = 0;
+/** Flag if the CAD is retried after CAD_RETRY_DELAY */
+boolean cadRetryPending = false;
+/** Time the channel was busy */
+time_t cadRetryTime;
 
 /** The Mesh node ID, created from ID of the nRF52 */
 uint32_t deviceID;
@@ -19,8 +23,6 @@ uint32_t broadcastID;
 /** Map message buffer */
 mapMsg syncMsg;
 
-/** Max number of messages in the queue */
-#define SEND_QUEUE_SIZE 2
 /** Send buffer for SEND_QUEUE_SIZE messages */
 dataMsg sendMsg[SEND_QUEUE_SIZE];
 /** Message size buffer for SEND_QUEUE_SIZE messages */
@@ -38,33 +40,118 @@ SemaphoreHandle_t accessNodeList;
 uint8_t txPckg[256];
 /** Size of data package */
 uint16_t txLen = 0;
+/** LoRa TX package as sent over the air */
+uint8_t txWire[256];
+/** Size of package as sent over the air */
+uint16_t txWireLen = 0;
 /** LoRa RX buffer */
 uint8_t rxBuffer[256];
+#if MESH_COMPRESS > 0
+/** Buffer for compressed TX data */
+uint8_t compressBuffer[DATA_MAX_SIZE];
+#endif
+/** Buffer for decompressed RX data, null terminated */
+uint8_t decompressBuffer[DATA_MAX_SIZE + 1];
+
+/** Link ACK message buffer */
+ackMsg linkAck;
+/** Flag if a link ACK has to be sent */
+boolean linkAckPending = false;
+/** Time the package to be acknowledged was received */
+time_t linkAckTime;
+/** Flag if the radio is sending a link ACK */
+boolean sendingLinkAck = false;
+/** Link sequence number of the last sent package */
+uint8_t linkSeqNum = 0;
+/** Flag if the last sent package requested a link ACK */
+boolean txAckRequested = false;
+/** Flag if we are waiting for a link ACK */
+boolean waitingLinkAck = false;
+/** Time the wait for a link ACK started */
+time_t linkAckWaitTime;
+/** Time to wait for the link ACK, with a random back off so collided senders retransmit at different times */
+uint32_t linkAckTimeout = LINK_ACK_TIMEOUT;
+/** Counter for link ACK retransmissions */
+uint8_t linkAckRetryNum = 0;
+
+/** Received package waiting to be handled */
+struct rxRingSlot
+{
+	uint16_t size;
+	int16_t rssi;
+	int8_t snr;
+	/** Start of the latency trace, 0 if not traced */
+	uint32_t traceTime;
+	uint8_t data[256];
+};
+/** Received packages, filled by OnRxDone in the radio task, handled by the mesh task */
+rxRingSlot rxRing[RX_RING_SIZE];
+/** Indexes of the free slots of the RX ring */
+xQueueHandle rxRingFree = NULL;
+
+/** Radio event for the mesh task */
+struct radioEvent
+{
+	/** Type of the event, radioEventType */
+	uint8_t type;
+	/** RX ring slot of a received package or the CAD result */
+	uint8_t value;
+};
+/** Radio events in the order the radio task got them */
+xQueueHandle radioEventQueue = NULL;
+/** Task that reads the radio events */
+TaskHandle_t meshIrqTaskHandle = NULL;
+static void radioTxDone(void);
+static void radioTxTimeout(void);
+static void radioRxTimeout(void);
+static void radioRxError(void);
+static void radioCadDone(bool cadResult);
+/** Start of the latency trace of the package in meshRxProcess */
+uint32_t rxTraceTime = 0;
+
+/** Time of the last data traffic */
+time_t rxLastTraffic = 0;
+/** Flag if the receiver listens continuously */
+boolean rxContinuous = false;
+
+/** Rate switch message buffer */
+rateMsg rateSwitch;
+/** SF used for the package in txWire, 0 if the common rate and channel is used */
+uint8_t txRateSf = 0;
+/** Channel used for the package in txWire */
+uint8_t txChannel = 0;
+/** Flag if the rate switch message is sent */
+boolean sendingRateSwitch = false;
+/** Flag if the package on the link rate is sent after RATE_TURNAROUND */
+boolean rateSendPending = false;
+/** Time the rate switch message was sent */
+time_t rateSendTime;
+/** Flag if we listen on a link rate */
+boolean rxRateSwitched = false;
+/** Time we switched to the link rate */
+time_t rxRateSwitchTime;
+/** Time we listen on the link rate */
+uint32_t rxRateWindow;
 
 /** Sync time for routing at start */
+#ifndef INIT_SYNCTIME
 #define INIT_SYNCTIME 30000
+#endif
 /** Sync time for routing after mesh has settled */
+#ifndef DEFAULT_SYNCTIME
 #define DEFAULT_SYNCTIME 60000
+#endif
 /** Time to switch from INIT_SYNCTIME to DEFAULT_SYNCTIME */
+#ifndef SWITCH_SYNCTIME
 #define SWITCH_SYNCTIME 300000
+#endif
 /** Sync time */
 time_t syncTime = INIT_SYNCTIME;
+/** Time after which a stuck MESH_TX state is reset */
+uint32_t txStuckTimeout = meshTxWatchdog(255);
 
-/**
- * Sleep and Listen time definitions 
- * Calculated with Semtech SX1261 Calculater
- * SF 7, BW 250, CR 4/5 PreambleLen 8 PayloadLen 253 Hdr enabled CRC enabled
- * 2 -> number of preambles required to detect package 
- * 512 -> length of a symbol im ms
- * 1000 -> wake time is in us
- * 15.625 -> SX126x counts in increments of 15.625 us
- * 
- * 10 -> max length we can sleep in symbols 
- * 512 -> length of a symbol im ms
- * 1000 -> sleep time is in us
- * 15.625 -> SX126x counts in increments of 15.625 us
- */
-#define RX_SLEEP_TIMES 2 * 512 * 1000 * 15.625, 10 * 512 * 1000 * 15.625
+// Senders must still wake up a sleeping receiver
+static_assert(RX_DUTY_SLEEP_SYMBOLS > 0, "LORA_PREAMBLE_LENGTH too short for RX duty cycle");
 
 typedef enum
 {
@@ -92,6 +179,47 @@ time_t preambTimeout;
 /** Flag if the nodes map has changed */
 boolean nodesChanged = false;
 
+/** HW configuration structure for the LoRa library */
+extern hw_config _hwConfig;
+/** DIO1 interrupt handler of the SX126x-Arduino library */
+extern void RadioOnDioIrq(void);
+
+/**
+ * DIO1 interrupt handler
+ * Forwards the interrupt to the SX126x-Arduino library
+ * and wakes up the radio task to process the radio event
+ */
+void IRAM_ATTR meshDio1Isr(void)
+{
+	RadioOnDioIrq();
+
+	if (meshIrqTaskHandle != NULL)
+	{
+		BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+		vTaskNotifyGiveFromISR(meshIrqTaskHandle, &xHigherPriorityTaskWoken);
+#ifdef ESP32
+		if (xHigherPriorityTaskWoken == pdTRUE)
+		{
+			portYIELD_FROM_ISR();
+		}
+#else
+		portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+#endif
+	}
+}
+
+/**
+ * Wake up the mesh task
+ * Used if a new send request or a radio event was queued
+ */
+void meshWakeup(void)
+{
+	if (meshTaskHandle != NULL)
+	{
+		xTaskNotifyGive(meshTaskHandle);
+	}
+}
+
 /**
  * Initialize the Mesh network
  * @param events
@@ -103,15 +231,32 @@ void initMesh(MeshEvents_t *events, int numOfNodes)
 {
 	_MeshEvents = events;
 
-	// Initialize the callbacks
-	RadioEvents.TxDone = OnTxDone;
+	// Create the queues between the radio task and the mesh task
+	radioEventQueue = xQueueCreate(RX_RING_SIZE + RADIO_EVENT_EXTRA, sizeof(radioEvent));
+	rxRingFree = xQueueCreate(RX_RING_SIZE, sizeof(uint8_t));
+	if ((radioEventQueue == NULL) || (rxRingFree == NULL))
+	{
+		myLog_e("Could not create radio event queues!");
+	}
+	for (uint8_t slot = 0; slot < RX_RING_SIZE; slot++)
+	{
+		xQueueSend(rxRingFree, &slot, 0);
+	}
+
+	// Initialize the callbacks, they run in the radio task
+	RadioEvents.TxDone = radioTxDone;
 	RadioEvents.RxDone = OnRxDone;
-	RadioEvents.TxTimeout = OnTxTimeout;
-	RadioEvents.RxTimeout = OnRxTimeout;
-	RadioEvents.RxError = OnRxError;
-	RadioEvents.CadDone = OnCadDone;
+	RadioEvents.TxTimeout = radioTxTimeout;
+	RadioEvents.RxTimeout = radioRxTimeout;
+	RadioEvents.RxError = radioRxError;
+	RadioEvents.CadDone = radioCadDone;
 	// RadioEvents.PreAmpDetect = OnPreAmbDetect;
+	initRadio();
 	Radio.Init(&RadioEvents);
+	radioReset();
+
+	// Hook into DIO1 interrupt to wake up the radio task
+	attachInterrupt(_hwConfig.PIN_LORA_DIO_1, meshDio1Isr, RISING);
 
 	_numOfNodes = numOfNodes;
 
@@ -155,26 +300,32 @@ void initMesh(MeshEvents_t *events, int numOfNodes)
 	accessNodeList = xSemaphoreCreateBinary();
 	xSemaphoreGive(accessNodeList);
 
+	// Initialize the airtime budget
+	initAirtime();
+
+	// Initialize the slotted mode
+	initTdma();
+
+	// Initialize the end-to-end transport
+	initTransport(events);
+	// Initialize the fragmentation
+	initFragment(events);
+
+	// Initialize the rebroadcast list
+	initFlood();
+
 	// Create broadcast ID
 	broadcastID = deviceID & 0xFFFFFF00;
 	myLog_d("Broadcast ID is %08X", broadcastID);
 
 	// Put LoRa into standby
-	Radio.Standby();
+	radioStandby();
 
 	// Set Frequency
-	Radio.SetChannel(RF_FREQUENCY);
-
-	// Set transmit configuration
-	Radio.SetTxConfig(MODEM_LORA, TX_OUTPUT_POWER, 0, LORA_BANDWIDTH,
-					  LORA_SPREADING_FACTOR, LORA_CODINGRATE,
-					  LORA_PREAMBLE_LENGTH, LORA_FIX_LENGTH_PAYLOAD_ON,
-					  true, 0, 0, LORA_IQ_INVERSION_ON, TX_TIMEOUT_VALUE);
-	// Set receive configuration
-	Radio.SetRxConfig(MODEM_LORA, LORA_BANDWIDTH, LORA_SPREADING_FACTOR,
-					  LORA_CODINGRATE, 0, LORA_PREAMBLE_LENGTH,
-					  LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
-					  0, true, 0, 0, LORA_IQ_INVERSION_ON, true);
+	radioSetChannel(0);
+
+	// Set transmit and receive configuration
+	radioSetRate(LORA_SPREADING_FACTOR);
 
 	// Create message queue for LoRa
 	meshMsgQueue = xQueueCreate(10, sizeof(uint8_t));
@@ -187,7 +338,10 @@ void initMesh(MeshEvents_t *events, int numOfNodes)
 		myLog_d("LoRa message queue created!");
 	}
 
-	if (!xTaskCreate(meshTask, "MeshSync", 3096, NULL, 1, &meshTaskHandle))
+	// Start the profiling clock
+	initProfile();
+
+	if (!xTaskCreate(meshTask, "MeshSync", MESH_TASK_STACK, NULL, 1, &meshTaskHandle))
 	{
 		myLog_e("Starting Mesh Sync Task failed");
 	}
@@ -195,6 +349,138 @@ void initMesh(MeshEvents_t *events, int numOfNodes)
 	{
 		myLog_d("Starting Mesh Sync Task success");
 	}
+
+	if (!xTaskCreate(meshIrqTask, "MeshIrq", MESH_IRQ_TASK_STACK, NULL, 2, &meshIrqTaskHandle))
+	{
+		myLog_e("Starting Mesh Irq Task failed");
+	}
+	else
+	{
+		myLog_d("Starting Mesh Irq Task success");
+	}
+}
+
+/**
+ * Task to read the radio events
+ * Runs above the mesh task, a received package is copied into the RX ring
+ * and the radio listens again while the mesh task is still busy.
+ */
+void meshIrqTask(void *pvParameters)
+{
+	(void)pvParameters;
+	while (1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		uint32_t irqStart = profileNow();
+		radioIrqProcess();
+		profileAdd(PROF_IRQ_PROCESS, irqStart);
+	}
+}
+
+/**
+ * Queue a radio event for the mesh task
+ * @param type
+ * 		Type of the event
+ * @param value
+ * 		RX ring slot or CAD result
+ */
+static void radioEventQueueSend(radioEventType type, uint8_t value)
+{
+	radioEvent event = {(uint8_t)type, value};
+	xQueueSend(radioEventQueue, &event, 0);
+	meshWakeup();
+}
+
+/**
+ * Radio callbacks, the SX126x is in standby after TX and CAD, the mesh task decides what comes next
+ */
+static void radioTxDone(void)
+{
+	radioIdle();
+	radioEventQueueSend(RADIO_EVENT_TX_DONE, 0);
+}
+
+static void radioTxTimeout(void)
+{
+	radioIdle();
+	radioEventQueueSend(RADIO_EVENT_TX_TIMEOUT, 0);
+}
+
+static void radioCadDone(bool cadResult)
+{
+	radioIdle();
+	radioEventQueueSend(RADIO_EVENT_CAD_DONE, cadResult ? 1 : 0);
+}
+
+/**
+ * Radio callbacks for failed RX, listen again right away
+ */
+static void radioRxTimeout(void)
+{
+	radioRxRestart();
+	radioEventQueueSend(RADIO_EVENT_RX_TIMEOUT, 0);
+}
+
+static void radioRxError(void)
+{
+	radioRxRestart();
+	radioEventQueueSend(RADIO_EVENT_RX_ERROR, 0);
+}
+
+/**
+ * Start listening
+ * Continuous while there is data traffic, else with RX duty cycle
+ */
+void meshStartRx(void)
+{
+	if (rxRateSwitched || ((millis() - rxLastTraffic) < RX_ACTIVE_TIME))
+	{
+		rxContinuous = true;
+		radioRx(true);
+	}
+	else
+	{
+		rxContinuous = false;
+		radioRx(false);
+	}
+}
+
+/**
+ * Switch back to the common rate and rendezvous channel after a package was sent or received on a link rate
+ */
+void meshRevertRate(void)
+{
+	if ((txRateSf == 0) && !rxRateSwitched)
+	{
+		return;
+	}
+	myLog_d("Switching back to SF%d", LORA_SPREADING_FACTOR);
+	txRateSf = 0;
+	txChannel = 0;
+	rxRateSwitched = false;
+	radioSetChannel(0);
+	radioSetRate(LORA_SPREADING_FACTOR);
+	meshStartRx();
+}
+
+/**
+ * Give up a package that requested a link ACK
+ * Switches back to the common rate and tells the application about own
+ * packages, relayed packages are covered by the originator.
+ */
+static void meshLinkGiveUp(void)
+{
+	meshStatAdd(STAT_LINK_GIVE_UP);
+	meshRevertRate();
+	waitingLinkAck = false;
+	txAckRequested = false;
+	linkAckRetryNum = 0;
+
+	dataFrame<uint8_t> lostData(txPckg, txLen);
+	if ((lostData.orig() == deviceID) && (_MeshEvents != NULL) && (_MeshEvents->SendFailed != NULL))
+	{
+		_MeshEvents->SendFailed(lostData.msgType() == LORA_FORWARD ? lostData.from() : lostData.dest());
+	}
 }
 
 /**
@@ -207,21 +493,77 @@ void meshTask(void *pvParameters)
 	// Queue variable to be sent to the task
 	uint8_t queueIndex;
 
-	time_t notifyTimer = millis() + syncTime;
+	uint32_t notifyTimer = millis() + syncTime;
 	// time_t cleanTimer = millis();
 	time_t checkSwitchSyncTime = millis();
 
 	loraState = MESH_IDLE;
 	// Start waiting for data package
-	Radio.Standby();
-	// Radio.Rx(0);
-	Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
+	meshStartRx();
 
 	time_t txTimeout = millis();
 
+	// Time until the next timer deadline
+	int32_t nextWakeup;
+	// Time until the next transport retransmission
+	int32_t transportWakeup;
+	// Time until the next fragment should be queued
+	int32_t fragmentWakeup;
+	// Time until the next rebroadcast should be queued
+	int32_t floodWakeup;
+	// Time until the duty cycle limit allows the next package
+	int32_t airtimeDelay = 0;
+	// Time until the own slot starts
+	int32_t slotDelay = 0;
+
 	while (1)
 	{
-		Radio.IrqProcess();
+		uint32_t loopStart = profileNow();
+
+		// Handle the radio events in the order they happened
+		radioEvent event;
+		while (xQueueReceive(radioEventQueue, &event, 0) == pdTRUE)
+		{
+			switch (event.type)
+			{
+			case RADIO_EVENT_RX_DONE:
+			{
+				// The radio task restarted RX already, only the state of a pending TX is kept
+				if (loraState != MESH_TX)
+				{
+					loraState = MESH_IDLE;
+				}
+				rxRingSlot *slot = &rxRing[event.value];
+				rxTraceTime = slot->traceTime;
+				traceRx(TRACE_RX_RING, rxTraceTime);
+				uint32_t rxStart = profileNow();
+				meshRxProcess(slot->data, slot->size, slot->rssi, slot->snr);
+				profileAdd(PROF_RX_PROCESS, rxStart);
+				xQueueSend(rxRingFree, &event.value, 0);
+				if (loraState == MESH_IDLE)
+				{
+					// Switch between continuous and duty cycle RX after data traffic
+					meshStartRx();
+				}
+				break;
+			}
+			case RADIO_EVENT_TX_DONE:
+				OnTxDone();
+				break;
+			case RADIO_EVENT_TX_TIMEOUT:
+				OnTxTimeout();
+				break;
+			case RADIO_EVENT_RX_TIMEOUT:
+				OnRxTimeout();
+				break;
+			case RADIO_EVENT_RX_ERROR:
+				OnRxError();
+				break;
+			case RADIO_EVENT_CAD_DONE:
+				OnCadDone(event.value != 0);
+				break;
+			}
+		}
 
 		if (nodesChanged)
 		{
@@ -232,9 +574,9 @@ void meshTask(void *pvParameters)
 			}
 		}
 		// Time to sync the Mesh ???
-		if ((millis() - notifyTimer) >= syncTime)
+		if ((millis() - notifyTimer) >= (uint32_t)syncTime)
 		{
-			if (xSemaphoreTake(accessNodeList, (TickType_t)1000) == pdTRUE)
+			if (nodeListTake((TickType_t)1000) == pdTRUE)
 			{
 				myLog_v("Checking mesh map");
 				if (!cleanMap())
@@ -254,7 +596,16 @@ void meshTask(void *pvParameters)
 				// Get sub nodes
 				uint8_t subsLen = nodeMap(syncMsg.nodes);
 
-				xSemaphoreGive(accessNodeList);
+#if MESH_TDMA > 0
+				// Check the own slot against the latest map
+				tdmaUpdateSlot();
+				// Keep space for the end marker and the trailer
+				if (subsLen > 46)
+				{
+					subsLen = 46;
+				}
+#endif
+				nodeListGive();
 
 				if (subsLen != 0)
 				{
@@ -266,12 +617,25 @@ void meshTask(void *pvParameters)
 						checkNode |= syncMsg.nodes[idx][3] << 24;
 					}
 				}
-				syncMsg.nodes[subsLen][0] = 0xAA;
-				syncMsg.nodes[subsLen][1] = 0x55;
-				syncMsg.nodes[subsLen][2] = 0x00;
-				syncMsg.nodes[subsLen][3] = 0xFF;
-				syncMsg.nodes[subsLen][4] = 0xAA;
+				mapFrame<uint8_t>((uint8_t *)&syncMsg, sizeof(syncMsg)).setEndMarker(subsLen);
 				subsLen++;
+#if MESH_TDMA > 0
+				// Time stamp is updated when the map is sent
+				tdmaTrailer(syncMsg.nodes[subsLen]);
+				subsLen++;
+#endif
+#if MESH_TELEMETRY > 0
+				// Only if the map has space left, nodes are not dropped for it
+				if ((subsLen + TELEMETRY_ENTRIES) <= 48)
+				{
+					uint16_t battery = 0;
+					if ((_MeshEvents != NULL) && (_MeshEvents->BatteryLevel != NULL))
+					{
+						battery = _MeshEvents->BatteryLevel();
+					}
+					subsLen += telemetryBlock(syncMsg.nodes[subsLen], battery);
+				}
+#endif
 
 				subsLen = MAP_HEADER_SIZE + (subsLen * 5);
 
@@ -295,54 +659,232 @@ void meshTask(void *pvParameters)
 			checkSwitchSyncTime = millis();
 		}
 
+		// Retry the CAD after the channel was busy
+		if (cadRetryPending && ((millis() - cadRetryTime) >= CAD_RETRY_DELAY))
+		{
+			cadRetryPending = false;
+			radioStartCad();
+		}
+
+		// Send the package on the link rate after the receiver switched
+		if (rateSendPending && ((millis() - rateSendTime) >= RATE_TURNAROUND))
+		{
+			rateSendPending = false;
+			airtimeConsume(loraTimeOnAirUs(txWireLen, txRateSf, LORA_BANDWIDTH, LORA_CODINGRATE, LORA_PREAMBLE_LENGTH));
+			radioSend((uint8_t *)&txWire, txWireLen);
+		}
+
 		// Check if loraState is stuck in MESH_TX
-		if ((loraState == MESH_TX) && ((millis() - txTimeout) > 7500))
+		if ((loraState == MESH_TX) && ((millis() - txTimeout) > txStuckTimeout))
 		{
-			Radio.Standby();
-			// Radio.Rx(0);
-			Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
+			radioReset();
+			meshStartRx();
 
 			loraState = MESH_IDLE;
-			myLog_e("loraState stuck in TX for 2 seconds");
+			cadRetryPending = false;
+			rateSendPending = false;
+			sendingLinkAck = false;
+			sendingRateSwitch = false;
+			meshRevertRate();
+			myLog_e("loraState stuck in TX for %lu ms", (unsigned long)txStuckTimeout);
+			meshStatAdd(STAT_TX_STUCK);
+			traceTxAbort();
+		}
+
+		// Check if the package on the link rate did not come
+		if (rxRateSwitched && !linkAckPending && ((millis() - rxRateSwitchTime) >= rxRateWindow))
+		{
+			myLog_w("No package on link rate");
+			meshRevertRate();
+		}
+
+		// Go back to RX duty cycle if there was no data traffic for a while
+		if (rxContinuous && (loraState == MESH_IDLE) && !rxRateSwitched && !waitingLinkAck && !linkAckPending &&
+			((millis() - rxLastTraffic) >= RX_ACTIVE_TIME))
+		{
+			myLog_v("No traffic, switching to RX duty cycle");
+			meshStartRx();
+		}
+
+		// Check if a link ACK has to be sent
+		if (linkAckPending && (loraState != MESH_TX) && ((millis() - linkAckTime) >= LINK_ACK_TURNAROUND))
+		{
+			linkAckPending = false;
+			myLog_d("Sending link ACK #%d to %08X", linkAck.seq, linkAck.dest);
+
+			loraState = MESH_TX;
+			sendingLinkAck = true;
+			// Link ACK is sent after a fixed turnaround, no CAD
+			airtimeConsume(meshTimeOnAirUs(ACK_MSG_SIZE));
+			radioSend((uint8_t *)&linkAck, ACK_MSG_SIZE);
+			txTimeout = millis();
+			txStuckTimeout = meshTimeOnAirUs(ACK_MSG_SIZE) / 1000 + TX_WATCHDOG_MARGIN;
+		}
+
+		// Check if the link ACK for the last package is overdue
+		slotDelay = 0;
+		if (waitingLinkAck && ((millis() - linkAckWaitTime) >= linkAckTimeout))
+		{
+			// Retransmissions with the full header wait for the own slot
+			slotDelay = tdmaWait(txLen);
+			if ((linkAckRetryNum < LINK_ACK_RETRY) && (loraState != MESH_TX) && (slotDelay == 0))
+			{
+				linkAckRetryNum++;
+				waitingLinkAck = false;
+				// Retransmissions use the common rate
+				meshRevertRate();
+				// and the full header, the receiver might not resolve the short addresses
+				memcpy(txWire, txPckg, txLen);
+				txWireLen = txLen;
+				myLog_w("No link ACK for #%d, retransmission %d", linkSeqNum, linkAckRetryNum);
+
+				loraState = MESH_TX;
+
+				radioStartCad();
+				txTimeout = millis();
+				txStuckTimeout = meshTxWatchdog(txWireLen);
+			}
+			else if (linkAckRetryNum >= LINK_ACK_RETRY)
+			{
+				myLog_e("No link ACK for #%d after %d retries, giving up", linkSeqNum, LINK_ACK_RETRY);
+				meshLinkGiveUp();
+			}
 		}
 
 		// Check if we have something in the queue
-		if (xQueuePeek(sendQueue, &queueIndex, (TickType_t)10) == pdTRUE)
+		airtimeDelay = 0;
+		if (xQueuePeek(sendQueue, &queueIndex, (TickType_t)0) == pdTRUE)
 		{
-			if (loraState != MESH_TX)
+			// Respect the duty cycle limit
+			airtimeDelay = airtimeWait(meshTimeOnAirUs(sendMsgSize[queueIndex]));
+			// Send only in the own slot
+			if (!waitingLinkAck && (slotDelay == 0))
+			{
+				slotDelay = tdmaWait(sendMsgSize[queueIndex]);
+			}
+			if ((loraState != MESH_TX) && !waitingLinkAck && !linkAckPending && (airtimeDelay == 0) && (slotDelay == 0))
 			{
 #ifdef ESP32
 				portENTER_CRITICAL(&accessMsgQueue);
 #else
 				taskENTER_CRITICAL();
 #endif
+				uint32_t critStart = profileNow();
 				txLen = sendMsgSize[queueIndex];
 				memset(txPckg, 0, 256);
 				memcpy(txPckg, &sendMsg[queueIndex].mark1, txLen);
 				if (xQueueReceive(sendQueue, &queueIndex, portMAX_DELAY) == pdTRUE)
 				{
 					sendMsg[queueIndex].type = 0;
+					traceDequeue(queueIndex);
+					profileAdd(PROF_CRITICAL, critStart);
 #ifdef ESP32
 					portEXIT_CRITICAL(&accessMsgQueue);
 #else
 					taskEXIT_CRITICAL();
 #endif
 
+					// Listen continuously for the answer to data packages
+					if ((txPckg[3] & LORA_TYPE_MASK) != LORA_NODEMAP)
+					{
+						rxLastTraffic = millis();
+					}
+
+					// Request a link ACK for packages to a single node
+					txPckg[3] &= ~LORA_FLAG_ACK_REQ;
+					txAckRequested = false;
+					linkAckRetryNum = 0;
+#if LINK_ACK > 0
+					if (((txPckg[3] & LORA_TYPE_MASK) == LORA_DIRECT) || ((txPckg[3] & LORA_TYPE_MASK) == LORA_FORWARD))
+					{
+						linkSeqNum++;
+						txPckg[3] |= LORA_FLAG_ACK_REQ;
+						dataFrame<uint8_t>(txPckg, txLen).setSeq(linkSeqNum);
+						txAckRequested = true;
+					}
+#endif
+
+					// Mark the package as sent by us on this link, the receiver sends its link ACK here
+					uint8_t hopType = txPckg[3] & LORA_TYPE_MASK;
+					if ((hopType != LORA_NODEMAP) && (txLen >= DATA_HEADER_SIZE))
+					{
+						dataFrame<uint8_t>(txPckg, txLen).setHop(deviceID);
+					}
+
+#if MESH_COMPRESS > 0
+					// Compress the data, forwarded packages are compressed already
+					uint8_t txType = txPckg[3] & LORA_TYPE_MASK;
+					if (((txType == LORA_DIRECT) || (txType == LORA_FORWARD) || (txType == LORA_BROADCAST)) &&
+						((txPckg[3] & LORA_FLAG_COMPRESSED) == 0) && (txLen > DATA_HEADER_SIZE))
+					{
+						uint8_t compressLen = meshCompress(&txPckg[DATA_HEADER_SIZE], txLen - DATA_HEADER_SIZE,
+														   compressBuffer, txLen - DATA_HEADER_SIZE);
+						if (compressLen != 0)
+						{
+							myLog_v("Compressed %d bytes to %d bytes", txLen - DATA_HEADER_SIZE, compressLen);
+							memcpy(&txPckg[DATA_HEADER_SIZE], compressBuffer, compressLen);
+							txLen = DATA_HEADER_SIZE + compressLen;
+							txPckg[3] |= LORA_FLAG_COMPRESSED;
+						}
+					}
+#endif
+
+					// Use the compact header if all addresses are unique
+					txWireLen = 0;
+#if MESH_COMPACT_HEADER > 0
+					txWireLen = compactHeader(txPckg, txLen, txWire);
+#endif
+					if (txWireLen == 0)
+					{
+						memcpy(txWire, txPckg, txLen);
+						txWireLen = txLen;
+					}
+
+					txRateSf = 0;
+					txChannel = 0;
+#if MESH_CHANNELS > 1
+					// Move larger unicast packages to the data channel of the next hop
+					if ((((txPckg[3] & LORA_TYPE_MASK) == LORA_DIRECT) || ((txPckg[3] & LORA_TYPE_MASK) == LORA_FORWARD)) &&
+						(txWireLen >= CHANNEL_MIN_SIZE))
+					{
+						txChannel = meshDataChannel(dataFrame<uint8_t>(txPckg, txLen).dest());
+						txRateSf = LORA_SPREADING_FACTOR;
+					}
+#endif
+#if MESH_ADR > 0
+					// Use a faster rate for a good link to the next hop
+					if ((((txPckg[3] & LORA_TYPE_MASK) == LORA_DIRECT) || ((txPckg[3] & LORA_TYPE_MASK) == LORA_FORWARD)) &&
+						(nodeListTake((TickType_t)10) == pdTRUE))
+					{
+						uint8_t linkSf = getLinkSf(dataFrame<uint8_t>(txPckg, txLen).dest());
+						nodeListGive();
+						// Only if the rate switch message pays off
+						if ((linkSf != LORA_SPREADING_FACTOR) &&
+							(meshTimeOnAirUs(txWireLen) >
+							 (meshTimeOnAirUs(RATE_MSG_SIZE) + RATE_TURNAROUND * 1000 +
+							  loraTimeOnAirUs(txWireLen, linkSf, LORA_BANDWIDTH, LORA_CODINGRATE, LORA_PREAMBLE_LENGTH))))
+						{
+							txRateSf = linkSf;
+						}
+					}
+#endif
+					if (txRateSf != 0)
+					{
+						myLog_d("Sending to %08X with SF%d on channel %d", dataFrame<uint8_t>(txPckg, txLen).dest(), txRateSf, txChannel);
+					}
+
 					myLog_d("Sending msg #%d with len %d", queueIndex, txLen);
 
 					loraState = MESH_TX;
 
-					Radio.Standby();
-					Radio.SetCadParams(LORA_CAD_08_SYMBOL, LORA_SPREADING_FACTOR + 13, 10, LORA_CAD_ONLY, 0);
-					// SX126xSetCadParams(LORA_CAD_08_SYMBOL, LORA_SPREADING_FACTOR + 13, 10, LORA_CAD_ONLY, 0);
-					// SX126xSetDioIrqParams(IRQ_RADIO_ALL,
-					// 					  IRQ_RADIO_ALL,
-					// 					  IRQ_RADIO_NONE, IRQ_RADIO_NONE);
-					Radio.StartCad();
+					traceTx(TRACE_CAD_START);
+					radioStartCad();
 					txTimeout = millis();
+					txStuckTimeout = meshTxWatchdog(txWireLen);
 				}
 				else
 				{
+					profileAdd(PROF_CRITICAL, critStart);
 #ifdef ESP32
 					portEXIT_CRITICAL(&accessMsgQueue);
 #else
@@ -352,13 +894,83 @@ void meshTask(void *pvParameters)
 			}
 		}
 
-		// Enable a task switch
-		delay(100);
+		// Handle transport retransmissions
+		transportWakeup = transportHandler();
+		// Queue the next fragment
+		fragmentWakeup = fragmentHandler();
+		// Queue the rebroadcasts
+		floodWakeup = floodHandler();
+
+		// Calculate time until the next timer deadline
+		nextWakeup = (int32_t)((uint32_t)syncTime - (millis() - notifyTimer));
+		if (transportWakeup < nextWakeup)
+		{
+			nextWakeup = transportWakeup;
+		}
+		if (fragmentWakeup < nextWakeup)
+		{
+			nextWakeup = fragmentWakeup;
+		}
+		if (floodWakeup < nextWakeup)
+		{
+			nextWakeup = floodWakeup;
+		}
+		if ((syncTime != DEFAULT_SYNCTIME) && ((int32_t)(SWITCH_SYNCTIME - (millis() - checkSwitchSyncTime)) < nextWakeup))
+		{
+			nextWakeup = (int32_t)(SWITCH_SYNCTIME - (millis() - checkSwitchSyncTime));
+		}
+		if ((loraState == MESH_TX) && ((int32_t)(txStuckTimeout - (millis() - txTimeout)) < nextWakeup))
+		{
+			nextWakeup = (int32_t)(txStuckTimeout - (millis() - txTimeout));
+		}
+		if (rxRateSwitched && ((int32_t)(rxRateWindow - (millis() - rxRateSwitchTime)) < nextWakeup))
+		{
+			nextWakeup = (int32_t)(rxRateWindow - (millis() - rxRateSwitchTime));
+		}
+		if ((airtimeDelay > 0) && (airtimeDelay < nextWakeup))
+		{
+			nextWakeup = airtimeDelay;
+		}
+		if (rxContinuous && ((int32_t)(RX_ACTIVE_TIME - (millis() - rxLastTraffic)) < nextWakeup))
+		{
+			nextWakeup = (int32_t)(RX_ACTIVE_TIME - (millis() - rxLastTraffic));
+		}
+		if ((slotDelay > 0) && (slotDelay < nextWakeup))
+		{
+			nextWakeup = slotDelay;
+		}
+		if (linkAckPending && ((int32_t)(LINK_ACK_TURNAROUND - (millis() - linkAckTime)) < nextWakeup))
+		{
+			nextWakeup = (int32_t)(LINK_ACK_TURNAROUND - (millis() - linkAckTime));
+		}
+		if (waitingLinkAck && ((int32_t)(linkAckTimeout - (millis() - linkAckWaitTime)) < nextWakeup))
+		{
+			nextWakeup = (int32_t)(linkAckTimeout - (millis() - linkAckWaitTime));
+		}
+		if (cadRetryPending && ((int32_t)(CAD_RETRY_DELAY - (millis() - cadRetryTime)) < nextWakeup))
+		{
+			nextWakeup = (int32_t)(CAD_RETRY_DELAY - (millis() - cadRetryTime));
+		}
+		if (rateSendPending && ((int32_t)(RATE_TURNAROUND - (millis() - rateSendTime)) < nextWakeup))
+		{
+			nextWakeup = (int32_t)(RATE_TURNAROUND - (millis() - rateSendTime));
+		}
+		if (nextWakeup <= 0)
+		{
+			nextWakeup = 1;
+		}
+
+		profileAdd(PROF_MESH_LOOP, loopStart);
+
+		// Sleep until DIO1 interrupt, a new send request or the next timer deadline
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(nextWakeup));
 	}
 }
 
 /**
  * Callback after a LoRa package was received
+ * Only copies the package into the RX ring and restarts listening,
+ * the package is handled by the mesh task
  * @param rxPayload
  * 			Pointer to the received data
  * @param rxSize
@@ -370,7 +982,73 @@ void meshTask(void *pvParameters)
  */
 void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 {
-	// Secure buffer before restart listening
+	uint8_t slotIdx;
+	if (xQueueReceive(rxRingFree, &slotIdx, 0) != pdTRUE)
+	{
+		// Mesh task is behind by RX_RING_SIZE packages
+		meshStatAdd(STAT_RX_RING_DROP);
+		radioRxRestart();
+		return;
+	}
+
+	rxRingSlot *slot = &rxRing[slotIdx];
+	slot->traceTime = traceRxStart();
+	slot->size = rxSize > 255 ? 255 : rxSize;
+	slot->rssi = rxRssi;
+	slot->snr = rxSnr;
+	memcpy(slot->data, rxPayload, slot->size);
+
+	// Restart listening, the mesh task may still be busy with older packages
+	radioRxRestart();
+
+	// Wake up the mesh task to handle the package
+	radioEventQueueSend(RADIO_EVENT_RX_DONE, slotIdx);
+}
+
+/**
+ * Decompress the payload of a received data package if necessary
+ * @param frame
+ * 			Received data package
+ * @param data
+ * 			Payload, set to the decompressed data
+ * @param dataLen
+ * 			Size of the payload, set to the size of the decompressed data
+ * @return bool
+ * 			False if the compressed data is invalid
+ */
+static bool meshRxPayload(dataFrame<uint8_t> &frame, uint8_t *&data, uint16_t &dataLen)
+{
+	if ((frame.type() & LORA_FLAG_COMPRESSED) == 0)
+	{
+		return true;
+	}
+	int16_t decompressLen = meshDecompress(data, dataLen, decompressBuffer, DATA_MAX_SIZE);
+	if (decompressLen < 0)
+	{
+		myLog_e("Invalid compressed data from %08X", frame.from());
+		return false;
+	}
+	decompressBuffer[decompressLen] = 0;
+	data = decompressBuffer;
+	dataLen = decompressLen;
+	return true;
+}
+
+/**
+ * Handle a received LoRa package
+ * Called by the mesh task for each package in the RX ring
+ * @param rxPayload
+ * 			Pointer to the received data
+ * @param rxSize
+ * 			Length of the received package
+ * @param rxRssi
+ * 			Signal strength while the package was received
+ * @param rxSnr
+ * 			Signal to noise ratio while the package was received
+ */
+void meshRxProcess(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
+{
+	// Copy into the work buffer, it has room to expand the header
 	if (rxSize < 256)
 	{
 		memcpy(rxBuffer, rxPayload, rxSize + 1);
@@ -384,40 +1062,155 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 
 	uint16_t tempSize = rxSize;
 
-	delay(1);
+	// Convert a compact header into the full header
+	if (tempSize != 0)
+	{
+		tempSize = expandHeader(rxBuffer, tempSize);
+		if (tempSize == 0)
+		{
+			// Not for us or unknown sender
+			return;
+		}
+		// Data packages of older firmware get the full header
+		tempSize = expandLegacyHeader(rxBuffer, tempSize);
+		if (tempSize == 0)
+		{
+			myLog_e("Package of older firmware too large");
+			meshStatAdd(STAT_RX_INVALID);
+			return;
+		}
+		rxBuffer[tempSize] = 0;
+	}
 
-	loraState = MESH_IDLE;
+	// Reject malformed frames before anything is parsed
+	frameView<uint8_t> rxFrame(rxBuffer, tempSize);
+	uint8_t msgType = LORA_INVALID;
+	bool frameOk = false;
+	if (rxFrame.valid(FRAME_FROM + 4))
+	{
+		msgType = rxFrame.msgType();
+		switch (msgType)
+		{
+		case LORA_DIRECT:
+		case LORA_FORWARD:
+		case LORA_BROADCAST:
+			frameOk = dataFrame<uint8_t>(rxBuffer, tempSize).valid();
+			break;
+		case LORA_NODEMAP:
+			frameOk = mapFrame<uint8_t>(rxBuffer, tempSize).valid();
+			break;
+		case LORA_ACK:
+			frameOk = ackFrame<uint8_t>(rxBuffer, tempSize).valid();
+			break;
+		case LORA_RATE:
+			frameOk = rateFrame<uint8_t>(rxBuffer, tempSize).valid();
+			break;
+		case LORA_ECHO:
+		case LORA_ECHO_REPLY:
+			frameOk = echoFrame<uint8_t>(rxBuffer, tempSize).valid();
+			break;
+		default:
+			break;
+		}
+	}
 
 	myLog_v("OnRxDone");
 	myLog_d("LoRa Packet received size:%d, rssi:%d, snr:%d", rxSize, rxRssi, rxSnr);
-#if MYLOG_LOG_LEVEL == MYLOG_LOG_LEVEL_VERBOSE
-	for (int idx = 0; idx < rxSize; idx++)
+
+	// Data traffic keeps the receiver listening continuously
+	if (frameOk && (msgType != LORA_NODEMAP))
 	{
-		Serial.printf(" %02X", rxBuffer[idx]);
+		rxLastTraffic = millis();
+		if (!rxContinuous)
+		{
+			meshStartRx();
+		}
 	}
-	Serial.println("");
-#endif
-
-	// Restart listening
-	Radio.Standby();
-	// Radio.Rx(0);
-	Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
 
 	// Check the received data
-	if ((rxBuffer[0] == 'L') && (rxBuffer[1] == 'o') && (rxBuffer[2] == 'R'))
+	if (frameOk)
 	{
+		meshStatAdd((meshStatId)(STAT_RX_DIRECT + msgType - LORA_DIRECT));
+
 		// Valid Mesh data received
-		mapMsg *thisMsg = (mapMsg *)rxBuffer;
-		dataMsg *thisDataMsg = (dataMsg *)rxBuffer;
+		mapFrame<uint8_t> thisMap(rxBuffer, tempSize);
+		dataFrame<uint8_t> thisData(rxBuffer, tempSize);
+
+		if (((msgType == LORA_DIRECT) || (msgType == LORA_FORWARD)) &&
+			(thisData.dest() == deviceID) && ((thisData.type() & LORA_FLAG_ACK_REQ) != 0))
+		{
+			// Sender requests a link ACK, ACK even duplicates as our last ACK might got lost
+			linkAck.dest = thisData.hop();
+			linkAck.from = deviceID;
+			linkAck.seq = thisData.seq();
+			linkAckPending = true;
+			linkAckTime = millis();
+
+			if (rxRateSwitched)
+			{
+				// Stay on the link rate until the link ACK is sent
+				rxRateSwitchTime = millis();
+			}
 
-		if (thisMsg->type == LORA_NODEMAP)
+			if (isOldLinkPackage(thisData.orig(), thisData.from(), thisData.hop(), thisData.seq()))
+			{
+				myLog_w("Got a retransmitted package #%d, dismissing it", thisData.seq());
+				meshStatAdd(STAT_RX_DUPLICATE);
+				return;
+			}
+		}
+
+		if (rxRateSwitched && !linkAckPending && (msgType != LORA_RATE))
+		{
+			// Package on the link rate received
+			meshRevertRate();
+		}
+
+		// Payload of data packages, decompressed only once the package is known to be for us
+		uint8_t *rxData = thisData.payload();
+		uint16_t rxDataLen = tempSize > DATA_HEADER_SIZE ? thisData.payloadSize() : 0;
+
+		if (msgType == LORA_ACK)
+		{
+			ackFrame<uint8_t> thisAck(rxBuffer, tempSize);
+			if (waitingLinkAck &&
+				(thisAck.from() == dataFrame<uint8_t>(txPckg, txLen).dest()) &&
+				(thisAck.dest() == deviceID) &&
+				(thisAck.seq() == linkSeqNum))
+			{
+				myLog_d("Got link ACK #%d from %08X", thisAck.seq(), thisAck.from());
+				meshRevertRate();
+				waitingLinkAck = false;
+				txAckRequested = false;
+				linkAckRetryNum = 0;
+			}
+		}
+		else if (msgType == LORA_RATE)
+		{
+			rateFrame<uint8_t> thisRate(rxBuffer, tempSize);
+			if ((thisRate.dest() == deviceID) &&
+				(thisRate.sf() >= ADR_MIN_SF) && (thisRate.sf() <= LORA_SPREADING_FACTOR) &&
+				(thisRate.channel() < MESH_CHANNELS))
+			{
+				// Listen on the link rate and channel for one package
+				myLog_d("Switching to SF%d channel %d for package from %08X", thisRate.sf(), thisRate.channel(), thisRate.from());
+				rxRateSwitched = true;
+				rxRateSwitchTime = millis();
+				rxRateWindow = RATE_TURNAROUND + 100 +
+							   loraTimeOnAirUs(255, thisRate.sf(), LORA_BANDWIDTH, LORA_CODINGRATE, LORA_PREAMBLE_LENGTH) / 1000;
+				radioSetChannel(thisRate.channel());
+				radioSetRate(thisRate.sf());
+				meshStartRx();
+			}
+		}
+		else if (msgType == LORA_NODEMAP)
 		{
 			/// \todo for debug make some nodes unreachable
 #ifdef BROKEN_NET
 			switch (deviceID)
 			{
 			case 0x1E2F8C8F:
-				if ((thisMsg->from == 0x2DDF3A8F) || (thisMsg->from == 0xFBAFD33E))
+				if ((thisMap.from() == 0x2DDF3A8F) || (thisMap.from() == 0xFBAFD33E))
 				{
 				}
 				else
@@ -427,7 +1220,7 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 				}
 				break;
 			case 0x2DDF3A8F:
-				if ((thisMsg->from == 0xBF6CED4E) || (thisMsg->from == 0x1E2F8C8F))
+				if ((thisMap.from() == 0xBF6CED4E) || (thisMap.from() == 0x1E2F8C8F))
 				{
 				}
 				else
@@ -437,7 +1230,7 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 				}
 				break;
 			case 0xFBAFD33E:
-				if ((thisMsg->from == 0x2DDF3A8F) || (thisMsg->from == 0x1E2F8C8F))
+				if ((thisMap.from() == 0x2DDF3A8F) || (thisMap.from() == 0x1E2F8C8F))
 				{
 				}
 				else
@@ -447,21 +1240,21 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 				}
 				break;
 			case 0xBF6CED4E:
-				if ((thisMsg->from == 0xBF6C660E) || (thisMsg->from == 0x1E2F8C8F) || (thisMsg->from == 0xFBAFD33E))
+				if ((thisMap.from() == 0xBF6C660E) || (thisMap.from() == 0x1E2F8C8F) || (thisMap.from() == 0xFBAFD33E))
 				{
 					myLog_d("No connection from 0xBF6CED4E to 0x1E2F8C8F & 0xBF6C660E & 0xFBAFD33E");
 					return;
 				}
 				break;
 			case 0xBF6C660E:
-				if ((thisMsg->from == 0xBF6CED4E) || (thisMsg->from == 0x1E2F8C8F) || (thisMsg->from == 0x2DDF3A8F) || (thisMsg->from == 0xFBAFD33E))
+				if ((thisMap.from() == 0xBF6CED4E) || (thisMap.from() == 0x1E2F8C8F) || (thisMap.from() == 0x2DDF3A8F) || (thisMap.from() == 0xFBAFD33E))
 				{
 					myLog_d("No connection from 0xBF6C660E to 0x1E2F8C8F & 0xBF6CED4E & 0x2DDF3A8F & 0xFBAFD33E");
 					return;
 				}
 				break;
 			default:
-				if ((thisMsg->from == 0x2DDF3A8F) || (thisMsg->from == 0x1E2F8C8F) || (thisMsg->from == 0xFBAFD33E))
+				if ((thisMap.from() == 0x2DDF3A8F) || (thisMap.from() == 0x1E2F8C8F) || (thisMap.from() == 0xFBAFD33E))
 				{
 					myLog_d("No connection from 0x1E2F8C8F & 0x2DDF3A8F & 0xFBAFD33E to any other node");
 					return;
@@ -470,9 +1263,13 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 			}
 #endif
 			myLog_d("Got map message");
-			// Mapping received
-			uint8_t subsSize = tempSize - MAP_HEADER_SIZE;
-			uint8_t numSubs = subsSize / 5;
+			// Mapping received, size and end marker were checked already
+			uint8_t numSubs = thisMap.numNodes();
+
+			if (thisMap.hasTelemetry())
+			{
+				telemetryRx(thisMap.from(), thisMap.telemetry(), thisMap.telemetrySize(), rxRssi, rxSnr);
+			}
 
 			// Serial.println("********************************");
 			// for (int idx = 0; idx < tempSize; idx++)
@@ -483,28 +1280,27 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 			// Serial.printf("subsSize %d -> # subs %d\n", subsSize, subsSize / 5);
 			// Serial.println("********************************");
 
-			// Check if end marker is in the message
-			if ((thisMsg->nodes[numSubs - 1][0] != 0xAA) ||
-				(thisMsg->nodes[numSubs - 1][1] != 0x55) ||
-				(thisMsg->nodes[numSubs - 1][2] != 0x00) ||
-				(thisMsg->nodes[numSubs - 1][3] != 0xFF) ||
-				(thisMsg->nodes[numSubs - 1][4] != 0xAA))
-			{
-				myLog_e("Invalid map, end marker is missing from %08X", thisMsg->from);
-				xSemaphoreGive(accessNodeList);
-				return;
-			}
-			if (xSemaphoreTake(accessNodeList, (TickType_t)1000) == pdTRUE)
+			if (nodeListTake((TickType_t)1000) == pdTRUE)
 			{
-				nodesChanged = addNode(thisMsg->from, 0, 0);
+				nodesChanged = addNode(thisMap.from(), 0, 0);
+				updateNodeSnr(thisMap.from(), rxSnr);
+#if MESH_TDMA > 0
+				if (thisMap.hasTrailer())
+				{
+					uint8_t *tdmaInfo = thisMap.trailer();
+					updateNodeSlot(thisMap.from(), tdmaInfo[0]);
+					tdmaUpdateSlot();
+					tdmaSync(tdmaInfo[1] | (tdmaInfo[2] << 8) | (tdmaInfo[3] << 16) | ((uint32_t)tdmaInfo[4] << 24), tempSize);
+				}
+#endif
 
 				// Remove nodes that use sending node as hop
-				clearSubs(thisMsg->from);
+				clearSubs(thisMap.from());
 
-				myLog_v("From %08X", thisMsg->from);
-				myLog_v("Dest %08X", thisMsg->dest);
+				myLog_v("From %08X", thisMap.from());
+				myLog_v("Dest %08X", thisMap.dest());
 
-				if (subsSize != 0)
+				if (numSubs != 0)
 				{
 					// Mapping contains subs
 
@@ -512,7 +1308,7 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 					myLog_v("#subs %d", numSubs);
 
 					// Serial.println("++++++++++++++++++++++++++++");
-					// Serial.printf("From %08X Dest %08X #Subs %d\n", thisMsg->from, thisMsg->dest, numSubs);
+					// Serial.printf("From %08X Dest %08X #Subs %d\n", thisMap.from(), thisMap.dest(), numSubs);
 					// for (int idx = 0; idx < numSubs; idx++)
 					// {
 					// 	uint32_t subId = (uint32_t)thisMsg->nodes[idx][0];
@@ -524,36 +1320,47 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 					// }
 					// Serial.println("++++++++++++++++++++++++++++");
 
-					for (int idx = 0; idx < numSubs - 1; idx++)
+					for (int idx = 0; idx < numSubs; idx++)
 					{
-						uint32_t subId = (uint32_t)thisMsg->nodes[idx][0];
-						subId += (uint32_t)thisMsg->nodes[idx][1] << 8;
-						subId += (uint32_t)thisMsg->nodes[idx][2] << 16;
-						subId += (uint32_t)thisMsg->nodes[idx][3] << 24;
-						uint8_t hops = thisMsg->nodes[idx][4];
+						uint32_t subId = thisMap.nodeId(idx);
+						uint8_t hops = thisMap.nodeHops(idx);
 						if (subId != deviceID)
 						{
-							nodesChanged |= addNode(subId, thisMsg->from, hops + 1);
+							nodesChanged |= addNode(subId, thisMap.from(), hops + 1);
 							myLog_v("Subs %08X", subId);
 						}
 					}
 				}
-				xSemaphoreGive(accessNodeList);
+				nodeListGive();
+				meshStatAdd(STAT_MAP_APPLIED);
 			}
 			else
 			{
 				myLog_e("Could not access map to add node");
 			}
 		}
-		else if (thisDataMsg->type == LORA_DIRECT)
+		else if (msgType == LORA_DIRECT)
 		{
-			if (thisDataMsg->dest == deviceID)
+			if (thisData.dest() == deviceID)
 			{
+				if (!meshRxPayload(thisData, rxData, rxDataLen))
+				{
+					return;
+				}
 				// Message is for us, call user callback to handle the data
-				myLog_d("Got data message type %c >%s<", thisDataMsg->data[0], (char *)&thisDataMsg->data[1]);
-				if ((_MeshEvents != NULL) && (_MeshEvents->DataAvailable != NULL))
+				myLog_d("Got data message type %c >%s<", rxData[0], (char *)&rxData[1]);
+				if ((thisData.type() & LORA_FLAG_TRANSPORT) != 0)
 				{
-					_MeshEvents->DataAvailable(thisDataMsg->orig, thisDataMsg->data, tempSize - 12, rxRssi, rxSnr);
+					transportRx(thisData.orig(), rxData, rxDataLen, rxRssi, rxSnr);
+				}
+				else if ((thisData.type() & LORA_FLAG_FRAGMENT) != 0)
+				{
+					fragmentRx(thisData.orig(), rxData, rxDataLen, rxRssi, rxSnr);
+				}
+				else if ((_MeshEvents != NULL) && (_MeshEvents->DataAvailable != NULL))
+				{
+					traceRx(TRACE_RX_CALLBACK, rxTraceTime);
+					_MeshEvents->DataAvailable(thisData.orig(), rxData, rxDataLen, rxRssi, rxSnr);
 				}
 			}
 			else
@@ -561,44 +1368,51 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 				// Message is not for us
 			}
 		}
-		else if (thisDataMsg->type == LORA_FORWARD)
+		else if (msgType == LORA_FORWARD)
 		{
-			if (thisDataMsg->dest == deviceID)
+			if ((thisData.dest() == deviceID) && (thisData.ttl() <= 1))
+			{
+				// Package was forwarded too often, maybe a routing loop
+				myLog_w("TTL of package from %08X to %08X expired", thisData.orig(), thisData.from());
+				meshStatAdd(STAT_TTL_DROP);
+			}
+			else if (thisData.dest() == deviceID)
 			{
 				// Message is for sub node, forward the message
+				thisData.setTtl(thisData.ttl() - 1);
 				nodesList route;
-				if (xSemaphoreTake(accessNodeList, (TickType_t)1000) == pdTRUE)
+				if (nodeListTake((TickType_t)1000) == pdTRUE)
 				{
-					if (getRoute(thisDataMsg->from, &route))
+					if (getRoute(thisData.from(), &route))
 					{
 						// We found a route, send package to next hop
 						if (route.firstHop == 0)
 						{
 							myLog_i("Route for %lX is direct", route.nodeId);
 							// Destination is a direct
-							thisDataMsg->dest = thisDataMsg->from;
-							thisDataMsg->from = thisDataMsg->orig;
-							thisDataMsg->type = LORA_DIRECT;
+							thisData.setDest(thisData.from());
+							thisData.setFrom(thisData.orig());
+							thisData.setType((thisData.type() & ~LORA_TYPE_MASK) | LORA_DIRECT);
 						}
 						else
 						{
 							myLog_i("Route for %lX is to %lX", route.nodeId, route.firstHop);
 							// Destination is a sub
-							thisDataMsg->dest = route.firstHop;
-							thisDataMsg->type = LORA_FORWARD;
+							thisData.setDest(route.firstHop);
+							thisData.setType((thisData.type() & ~LORA_TYPE_MASK) | LORA_FORWARD);
 						}
 
 						// Put message into send queue
-						if (!addSendRequest(thisDataMsg, tempSize))
+						if (!addSendRequest((dataMsg *)rxBuffer, tempSize))
 						{
 							myLog_e("Cannot forward message because send queue is full");
 						}
 					}
 					else
 					{
-						myLog_e("No route found for %lX", thisMsg->from);
+						myLog_e("No route found for %lX", thisData.from());
 					}
-					xSemaphoreGive(accessNodeList);
+					nodeListGive();
 				}
 				else
 				{
@@ -610,45 +1424,62 @@ void OnRxDone(uint8_t *rxPayload, uint16_t rxSize, int16_t rxRssi, int8_t rxSnr)
 				// Message is not for us
 			}
 		}
-		else if (thisDataMsg->type == LORA_BROADCAST)
+		else if ((msgType == LORA_ECHO) || (msgType == LORA_ECHO_REPLY))
+		{
+			if (thisData.dest() == deviceID)
+			{
+				// Forward, answer or finish the echo
+				echoRx(rxBuffer, tempSize);
+			}
+		}
+		else if (msgType == LORA_BROADCAST)
 		{
 			// This is a broadcast. Forward to all direct nodes, but not to the one who sent it
-			myLog_d("Handling broadcast with ID %08X from %08X", thisDataMsg->dest, thisDataMsg->from);
+			myLog_d("Handling broadcast with ID %08X from %08X", thisData.dest(), thisData.from());
 			// Check if this broadcast is coming from ourself
-			if ((thisDataMsg->dest & 0xFFFFFF00) == (deviceID & 0xFFFFFF00))
+			if ((thisData.dest() & 0xFFFFFF00) == (deviceID & 0xFFFFFF00))
 			{
 				myLog_w("We received our own broadcast, dismissing it");
 				return;
 			}
 			// Check if we handled this broadcast already
-			if (isOldBroadcast(thisDataMsg->dest))
+			if (isOldBroadcast(thisData.dest()))
 			{
 				myLog_w("Got an old broadcast, dismissing it");
+				meshStatAdd(STAT_RX_DUPLICATE);
+				floodDuplicate(thisData.dest(), thisData.hop());
 				return;
 			}
 
-			// Put broadcast into send queue
-			if (!addSendRequest(thisDataMsg, tempSize))
+			// Rebroadcast after the assessment delay if the hop limit is not reached
+			if (thisData.ttl() > 1)
 			{
-				myLog_e("Cannot forward broadcast because send queue is full");
+				thisData.setTtl(thisData.ttl() - 1);
+				floodRx(rxBuffer, tempSize);
+			}
+			else
+			{
+				myLog_d("TTL of broadcast %08X expired", thisData.dest());
+				meshStatAdd(STAT_TTL_DROP);
 			}
 
 			// This is a broadcast, call user callback to handle the data
-			myLog_d("Got data broadcast %s", (char *)thisDataMsg->data);
+			if (!meshRxPayload(thisData, rxData, rxDataLen))
+			{
+				return;
+			}
+			myLog_d("Got data broadcast %s", (char *)rxData);
 			if ((_MeshEvents != NULL) && (_MeshEvents->DataAvailable != NULL))
 			{
-				_MeshEvents->DataAvailable(thisDataMsg->from, thisDataMsg->data, tempSize - 12, rxRssi, rxSnr);
+				traceRx(TRACE_RX_CALLBACK, rxTraceTime);
+				_MeshEvents->DataAvailable(thisData.from(), rxData, rxDataLen, rxRssi, rxSnr);
 			}
 		}
 	}
 	else
 	{
-		myLog_e("Invalid package");
-		for (int idx = 0; idx < tempSize; idx++)
-		{
-			Serial.printf("%02X ", rxBuffer[idx]);
-		}
-		Serial.println("");
+		myLog_e("Invalid package size %d type %02X", tempSize, tempSize > FRAME_TYPE ? rxBuffer[FRAME_TYPE] : 0);
+		meshStatAdd(STAT_RX_INVALID);
 	}
 }
 
@@ -659,11 +1490,48 @@ void OnTxDone(void)
 {
 	myLog_w("LoRa send finished");
 	loraState = MESH_IDLE;
+	meshStatAdd(STAT_TX_DONE);
+
+	if (sendingRateSwitch)
+	{
+		// Receiver switches now to the link rate, the mesh task sends the package after the turnaround
+		sendingRateSwitch = false;
+		radioSetChannel(txChannel);
+		radioSetRate(txRateSf);
+		loraState = MESH_TX;
+		rateSendPending = true;
+		rateSendTime = millis();
+		return;
+	}
+
+	traceTx(TRACE_TX_DONE);
+
+	if (sendingLinkAck)
+	{
+		sendingLinkAck = false;
+		if (rxRateSwitched)
+		{
+			// Link ACK on the link rate is sent
+			meshRevertRate();
+			return;
+		}
+	}
+	else if (txAckRequested)
+	{
+		// Wait for the link ACK of the receiver
+		waitingLinkAck = true;
+		linkAckWaitTime = millis();
+		linkAckTimeout = LINK_ACK_TIMEOUT + random(0, LINK_ACK_BACKOFF << linkAckRetryNum);
+	}
+	else if (txRateSf != 0)
+	{
+		// Package on the link rate is sent
+		meshRevertRate();
+		return;
+	}
 
 	// Restart listening
-	Radio.Standby();
-	// Radio.Rx(0);
-	Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
+	meshStartRx();
 }
 
 /**
@@ -673,12 +1541,15 @@ void OnTxDone(void)
 void OnTxTimeout(void)
 {
 	myLog_w("LoRa TX timeout");
+	meshStatAdd(STAT_TX_TIMEOUT);
+	traceTxAbort();
 	loraState = MESH_IDLE;
+	sendingLinkAck = false;
+	sendingRateSwitch = false;
+	meshRevertRate();
 
 	// Restart listening
-	Radio.Standby();
-	// Radio.Rx(0);
-	Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
+	meshStartRx();
 }
 
 /**
@@ -691,9 +1562,8 @@ void OnTxTimerTimeout(void)
 	loraState = MESH_IDLE;
 
 	// Internal timer timeout, maybe some problem with SX126x ???
-	Radio.Standby();
-	// Radio.Rx(0);
-	Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
+	radioReset();
+	meshStartRx();
 }
 
 /**
@@ -708,9 +1578,7 @@ void OnRxTimeout(void)
 		loraState = MESH_IDLE;
 
 		// Restart listening
-		Radio.Standby();
-		// Radio.Rx(0);
-		Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
+		meshStartRx();
 	}
 }
 
@@ -725,9 +1593,8 @@ void OnRxTimerTimeout(void)
 		loraState = MESH_IDLE;
 
 		// Internal timer timeout, maybe some problem with SX126x ???
-		Radio.Standby();
-		// Radio.Rx(0);
-		Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
+		radioReset();
+		meshStartRx();
 	}
 }
 
@@ -738,14 +1605,13 @@ void OnRxTimerTimeout(void)
 void OnRxError(void)
 {
 	myLog_w("LoRa CRC error");
+	meshStatAdd(STAT_RX_CRC_ERROR);
 	if (loraState != MESH_TX)
 	{
 		loraState = MESH_IDLE;
 
 		// Restart listening
-		Radio.Standby();
-		// Radio.Rx(0);
-		Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
+		meshStartRx();
 	}
 }
 
@@ -777,40 +1643,77 @@ void OnCadDone(bool cadResult)
 	if (cadResult)
 	{
 		myLog_d("CAD returned channel busy");
+		meshStatAdd(STAT_CAD_BUSY);
 		channelFreeRetryNum++;
 		if (channelFreeRetryNum >= CAD_RETRY)
 		{
 			myLog_e("CAD returned channel busy %d times, giving up", CAD_RETRY);
+			meshStatAdd(STAT_CAD_GIVE_UP);
+			traceTxAbort();
 			loraState = MESH_IDLE;
 			channelFreeRetryNum = 0;
+			if (txAckRequested)
+			{
+				// Nothing retries the package anymore
+				meshLinkGiveUp();
+			}
+			else
+			{
+				meshRevertRate();
+			}
 			// Restart listening
-			Radio.Standby();
-			// Radio.Rx(0);
-			Radio.SetRxDutyCycle(RX_SLEEP_TIMES);
+			meshStartRx();
 		}
 		else
 		{
-			// Wait a little bit before retrying
-			delay(250);
-			Radio.Standby();
-			Radio.SetCadParams(LORA_CAD_08_SYMBOL, LORA_SPREADING_FACTOR + 13, 10, LORA_CAD_ONLY, 0);
-			Radio.StartCad();
+			// Wait a little bit before retrying, the mesh task starts the next CAD
+			cadRetryPending = true;
+			cadRetryTime = millis();
 		}
 	}
 	else
 	{
 		myLog_d("CAD returned channel free");
-		myLog_d("Sending %d bytes", txLen);
+		traceTx(TRACE_CAD_DONE);
+		myLog_d("Sending %d bytes", txWireLen);
 		channelFreeRetryNum = 0;
 
+		if (txRateSf != 0)
+		{
+			// Tell the receiver to switch to the link rate
+			rateSwitch.dest = dataFrame<uint8_t>(txPckg, txLen).dest();
+			rateSwitch.from = deviceID;
+			rateSwitch.sf = txRateSf;
+			rateSwitch.channel = txChannel;
+			sendingRateSwitch = true;
+			airtimeConsume(meshTimeOnAirUs(RATE_MSG_SIZE));
+			traceTx(TRACE_SEND);
+			radioSend((uint8_t *)&rateSwitch, RATE_MSG_SIZE);
+			return;
+		}
+
+#if MESH_TDMA > 0
+		if ((txWire[3] & LORA_TYPE_MASK) == LORA_NODEMAP)
+		{
+			// Time stamp of the map trailer
+			mapFrame<uint8_t> txMap(txWire, txWireLen);
+			if (txMap.hasTrailer())
+			{
+				tdmaTrailer(txMap.trailer());
+			}
+		}
+#endif
 		// Send the data package
-		Radio.Standby();
-		Radio.Send((uint8_t *)&txPckg, txLen);
+		airtimeConsume(meshTimeOnAirUs(txWireLen));
+		traceTx(TRACE_SEND);
+		radioSend((uint8_t *)&txWire, txWireLen);
 	}
 }
 
 /**
  * Add a data package to the queue
+ * The package is only copied, so any frame in a byte buffer can be passed
+ * with a (dataMsg *) cast, its fields are read through the frame views.
  * @param package
  * 			dataPckg * to the package data
  * @param msgSize
@@ -828,6 +1731,7 @@ bool addSendRequest(dataMsg *package, uint8_t msgSize)
 #else
 		taskENTER_CRITICAL();
 #endif
+		uint32_t critStart = profileNow();
 		// Find unused entry in queue list
 		int next = SEND_QUEUE_SIZE;
 		for (int idx = 0; idx < SEND_QUEUE_SIZE; idx++)
@@ -847,10 +1751,14 @@ bool addSendRequest(dataMsg *package, uint8_t msgSize)
 
 			myLog_d("Queued msg #%d with len %d", next, msgSize);
 
+			traceEnqueue(next);
+
 			// Try to add to cloudTaskQueue
 			if (xQueueSend(sendQueue, &next, (TickType_t)1000) != pdTRUE)
 			{
 				myLog_e("Send queue is busy");
+				meshStatAdd(STAT_QUEUE_FULL);
+				profileAdd(PROF_CRITICAL, critStart);
 #ifdef ESP32
 				portEXIT_CRITICAL(&accessMsgQueue);
 #else
@@ -861,18 +1769,23 @@ bool addSendRequest(dataMsg *package, uint8_t msgSize)
 			else
 			{
 				myLog_v("Send request queued:");
+				profileAdd(PROF_CRITICAL, critStart);
 #ifdef ESP32
 				portEXIT_CRITICAL(&accessMsgQueue);
 #else
 				taskEXIT_CRITICAL();
 #endif
+				// Wake up the mesh task to handle the request
+				meshWakeup();
 				return true;
 			}
 		}
 		else
 		{
 			myLog_e("Send queue is full");
+			meshStatAdd(STAT_QUEUE_FULL);
 			// Queue is already full!
+			profileAdd(PROF_CRITICAL, critStart);
 #ifdef ESP32
 			portEXIT_CRITICAL(&accessMsgQueue);
 #else
@@ -887,3 +1800,93 @@ bool addSendRequest(dataMsg *package, uint8_t msgSize)
 		return false;
 	}
 }
+
+
+/**
+ * Send data to a node, the route is taken from the nodes map
+ * Must not be called while holding accessNodeList
+ * @param nodeId
+ * 			Destination node
+ * @param data
+ * 			Pointer to the data
+ * @param dataLen
+ * 			Size of the data
+ * @param flags
+ * 			Flags to be set in the type byte
+ * @return result
+ * 			TRUE if the package was added to the send queue
+ * 			FALSE if no route was found or the queue is full
+ */
+bool sendToNode(uint32_t nodeId, uint8_t *data, uint8_t dataLen, uint8_t flags)
+{
+	dataMsg outMsg;
+	nodesList route;
+
+	if (dataLen > DATA_MAX_SIZE)
+	{
+		myLog_e("Data too large %d", dataLen);
+		return false;
+	}
+
+	if (nodeListTake((TickType_t)1000) != pdTRUE)
+	{
+		myLog_e("Could not access map to send package");
+		return false;
+	}
+	if (!getRoute(nodeId, &route))
+	{
+		nodeListGive();
+		myLog_e("No route found for %08X", nodeId);
+		return false;
+	}
+	nodeListGive();
+
+	if (route.firstHop != 0)
+	{
+		outMsg.dest = route.firstHop;
+		outMsg.from = route.nodeId;
+		outMsg.type = LORA_FORWARD | flags;
+	}
+	else
+	{
+		outMsg.dest = route.nodeId;
+		outMsg.from = deviceID;
+		outMsg.type = LORA_DIRECT | flags;
+	}
+	outMsg.orig = deviceID;
+	memcpy(outMsg.data, data, dataLen);
+
+	return addSendRequest(&outMsg, DATA_HEADER_SIZE + dataLen);
+}
+
+/**
+ * Send a broadcast to all nodes up to a number of hops away
+ * @param data
+ * 			Pointer to the data
+ * @param dataLen
+ * 			Size of the data
+ * @param hops
+ * 			Max number of hops, 1 reaches only the direct nodes
+ * @return result
+ * 			TRUE if the package was added to the send queue
+ * 			FALSE if the queue is full
+ */
+bool sendBroadcast(uint8_t *data, uint8_t dataLen, uint8_t hops)
+{
+	dataMsg outMsg;
+
+	if ((dataLen > DATA_MAX_SIZE) || (hops == 0))
+	{
+		myLog_e("Invalid broadcast with %d bytes and %d hops", dataLen, hops);
+		return false;
+	}
+
+	outMsg.dest = getNextBroadcastID();
+	outMsg.from = deviceID;
+	outMsg.orig = deviceID;
+	outMsg.type = LORA_BROADCAST;
+	outMsg.ttl = hops;
+	memcpy(outMsg.data, data, dataLen);
+
+	return addSendRequest(&outMsg, DATA_HEADER_SIZE + dataLen);
+}
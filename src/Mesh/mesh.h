@@ -11,16 +11,57 @@ struct mapMsg
 	uint8_t nodes[48][5];
 };
 
+/** Max number of hops of a data package */
+#ifndef MESH_DEFAULT_TTL
+#define MESH_DEFAULT_TTL 16
+#endif
+
+/**
+ * Third magic byte of data frames with hop, seq and TTL
+ * Maps, link ACKs and rate switches keep 'L','o','R'. Firmware before the
+ * hop, seq and TTL fields sends data frames with 'L','o','R' and the
+ * shorter LEGACY_HEADER_SIZE header, it drops the new data frames.
+ */
+#define DATA_MAGIC '2'
+/** Size of the data header of older firmware: magic, type, dest, from, orig */
+#define LEGACY_HEADER_SIZE 16
+
 struct dataMsg
 {
 	uint8_t mark1 = 'L';
 	uint8_t mark2 = 'o';
-	uint8_t mark3 = 'R';
+	uint8_t mark3 = DATA_MAGIC;
 	uint8_t type = 0;
 	uint32_t dest = 0;
 	uint32_t from = 0;
 	uint32_t orig = 0;
-	uint8_t data[243];
+	uint32_t hop = 0;
+	uint8_t seq = 0;
+	uint8_t ttl = MESH_DEFAULT_TTL;
+	uint8_t data[242];
+};
+
+struct ackMsg
+{
+	uint8_t mark1 = 'L';
+	uint8_t mark2 = 'o';
+	uint8_t mark3 = 'R';
+	uint8_t type = LORA_ACK;
+	uint32_t dest = 0;
+	uint32_t from = 0;
+	uint8_t seq = 0;
+};
+
+struct rateMsg
+{
+	uint8_t mark1 = 'L';
+	uint8_t mark2 = 'o';
+	uint8_t mark3 = 'R';
+	uint8_t type = LORA_RATE;
+	uint32_t dest = 0;
+	uint32_t from = 0;
+	uint8_t sf = 0;
+	uint8_t channel = 0;
 };
 
 /**
@@ -49,42 +90,800 @@ typedef struct
      */
 	void (*NodesListChanged)(void);
 
+	/**
+     * Transport message finished callback prototype.
+     *
+     * @param nodeId
+	 * 			Destination of the message
+     * @param msgId
+	 * 			Message ID returned by transportSend
+     * @param delivered
+	 * 			True if the destination acknowledged the message
+	 * 			False if all retransmissions failed
+     */
+	void (*TransportDone)(uint32_t nodeId, uint16_t msgId, bool delivered);
+
+	/**
+     * Send failed callback prototype, optional.
+     * Called if the next hop did not acknowledge an own package
+     * after LINK_ACK_RETRY retransmissions.
+     *
+     * @param nodeId
+	 * 			Destination of the package
+     */
+	void (*SendFailed)(uint32_t nodeId);
+
+	/**
+     * Battery level callback prototype, optional.
+     * Used for the telemetry block of the node map.
+     *
+     * @return
+	 * 			Battery voltage [mV], 0 if unknown
+     */
+	uint16_t (*BatteryLevel)(void);
+
 } MeshEvents_t;
 
 // LoRa Mesh functions & variables
 void initMesh(MeshEvents_t *events, int numOfNodes);
 void meshTask(void *pvParameters);
+void meshIrqTask(void *pvParameters);
 void OnTxDone(void);
 void OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
+void meshRxProcess(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
 void OnTxTimeout(void);
 void OnRxTimeout(void);
 void OnRxError(void);
 void OnPreAmbDetect(void);
 void OnCadDone(bool cadResult);
 bool addSendRequest(dataMsg *package, uint8_t msgSize);
+void meshWakeup(void);
+void meshStartRx(void);
+void meshRevertRate(void);
+bool sendToNode(uint32_t nodeId, uint8_t *data, uint8_t dataLen, uint8_t flags);
+bool sendBroadcast(uint8_t *data, uint8_t dataLen, uint8_t hops);
+uint8_t meshCompress(uint8_t *in, uint8_t inLen, uint8_t *out, uint8_t outMax);
+int16_t meshDecompress(uint8_t *in, uint8_t inLen, uint8_t *out, uint16_t outMax);
 extern TaskHandle_t meshTaskHandle;
+extern TaskHandle_t meshIrqTaskHandle;
 extern volatile xQueueHandle meshMsgQueue;
+extern volatile xQueueHandle sendQueue;
+
+/** Stack size of the mesh task, words on nRF52, bytes on ESP32 */
+#ifndef MESH_TASK_STACK
+#define MESH_TASK_STACK 3096
+#endif
+
+/** Stack size of the radio task, words on nRF52, bytes on ESP32 */
+#ifndef MESH_IRQ_TASK_STACK
+#define MESH_IRQ_TASK_STACK 2048
+#endif
+
+/** Max number of messages in the send queue */
+#ifndef SEND_QUEUE_SIZE
+#define SEND_QUEUE_SIZE 2
+#endif
+
+/** Number of received packages that can wait for the mesh task */
+#ifndef RX_RING_SIZE
+#define RX_RING_SIZE 4
+#endif
+
+/** Room in the radio event queue for the events besides the received packages */
+#define RADIO_EVENT_EXTRA 4
+
+/** Radio events from the radio task to the mesh task */
+enum radioEventType
+{
+	RADIO_EVENT_RX_DONE = 0,
+	RADIO_EVENT_TX_DONE,
+	RADIO_EVENT_TX_TIMEOUT,
+	RADIO_EVENT_RX_TIMEOUT,
+	RADIO_EVENT_RX_ERROR,
+	RADIO_EVENT_CAD_DONE
+};
 
 /** Size of map message buffer without subnode */
 #define MAP_HEADER_SIZE 12
 /** Size of data message buffer without subnode */
-#define DATA_HEADER_SIZE 16
+#define DATA_HEADER_SIZE 22
+/** Max size of data in a data message */
+#define DATA_MAX_SIZE (255 - DATA_HEADER_SIZE)
+/** Size of data message buffer with compact header */
+#define COMPACT_HEADER_SIZE 12
+/** Send data messages with compact header if possible */
+#ifndef MESH_COMPACT_HEADER
+#define MESH_COMPACT_HEADER 1
+#endif
+/** Size of link ACK message */
+#define ACK_MSG_SIZE 13
+/** Size of rate switch message */
+#define RATE_MSG_SIZE 14
+
+/** Request link ACKs for direct and forwarded packages */
+#ifndef LINK_ACK
+#define LINK_ACK 1
+#endif
+/** Delay before a link ACK is sent after a package was received */
+#define LINK_ACK_TURNAROUND 10
+/** Time to wait for a link ACK before retransmitting */
+#define LINK_ACK_TIMEOUT (LINK_ACK_TURNAROUND + meshTimeOnAirUs(ACK_MSG_SIZE) / 1000 + 200)
+/** Number of retransmissions if no link ACK was received */
+#define LINK_ACK_RETRY 3
+/** Max random delay added to the link ACK timeout [ms], doubled with every retransmission */
+#define LINK_ACK_BACKOFF 200
+
+/**
+ * Compress the payload of data packages before sending
+ * Off by default, typical sensor payloads are too short to gain.
+ * Compressed packages are received with any setting.
+ */
+#ifndef MESH_COMPRESS
+#define MESH_COMPRESS 0
+#endif
 
 /** Number of retries if CAD shows busy */
 #define CAD_RETRY 20
+/** Time to wait before CAD is retried */
+#define CAD_RETRY_DELAY 250
 
 // LoRa definitions
 #define RF_FREQUENCY 916000000  // Hz
 #define TX_OUTPUT_POWER 22		// dBm
 #define LORA_BANDWIDTH 1		// [0: 125 kHz, 1: 250 kHz, 2: 500 kHz, 3: Reserved]
-#define LORA_SPREADING_FACTOR 7 // [SF7..SF12]
+#ifndef LORA_SPREADING_FACTOR
+#define LORA_SPREADING_FACTOR 7 // [SF7..SF12] Common rate for maps and broadcasts
+#endif
 #define LORA_CODINGRATE 1		// [1: 4/5, 2: 4/6, 3: 4/7, 4: 4/8]
-#define LORA_PREAMBLE_LENGTH 8  // Same for Tx and Rx
+#ifndef LORA_PREAMBLE_LENGTH
+#define LORA_PREAMBLE_LENGTH 8  // Same for Tx and Rx, must cover the RX duty cycle
+#endif
 #define LORA_SYMBOL_TIMEOUT 0   // Symbols
 #define LORA_FIX_LENGTH_PAYLOAD_ON false
 #define LORA_IQ_INVERSION_ON false
 #define RX_TIMEOUT_VALUE 5000
-#define TX_TIMEOUT_VALUE 5000
+#define TX_TIMEOUT_VALUE (meshTimeOnAirUs(255) / 1000 + 1000)
+
+/**
+ * Time on air calculation
+ * Same formula as the Semtech SX126x calculator,
+ * explicit header, CRC on, SF7 to SF12
+ */
+
+/**
+ * Get the bandwidth in Hz
+ * @param bw
+ * 		Bandwidth [0: 125 kHz, 1: 250 kHz, 2: 500 kHz]
+ */
+constexpr uint32_t loraBandwidthHz(uint8_t bw)
+{
+	return bw == 0 ? 125000 : (bw == 1 ? 250000 : 500000);
+}
+
+/**
+ * Get the length of one symbol in us
+ * @param sf
+ * 		Spreading factor
+ * @param bw
+ * 		Bandwidth [0: 125 kHz, 1: 250 kHz, 2: 500 kHz]
+ */
+constexpr uint32_t loraSymbolTimeUs(uint8_t sf, uint8_t bw)
+{
+	return ((uint32_t)1 << sf) * 1000000UL / loraBandwidthHz(bw);
+}
+
+/**
+ * Get the number of payload symbols (rounded up division)
+ * @param num
+ * 		8 * payload length - 4 * SF + 28 + 16 (CRC)
+ * @param den
+ * 		4 * (SF - 2 * low data rate optimization)
+ * @param cr
+ * 		Coding rate [1: 4/5, 2: 4/6, 3: 4/7, 4: 4/8]
+ */
+constexpr uint32_t loraPayloadSymbols(int32_t num, int32_t den, uint8_t cr)
+{
+	return 8 + (num > 0 ? ((num + den - 1) / den) * (cr + 4) : 0);
+}
+
+/**
+ * Get the time on air of a package in us
+ * @param len
+ * 		Payload length
+ * @param sf
+ * 		Spreading factor
+ * @param bw
+ * 		Bandwidth [0: 125 kHz, 1: 250 kHz, 2: 500 kHz]
+ * @param cr
+ * 		Coding rate [1: 4/5, 2: 4/6, 3: 4/7, 4: 4/8]
+ * @param preamble
+ * 		Preamble length in symbols
+ */
+constexpr uint32_t loraTimeOnAirUs(uint16_t len, uint8_t sf, uint8_t bw, uint8_t cr, uint16_t preamble)
+{
+	// Low data rate optimization is used for symbols >= 16.38 ms
+	return ((preamble * 4 + 17) +
+			4 * loraPayloadSymbols(8 * len - 4 * sf + 28 + 16,
+								   4 * (sf - (loraSymbolTimeUs(sf, bw) >= 16380 ? 2 : 0)), cr)) *
+		   loraSymbolTimeUs(sf, bw) / 4;
+}
+
+/**
+ * Get the time on air of a package with the mesh LoRa settings in us
+ * @param len
+ * 		Payload length
+ */
+constexpr uint32_t meshTimeOnAirUs(uint16_t len)
+{
+	return loraTimeOnAirUs(len, LORA_SPREADING_FACTOR, LORA_BANDWIDTH, LORA_CODINGRATE, LORA_PREAMBLE_LENGTH);
+}
+
+/** Margin for the stuck TX watchdog */
+#define TX_WATCHDOG_MARGIN 500
+
+/**
+ * Get the time after which a package is considered stuck in TX in ms
+ * Covers all CAD retries and the time on air of the package
+ * @param len
+ * 		Payload length
+ */
+constexpr uint32_t meshTxWatchdog(uint16_t len)
+{
+	return CAD_RETRY * (CAD_RETRY_DELAY + 8 * loraSymbolTimeUs(LORA_SPREADING_FACTOR, LORA_BANDWIDTH) / 1000 + 1) +
+		   meshTimeOnAirUs(len) / 1000 + TX_WATCHDOG_MARGIN;
+}
+
+/**
+ * RX duty cycle
+ * While there is data traffic the receiver listens continuously.
+ * After RX_ACTIVE_TIME without traffic it listens for RX_DUTY_RX_SYMBOLS
+ * and sleeps as long as the preamble of a sender still spans two listen
+ * windows: preamble >= 2 * listen + sleep.
+ * Longer sleep needs a longer LORA_PREAMBLE_LENGTH on all nodes.
+ */
+#define RX_ACTIVE_TIME 5000
+/** Symbols the receiver needs to detect a preamble */
+#define RX_DUTY_RX_SYMBOLS 2
+/** Symbols the receiver sleeps, one symbol margin */
+#define RX_DUTY_SLEEP_SYMBOLS (LORA_PREAMBLE_LENGTH - 2 * RX_DUTY_RX_SYMBOLS - 1)
+
+/**
+ * Convert a time into SX126x timer steps of 15.625 us
+ * @param us
+ * 		Time in us
+ */
+constexpr uint32_t loraTimerSteps(uint32_t us)
+{
+	return us * 64 / 1000;
+}
+
+/** Listen time of the RX duty cycle in timer steps */
+#define RX_DUTY_RX_STEPS loraTimerSteps(RX_DUTY_RX_SYMBOLS * loraSymbolTimeUs(LORA_SPREADING_FACTOR, LORA_BANDWIDTH))
+/** Sleep time of the RX duty cycle in timer steps */
+#define RX_DUTY_SLEEP_STEPS loraTimerSteps(RX_DUTY_SLEEP_SYMBOLS * loraSymbolTimeUs(LORA_SPREADING_FACTOR, LORA_BANDWIDTH))
+
+/**
+ * Per link data rate
+ * Unicast packages to a direct neighbor are sent with the fastest SF
+ * that has ADR_SNR_MARGIN dB margin over the SNR the SF needs.
+ * A LORA_RATE message on the common rate makes the receiver listen on
+ * the faster SF for one package. Only useful if LORA_SPREADING_FACTOR
+ * is set to a robust rate, e.g. -DLORA_SPREADING_FACTOR=10
+ */
+#ifndef MESH_ADR
+#define MESH_ADR 0
+#endif
+/** Fastest SF used for a link */
+#define ADR_MIN_SF 7
+/** Margin in dB over the SNR a SF needs */
+#define ADR_SNR_MARGIN 5
+/** SNR of a node that was not yet measured */
+#define ADR_SNR_UNKNOWN -128
+/** Delay between rate switch message and data package */
+#define RATE_TURNAROUND 10
+
+/**
+ * Multi channel mode
+ * Channel 0 (RF_FREQUENCY) is the rendezvous channel for maps, broadcasts
+ * and rate switch messages. Each node has a data channel derived from its
+ * ID. Unicast packages larger than CHANNEL_MIN_SIZE are announced with a
+ * LORA_RATE message on the rendezvous channel and sent on the data channel
+ * of the next hop, so transfers between different node pairs do not collide.
+ */
+#ifndef MESH_CHANNELS
+#define MESH_CHANNELS 1
+#endif
+/** Distance between two channels in Hz */
+#define CHANNEL_SPACING 300000
+/** Min package size to move to a data channel */
+#define CHANNEL_MIN_SIZE 64
+
+/**
+ * Get the data channel of a node
+ * @param nodeId
+ * 		Node ID
+ */
+constexpr uint8_t meshDataChannel(uint32_t nodeId)
+{
+	return MESH_CHANNELS > 1 ? 1 + (nodeId ^ (nodeId >> 16)) % (MESH_CHANNELS - 1) : 0;
+}
+
+/**
+ * Get the SNR in dB a SF needs for demodulation
+ * @param sf
+ * 		Spreading factor
+ */
+constexpr int8_t loraRequiredSnr(uint8_t sf)
+{
+	return (int8_t)(-5 - 5 * ((int8_t)sf - 6) / 2);
+}
+
+/**
+ * Slotted mode
+ * Time is split into frames of TDMA_SLOTS slots. A node sends only in
+ * its own slot. The slot is hashed from the node ID, collisions with
+ * nodes up to two hops away are resolved in favor of the lower ID.
+ * The mesh time is synchronized with a trailer after the end marker of
+ * the node map, all nodes must use the same MESH_TDMA setting.
+ */
+#ifndef MESH_TDMA
+#define MESH_TDMA 0
+#endif
+/** Number of slots in a frame */
+#define TDMA_SLOTS 16
+/** Guard time in ms at the end of a slot */
+#define TDMA_GUARD 20
+/** Size of the slot and time trailer of the node map */
+#define TDMA_TRAILER_SIZE 5
+/** Slot of a node that was not yet received */
+#define TDMA_SLOT_UNKNOWN 0xFF
+
+/**
+ * Get the time in ms a package needs in a slot, including CAD, rate switch and link ACK
+ * @param len
+ * 		Package size
+ */
+constexpr uint32_t tdmaBusyTime(uint16_t len)
+{
+	return (8 * loraSymbolTimeUs(LORA_SPREADING_FACTOR, LORA_BANDWIDTH) + meshTimeOnAirUs(RATE_MSG_SIZE) +
+			meshTimeOnAirUs(len) + meshTimeOnAirUs(ACK_MSG_SIZE)) / 1000 +
+		   RATE_TURNAROUND + LINK_ACK_TURNAROUND + TDMA_GUARD;
+}
+
+/** Length of a slot in ms, fits a package of max size */
+#define TDMA_SLOT_TIME tdmaBusyTime(255)
+/** Length of a frame in ms */
+#define TDMA_FRAME_TIME (TDMA_SLOTS * TDMA_SLOT_TIME)
+
+/**
+ * Get the preferred slot of a node
+ * @param nodeId
+ * 		Node ID
+ */
+constexpr uint8_t tdmaBaseSlot(uint32_t nodeId)
+{
+	return (uint8_t)(((nodeId * 2654435761UL) >> 24) % TDMA_SLOTS);
+}
+
+/** Duty cycle limit in 1/1000, 0 = no limit (e.g. 10 for 1 % in EU868) */
+#ifndef MESH_DUTY_CYCLE
+#define MESH_DUTY_CYCLE 0
+#endif
+/** Time window of the duty cycle limit */
+#define DUTY_CYCLE_WINDOW 3600000
+
+// Airtime functions
+void initAirtime(void);
+int32_t airtimeWait(uint32_t timeOnAir);
+void airtimeConsume(uint32_t timeOnAir);
+uint32_t airtimeUsed(void);
+
+// Radio control functions
+void initRadio(void);
+void radioReset(void);
+void radioIdle(void);
+void radioRxRestart(void);
+void radioIrqProcess(void);
+void radioStandby(void);
+void radioSetRate(uint8_t sf);
+void radioSetChannel(uint8_t channel);
+void radioRx(bool continuous);
+void radioStartCad(void);
+void radioSend(uint8_t *buffer, uint8_t size);
+uint32_t radioStat(uint8_t id);
+void radioAccountReset(void);
+
+/** Current draw of the SX1262 [uA], datasheet values with DC-DC regulator */
+#ifndef RADIO_CURRENT_TX
+#define RADIO_CURRENT_TX 118000 // at +22 dBm
+#endif
+#ifndef RADIO_CURRENT_RX
+#define RADIO_CURRENT_RX 4600
+#endif
+#ifndef RADIO_CURRENT_CAD
+#define RADIO_CURRENT_CAD 4600
+#endif
+#ifndef RADIO_CURRENT_STANDBY
+#define RADIO_CURRENT_STANDBY 600 // STDBY_RC
+#endif
+#ifndef RADIO_CURRENT_SLEEP
+#define RADIO_CURRENT_SLEEP 1 // Warm start, sleep phase of the RX duty cycle
+#endif
+/** Supply voltage of the radio [mV] */
+#ifndef RADIO_VOLTAGE
+#define RADIO_VOLTAGE 3300
+#endif
+
+void initTdma(void);
+uint32_t tdmaTime(void);
+uint8_t tdmaSlot(void);
+void tdmaUpdateSlot(void);
+int32_t tdmaWait(uint16_t len);
+void tdmaSync(uint32_t remoteTime, uint16_t len);
+void tdmaTrailer(uint8_t *trailer);
+
+/** Number of destinations and sources the transport keeps track of */
+#ifndef TRANSPORT_PEERS
+#define TRANSPORT_PEERS 4
+#endif
+/**
+ * Number of unacknowledged messages per destination
+ * 1 by default, over a chain more messages on the way collide with each
+ * other (see the transport_hops scenario)
+ */
+#ifndef TRANSPORT_WINDOW
+#define TRANSPORT_WINDOW 1
+#endif
+/** Max size of a transport message */
+#define TRANSPORT_MAX_PAYLOAD 200
+
+// Transport functions
+void initTransport(MeshEvents_t *events);
+bool transportSend(uint32_t nodeId, uint8_t *data, uint8_t size, uint16_t *msgId);
+void transportRx(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
+int32_t transportHandler(void);
+int32_t transportRto(uint32_t nodeId);
+
+/** Max size of a message sent with fragmentSend */
+#ifndef FRAGMENT_MAX_SIZE
+#if defined(ESP32) || defined(NRF52840_XXAA)
+#define FRAGMENT_MAX_SIZE 8192
+#else
+#define FRAGMENT_MAX_SIZE 2048
+#endif
+#endif
+/** Number of messages that can be reassembled at the same time */
+#ifndef FRAGMENT_BUFFERS
+#define FRAGMENT_BUFFERS 2
+#endif
+
+// Fragmentation functions
+void initFragment(MeshEvents_t *events);
+bool fragmentSend(uint32_t nodeId, uint8_t *data, uint16_t size);
+bool fragmentBusy(void);
+void fragmentRx(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
+int32_t fragmentHandler(void);
+
+/**
+ * Rebroadcast mode
+ * 0 = full flooding, every node rebroadcasts every new broadcast
+ * 1 = counter based, a node waits a random assessment delay and
+ * cancels its rebroadcast if it overheard the broadcast
+ * FLOOD_COUNT_THRESHOLD times or from all its direct nodes
+ */
+#ifndef MESH_FLOOD_COUNTER
+#define MESH_FLOOD_COUNTER 1
+#endif
+/** Number of copies heard that cancel the rebroadcast */
+#ifndef FLOOD_COUNT_THRESHOLD
+#define FLOOD_COUNT_THRESHOLD 2
+#endif
+/** Max random assessment delay in packages of the same size */
+#ifndef FLOOD_RAD_PACKAGES
+#define FLOOD_RAD_PACKAGES 8
+#endif
+/** Number of nodes that sent a copy remembered per rebroadcast */
+#define FLOOD_HEARD_MAX 8
+/** Number of rebroadcasts that can wait for the assessment delay */
+#define FLOOD_PENDING 3
+
+// Flooding functions
+void initFlood(void);
+void floodRx(uint8_t *package, uint8_t msgSize);
+void floodDuplicate(uint32_t broadcastID, uint32_t hop);
+int32_t floodHandler(void);
+
+/** Mesh statistics counters */
+enum meshStatId
+{
+	/** Valid packages received, in the order of the package types */
+	STAT_RX_DIRECT = 0,
+	STAT_RX_FORWARD,
+	STAT_RX_BROADCAST,
+	STAT_RX_MAP,
+	STAT_RX_ACK,
+	STAT_RX_RATE,
+	STAT_RX_ECHO,
+	STAT_RX_ECHO_REPLY,
+	/** Malformed packages */
+	STAT_RX_INVALID,
+	/** Packages with compact header dropped because a short address is not known */
+	STAT_RX_UNRESOLVED,
+	/** Packages with compact header dropped because the sender is not a direct node */
+	STAT_RX_NOT_NEIGHBOUR,
+	/** Data packages of older firmware with the 16 byte header */
+	STAT_RX_LEGACY,
+	/** Packages dropped because the RX ring was full */
+	STAT_RX_RING_DROP,
+	STAT_RX_CRC_ERROR,
+	/** Retransmitted packages and old broadcasts */
+	STAT_RX_DUPLICATE,
+	/** Packages dropped because the TTL expired */
+	STAT_TTL_DROP,
+	STAT_TX_DONE,
+	STAT_TX_TIMEOUT,
+	/** Recoveries from a loraState stuck in MESH_TX */
+	STAT_TX_STUCK,
+	STAT_CAD_BUSY,
+	/** Packages dropped after CAD_RETRY busy channels */
+	STAT_CAD_GIVE_UP,
+	/** Packages dropped after LINK_ACK_RETRY retransmissions without link ACK */
+	STAT_LINK_GIVE_UP,
+	/** Send requests rejected because the send queue was full */
+	STAT_QUEUE_FULL,
+	STAT_MAP_APPLIED,
+	STAT_NODE_ADDED,
+	STAT_NODE_TIMEOUT,
+	/** SX126x commands sent and skipped by the radio control layer */
+	STAT_RADIO_CMD,
+	STAT_RADIO_SKIPPED,
+	STAT_FLOOD_REBROADCAST,
+	/** Rebroadcasts cancelled by the flooding counter */
+	STAT_FLOOD_SUPPRESSED,
+	/** Time in each radio mode [ms], computed by the radio accounting */
+	STAT_RADIO_TX_MS,
+	STAT_RADIO_RX_MS,
+	STAT_RADIO_RX_DUTY_MS,
+	STAT_RADIO_CAD_MS,
+	STAT_RADIO_STANDBY_MS,
+	/** Charge used by the radio [uAh] */
+	STAT_RADIO_CHARGE_UAH,
+	/** Average current of the radio, equals the charge per hour [uAh/h] */
+	STAT_RADIO_UAH_PER_HOUR,
+	/** Energy for CAD and TX per sent package [uJ] */
+	STAT_RADIO_UJ_PER_PACKET,
+	STAT_NUM
+};
+
+extern uint32_t meshStats[STAT_NUM];
+
+/**
+ * Increment a statistics counter
+ * Safe from any task, does not take accessNodeList
+ */
+inline void meshStatAdd(meshStatId id, uint32_t value = 1)
+{
+	__atomic_fetch_add(&meshStats[id], value, __ATOMIC_RELAXED);
+}
+
+// Statistics functions
+uint32_t meshStatGet(uint8_t id);
+const char *meshStatName(uint8_t id);
+void meshStatsReset(void);
+uint16_t meshStatsCsv(char *buffer, uint16_t size, uint8_t &next);
+uint16_t meshStatsBinary(uint8_t *buffer, uint16_t size);
+
+/** Trace every TRACE_SAMPLE th package, 1 = every package */
+#ifndef TRACE_SAMPLE
+#define TRACE_SAMPLE 4
+#endif
+/** Number of buckets of a latency histogram */
+#define TRACE_BUCKETS 12
+
+/** Stages of a sent package */
+enum traceStage
+{
+	TRACE_ENQUEUE = 0,
+	TRACE_DEQUEUE,
+	TRACE_CAD_START,
+	TRACE_CAD_DONE,
+	TRACE_SEND,
+	TRACE_TX_DONE,
+	TRACE_STAGES
+};
+
+/** Latency histograms */
+enum traceInterval
+{
+	/** Waiting in the send queue */
+	TRACE_QUEUE = 0,
+	/** Dequeue until CAD start, compression and header */
+	TRACE_PREPARE,
+	/** CAD including the busy retries */
+	TRACE_CAD,
+	/** CAD done until send */
+	TRACE_CAD_TO_SEND,
+	/** Send until TX done, including a rate switch */
+	TRACE_ON_AIR,
+	/** Enqueue until TX done */
+	TRACE_TX_TOTAL,
+	/** OnRxDone until the mesh task handles the package */
+	TRACE_RX_RING,
+	/** OnRxDone until the DataAvailable callback */
+	TRACE_RX_CALLBACK,
+	TRACE_NUM
+};
+
+struct traceHistogram
+{
+	uint32_t count;
+	uint64_t sum;
+	uint32_t max;
+	uint32_t buckets[TRACE_BUCKETS];
+};
+
+extern traceHistogram traceHist[TRACE_NUM];
+
+// Tracing functions
+void traceEnqueue(uint8_t slot);
+void traceDequeue(uint8_t slot);
+void traceTx(traceStage stage);
+void traceTxAbort(void);
+uint32_t traceRxStart(void);
+void traceRx(traceInterval interval, uint32_t start);
+const char *traceName(uint8_t interval);
+uint32_t traceBucketLimit(uint8_t bucket);
+void traceReset(void);
+uint16_t traceCsv(char *buffer, uint16_t size, uint8_t &next);
+
+/** Profiled sections */
+enum profileId
+{
+	/** One loop of the mesh task without the sleep */
+	PROF_MESH_LOOP = 0,
+	/** Radio.IrqProcess() including the radio callbacks */
+	PROF_IRQ_PROCESS,
+	/** Handling of one received package */
+	PROF_RX_PROCESS,
+	/** Wait for accessNodeList */
+	PROF_LIST_WAIT,
+	/** Hold time of accessNodeList */
+	PROF_LIST_HOLD,
+	/** Send queue critical sections */
+	PROF_CRITICAL,
+	PROF_NUM
+};
+
+// Profiling functions
+void initProfile(void);
+uint32_t profileNow(void);
+void profileAdd(profileId id, uint32_t start);
+BaseType_t nodeListTake(TickType_t wait);
+void nodeListGive(void);
+void profileReset(void);
+uint16_t profileCsv(char *buffer, uint16_t size, uint8_t &next);
+
+/**
+ * Node telemetry
+ * With MESH_TELEMETRY a node appends a telemetry block after the end
+ * marker (and the TDMA trailer) of its node map, if the map has space
+ * left. Node entries are never dropped for the block, so the map is not
+ * split and no extra package is sent.
+ * Receivers always parse the block and keep the latest block of up to
+ * TELEMETRY_NODES neighbors.
+ * Block version 1, 20 bytes = 4 map entries, little endian:
+ * [0] version
+ * [1] length of the block in bytes
+ * [2..5] uptime [s]
+ * [6..7] battery [mV], 0 if unknown
+ * [8..9] received packages
+ * [10..11] sent packages
+ * [12..13] send queue full
+ * [14..15] channel busy, sending given up
+ * [16..17] invalid packages and CRC errors
+ * [18..19] RX ring buffer drops
+ * Counters are the low 16 bits of the statistics counters.
+ * Later versions may only append fields, the length tells the receiver
+ * where the block ends.
+ */
+#ifndef MESH_TELEMETRY
+#define MESH_TELEMETRY 0
+#endif
+/** Version of the telemetry block */
+#define TELEMETRY_VERSION 1
+/** Size of the telemetry block */
+#define TELEMETRY_SIZE 20
+/** Number of map entries of the telemetry block */
+#define TELEMETRY_ENTRIES ((TELEMETRY_SIZE + 4) / 5)
+/** Min size of a telemetry block a receiver accepts */
+#define TELEMETRY_MIN_SIZE 2
+/** Max size of a telemetry block a receiver accepts */
+#define TELEMETRY_MAX_SIZE 40
+/** Number of neighbors in the telemetry table */
+#ifndef TELEMETRY_NODES
+#define TELEMETRY_NODES 8
+#endif
+
+struct telemetryData
+{
+	uint32_t nodeId;
+	/** Time the block was received [ms] */
+	time_t rxTime;
+	int16_t rssi;
+	int8_t snr;
+	uint8_t version;
+	uint32_t uptime;
+	uint16_t battery;
+	uint16_t rxPackets;
+	uint16_t txPackets;
+	uint16_t queueFull;
+	uint16_t cadGiveUp;
+	uint16_t rxErrors;
+	uint16_t rxDrops;
+};
+
+// Telemetry functions
+uint8_t telemetryBlock(uint8_t *block, uint16_t battery);
+void telemetryRx(uint32_t fromID, const uint8_t *block, uint8_t size, int16_t rssi, int8_t snr);
+bool telemetryGet(uint8_t idx, telemetryData *entry);
+uint16_t telemetryCsv(char *buffer, uint16_t size, uint8_t &next);
+
+/**
+ * Ping and traceroute
+ * An echo request is routed hop by hop to the target, the target answers
+ * with an echo reply that is routed back the same way. In traceroute
+ * mode every forwarder and the target append a hop record with their ID
+ * and the local time the frame was received. A node that forwards the
+ * request and the reply gives the round trip time from this node as
+ * the difference of its two time stamps, no synchronized clocks needed.
+ * Only one echo can be pending at a time.
+ */
+/** Size of the echo header after the data header: target, flags, number of hops */
+#define ECHO_HEADER_SIZE 6
+/** Size of a hop record: node ID, time stamp [ms] */
+#define ECHO_HOP_SIZE 8
+/** Max number of hop records in an echo frame */
+#define ECHO_MAX_HOPS ((DATA_MAX_SIZE - ECHO_HEADER_SIZE) / ECHO_HOP_SIZE)
+/** Echo flag, forwarders append hop records */
+#define ECHO_FLAG_ROUTE 0x01
+/** Time to wait for the echo reply [ms] */
+#ifndef ECHO_REPLY_TIMEOUT
+#define ECHO_REPLY_TIMEOUT 10000
+#endif
+
+enum echoState
+{
+	ECHO_IDLE = 0,
+	ECHO_PENDING,
+	ECHO_DONE,
+	ECHO_TIMEOUT
+};
+
+struct echoHop
+{
+	uint32_t nodeId;
+	/** Round trip time from this hop to the target and back [ms], -1 if unknown */
+	int32_t rtt;
+};
+
+struct echoResult
+{
+	uint32_t nodeId;
+	uint8_t seq;
+	/** Round trip time [ms] */
+	uint32_t rtt;
+	/** Number of hop records, 0 for a ping */
+	uint8_t numHops;
+	/** Index of the target in the hop records */
+	uint8_t targetIdx;
+	echoHop hops[ECHO_MAX_HOPS];
+};
+
+// Ping and traceroute functions
+bool echoSend(uint32_t nodeId, bool route);
+void echoRx(uint8_t *frame, uint16_t size);
+echoState echoGetResult(echoResult *result);
+uint16_t echoCsv(char *buffer, uint16_t size, uint8_t &next);
 
 struct nodesList
 {
@@ -92,6 +891,8 @@ struct nodesList
 	uint32_t firstHop;
 	time_t timeStamp;
 	uint8_t numHops;
+	int8_t snr;
+	uint8_t slot;
 };
 
 bool getRoute(uint32_t id, nodesList *route);
@@ -105,7 +906,20 @@ uint8_t numOfNodes();
 bool getNode(uint8_t nodeNum, uint32_t &nodeId, uint32_t &firstHop, uint8_t &numHops);
 uint32_t getNextBroadcastID(void);
 bool isOldBroadcast(uint32_t broadcastID);
+void updateNodeSnr(uint32_t id, int8_t snr);
+uint8_t getLinkSf(uint32_t id);
+void updateNodeSlot(uint32_t id, uint8_t slot);
+bool isSlotTaken(uint8_t slot);
+bool isOldLinkPackage(uint32_t orig, uint32_t from, uint32_t hop, uint8_t seq);
+uint16_t shortAddress(uint32_t id);
+bool isShortAddressUnique(uint32_t id);
+bool getFullAddress(uint16_t idShort, uint32_t &id);
+uint16_t compactHeader(uint8_t *in, uint16_t inLen, uint8_t *out);
+uint16_t expandHeader(uint8_t *pckg, uint16_t len);
+uint16_t expandLegacyHeader(uint8_t *pckg, uint16_t len);
 
 extern SemaphoreHandle_t accessNodeList;
 extern nodesList *nodesMap;
 extern int _numOfNodes;
+
+#include "frame.h"
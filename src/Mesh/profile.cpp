@@ -0,0 +1,192 @@
+#include "main.h"
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+
+/**
+ * Task profiling
+ * Measures the time spent in sections of the mesh task, the wait for and
+ * the hold time of accessNodeList and the time spent in the send queue
+ * critical sections. Each section keeps count, total and max.
+ * Clock: DWT CYCCNT (CPU cycles) on nRF52, esp_timer (us) on ESP32,
+ * micros() on other builds.
+ * The sections are only updated by one task at a time: the mesh task
+ * sections by the mesh task, the list sections while holding the list,
+ * the critical section inside the critical section.
+ */
+
+/** Names of the sections, in the order of profileId */
+static const char *profileNames[] = {
+	"mesh_loop",
+	"irq_process",
+	"rx_process",
+	"list_wait",
+	"list_hold",
+	"critical",
+};
+
+static_assert(sizeof(profileNames) / sizeof(profileNames[0]) == PROF_NUM, "A name is needed for each section");
+
+struct profileSection
+{
+	uint32_t count;
+	uint64_t total;
+	uint32_t max;
+};
+
+/** The sections */
+static profileSection profileSections[PROF_NUM];
+
+/** Time accessNodeList was taken */
+static uint32_t listHoldStart = 0;
+
+/**
+ * Start the clock
+ */
+void initProfile(void)
+{
+#ifdef NRF52_SERIES
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+/**
+ * Read the clock
+ * @return uint32_t
+ * 		Clock ticks, see profileTicksPerUs()
+ */
+uint32_t profileNow(void)
+{
+#ifdef NRF52_SERIES
+	return DWT->CYCCNT;
+#elif defined(ESP32)
+	return (uint32_t)esp_timer_get_time();
+#else
+	return micros();
+#endif
+}
+
+/**
+ * Clock ticks per us
+ */
+static uint32_t profileTicksPerUs(void)
+{
+#ifdef NRF52_SERIES
+	return SystemCoreClock / 1000000;
+#else
+	return 1;
+#endif
+}
+
+/**
+ * Add the time since start to a section
+ * @param id
+ * 		Section
+ * @param start
+ * 		Start time from profileNow()
+ */
+void profileAdd(profileId id, uint32_t start)
+{
+	uint32_t ticks = profileNow() - start;
+	profileSection *section = &profileSections[id];
+	section->count++;
+	section->total += ticks;
+	if (ticks > section->max)
+	{
+		section->max = ticks;
+	}
+}
+
+/**
+ * Take accessNodeList and measure the wait time
+ * @param wait
+ * 		Max time to wait [ticks]
+ * @return BaseType_t
+ * 		pdTRUE if the list was taken
+ */
+BaseType_t nodeListTake(TickType_t wait)
+{
+	uint32_t start = profileNow();
+	BaseType_t result = xSemaphoreTake(accessNodeList, wait);
+	if (result == pdTRUE)
+	{
+		profileAdd(PROF_LIST_WAIT, start);
+		listHoldStart = profileNow();
+	}
+	return result;
+}
+
+/**
+ * Give accessNodeList back and measure the hold time
+ */
+void nodeListGive(void)
+{
+	profileAdd(PROF_LIST_HOLD, listHoldStart);
+	xSemaphoreGive(accessNodeList);
+}
+
+/**
+ * Reset all sections
+ */
+void profileReset(void)
+{
+	memset(profileSections, 0, sizeof(profileSections));
+}
+
+/**
+ * Write the sections as CSV lines name,count,avg [us],max [us]
+ * followed by the free stack of the mesh task, the radio task and the calling task
+ * (words on nRF52, bytes on ESP32)
+ * Writes only complete lines, call again with the updated index until it returns 0
+ * @param buffer
+ * 		Buffer for the text
+ * @param size
+ * 		Size of the buffer
+ * @param next
+ * 		Index of the first line to write, updated to the next line
+ * @return uint16_t
+ * 		Length of the text
+ */
+uint16_t profileCsv(char *buffer, uint16_t size, uint8_t &next)
+{
+	uint16_t len = 0;
+	uint32_t ticksPerUs = profileTicksPerUs();
+	while (next < PROF_NUM + 3)
+	{
+		int lineLen;
+		if (next < PROF_NUM)
+		{
+			profileSection *section = &profileSections[next];
+			lineLen = snprintf(&buffer[len], size - len, "%s,%lu,%lu,%lu\n", profileNames[next], (unsigned long)section->count,
+							   (unsigned long)(section->count != 0 ? section->total / section->count / ticksPerUs : 0),
+							   (unsigned long)(section->max / ticksPerUs));
+		}
+		else if (next == PROF_NUM)
+		{
+			lineLen = snprintf(&buffer[len], size - len, "mesh_stack_free,%lu\n",
+							   (unsigned long)(meshTaskHandle != NULL ? uxTaskGetStackHighWaterMark(meshTaskHandle) : 0));
+		}
+		else if (next == PROF_NUM + 1)
+		{
+			lineLen = snprintf(&buffer[len], size - len, "irq_stack_free,%lu\n",
+							   (unsigned long)(meshIrqTaskHandle != NULL ? uxTaskGetStackHighWaterMark(meshIrqTaskHandle) : 0));
+		}
+		else
+		{
+			lineLen = snprintf(&buffer[len], size - len, "caller_stack_free,%lu\n", (unsigned long)uxTaskGetStackHighWaterMark(NULL));
+		}
+		if ((lineLen < 0) || (lineLen >= (size - len)))
+		{
+			break;
+		}
+		len += lineLen;
+		next++;
+	}
+	if (len < size)
+	{
+		buffer[len] = 0;
+	}
+	return len;
+}
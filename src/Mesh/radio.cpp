@@ -0,0 +1,367 @@
+#include "main.h"
+
+/**
+ * Radio control layer.
+ * Keeps track of the mode and configuration of the SX126x and skips
+ * commands that would not change anything. Every command costs an SPI
+ * transaction and a wait for the BUSY pin.
+ * After TX done, RX done, CAD done and the timeouts the SX126x is back
+ * in standby, the callbacks report that with radioIdle().
+ * Called from the mesh task and from the radio callbacks in the radio
+ * task, a recursive mutex keeps the commands and the state together.
+ *
+ * Every mode change is time stamped and the time spent in each mode is
+ * accumulated. With the current draw of each mode this gives the charge
+ * and energy used by the radio. The RX duty cycle is accounted with its
+ * RX/sleep ratio, the longer RX after a detected preamble is not seen.
+ */
+
+/** Modes of the SX126x */
+enum radioModes
+{
+	RADIO_UNKNOWN = 0,
+	RADIO_STANDBY,
+	RADIO_RX,
+	RADIO_RX_DUTY,
+	RADIO_CAD,
+	RADIO_TX,
+	RADIO_MODES
+};
+
+/** Current draw of each mode [uA], unknown is accounted as standby */
+static const uint32_t radioCurrent[RADIO_MODES] = {
+	RADIO_CURRENT_STANDBY,
+	RADIO_CURRENT_STANDBY,
+	RADIO_CURRENT_RX,
+	(uint32_t)(((uint64_t)RADIO_CURRENT_RX * RX_DUTY_RX_STEPS + (uint64_t)RADIO_CURRENT_SLEEP * RX_DUTY_SLEEP_STEPS) /
+			   (RX_DUTY_RX_STEPS + RX_DUTY_SLEEP_STEPS)),
+	RADIO_CURRENT_CAD,
+	RADIO_CURRENT_TX};
+
+/** Current mode of the SX126x */
+radioModes radioMode = RADIO_UNKNOWN;
+/** Current spreading factor, 0 = unknown */
+uint8_t radioSf = 0;
+/** Current channel, 0xFF = unknown */
+uint8_t radioChannel = 0xFF;
+/** Flag if the CAD parameters are set */
+boolean radioCadReady = false;
+
+/** Lock of the SX126x and its state */
+SemaphoreHandle_t radioLock = NULL;
+
+/** Holds the radio lock while in scope */
+struct radioGuard
+{
+	radioGuard()
+	{
+		if (radioLock != NULL)
+		{
+			xSemaphoreTakeRecursive(radioLock, portMAX_DELAY);
+		}
+	}
+	~radioGuard()
+	{
+		if (radioLock != NULL)
+		{
+			xSemaphoreGiveRecursive(radioLock);
+		}
+	}
+};
+
+/** Time spent in each mode [us] */
+uint64_t radioModeTime[RADIO_MODES] = {0};
+/** Time the current mode started [us] */
+uint32_t radioModeStart = 0;
+
+/**
+ * Change the mode and account the time spent in the old mode
+ * @param mode
+ * 		New mode
+ */
+static void radioSetMode(radioModes mode)
+{
+	uint32_t now = micros();
+	radioModeTime[radioMode] += now - radioModeStart;
+	radioModeStart = now;
+	radioMode = mode;
+}
+
+/**
+ * Get the time spent in a mode including the running mode
+ * @param mode
+ * 		Mode
+ * @return uint64_t
+ * 		Time [us]
+ */
+static uint64_t radioTimeIn(radioModes mode)
+{
+	uint64_t time = radioModeTime[mode];
+	if (mode == radioMode)
+	{
+		time += micros() - radioModeStart;
+	}
+	return time;
+}
+
+/**
+ * Get the charge used in a mode
+ * @param mode
+ * 		Mode
+ * @return uint64_t
+ * 		Charge [uA * us]
+ */
+static uint64_t radioCharge(radioModes mode)
+{
+	return radioTimeIn(mode) * radioCurrent[mode];
+}
+
+/**
+ * Get a radio accounting value for the statistics
+ * @param id
+ * 		STAT_RADIO_TX_MS ... STAT_RADIO_UJ_PER_PACKET
+ * @return uint32_t
+ * 		Value, 0 if the ID is not a radio accounting value
+ */
+uint32_t radioStat(uint8_t id)
+{
+	radioGuard guard;
+	switch (id)
+	{
+	case STAT_RADIO_TX_MS:
+		return radioTimeIn(RADIO_TX) / 1000;
+	case STAT_RADIO_RX_MS:
+		return radioTimeIn(RADIO_RX) / 1000;
+	case STAT_RADIO_RX_DUTY_MS:
+		return radioTimeIn(RADIO_RX_DUTY) / 1000;
+	case STAT_RADIO_CAD_MS:
+		return radioTimeIn(RADIO_CAD) / 1000;
+	case STAT_RADIO_STANDBY_MS:
+		return (radioTimeIn(RADIO_STANDBY) + radioTimeIn(RADIO_UNKNOWN)) / 1000;
+	case STAT_RADIO_CHARGE_UAH:
+	case STAT_RADIO_UAH_PER_HOUR:
+	{
+		uint64_t charge = 0;
+		uint64_t time = 0;
+		for (int mode = 0; mode < RADIO_MODES; mode++)
+		{
+			charge += radioCharge((radioModes)mode);
+			time += radioTimeIn((radioModes)mode);
+		}
+		if (id == STAT_RADIO_CHARGE_UAH)
+		{
+			// 1 uAh = 3600000000 uA * us
+			return charge / 3600000000ULL;
+		}
+		// Average current, equals the charge per hour
+		return time != 0 ? charge / time : 0;
+	}
+	case STAT_RADIO_UJ_PER_PACKET:
+	{
+		// CAD and TX per sent package, uA * us * mV = 1e-9 uJ
+		uint32_t packets = meshStatGet(STAT_TX_DONE);
+		if (packets == 0)
+		{
+			return 0;
+		}
+		uint64_t charge = (radioCharge(RADIO_TX) + radioCharge(RADIO_CAD)) / packets;
+		return charge * RADIO_VOLTAGE / 1000000000ULL;
+	}
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Reset the radio accounting
+ */
+void radioAccountReset(void)
+{
+	radioGuard guard;
+	for (int mode = 0; mode < RADIO_MODES; mode++)
+	{
+		radioModeTime[mode] = 0;
+	}
+	radioModeStart = micros();
+}
+
+/**
+ * Initialize the radio control layer
+ */
+void initRadio(void)
+{
+	radioLock = xSemaphoreCreateRecursiveMutex();
+}
+
+/**
+ * Forget the state of the SX126x, the next commands are sent in any case
+ */
+void radioReset(void)
+{
+	radioGuard guard;
+	radioSetMode(RADIO_UNKNOWN);
+	radioSf = 0;
+	radioChannel = 0xFF;
+	radioCadReady = false;
+}
+
+/**
+ * The SX126x went back to standby after an event
+ */
+void radioIdle(void)
+{
+	radioGuard guard;
+	radioSetMode(RADIO_STANDBY);
+}
+
+/**
+ * The SX126x went back to standby after an RX event, listen again in the same mode
+ * Nothing is done if the mesh task changed the mode meanwhile.
+ */
+void radioRxRestart(void)
+{
+	radioGuard guard;
+	if ((radioMode == RADIO_RX) || (radioMode == RADIO_RX_DUTY))
+	{
+		boolean continuous = radioMode == RADIO_RX;
+		radioIdle();
+		radioRx(continuous);
+	}
+}
+
+/**
+ * Read and handle the interrupts of the SX126x, calls the radio callbacks
+ */
+void radioIrqProcess(void)
+{
+	radioGuard guard;
+	Radio.IrqProcess();
+}
+
+/**
+ * Put the SX126x into standby
+ */
+void radioStandby(void)
+{
+	radioGuard guard;
+	if (radioMode == RADIO_STANDBY)
+	{
+		meshStatAdd(STAT_RADIO_SKIPPED);
+		return;
+	}
+	meshStatAdd(STAT_RADIO_CMD);
+	Radio.Standby();
+	radioSetMode(RADIO_STANDBY);
+}
+
+/**
+ * Set the spreading factor for TX and RX
+ * @param sf
+ * 		Spreading factor
+ */
+void radioSetRate(uint8_t sf)
+{
+	radioGuard guard;
+	if (sf == radioSf)
+	{
+		meshStatAdd(STAT_RADIO_SKIPPED);
+		return;
+	}
+	radioStandby();
+	meshStatAdd(STAT_RADIO_CMD, 2);
+	// Set transmit configuration
+	Radio.SetTxConfig(MODEM_LORA, TX_OUTPUT_POWER, 0, LORA_BANDWIDTH,
+					  sf, LORA_CODINGRATE,
+					  LORA_PREAMBLE_LENGTH, LORA_FIX_LENGTH_PAYLOAD_ON,
+					  true, 0, 0, LORA_IQ_INVERSION_ON, TX_TIMEOUT_VALUE);
+	// Set receive configuration
+	Radio.SetRxConfig(MODEM_LORA, LORA_BANDWIDTH, sf,
+					  LORA_CODINGRATE, 0, LORA_PREAMBLE_LENGTH,
+					  LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
+					  0, true, 0, 0, LORA_IQ_INVERSION_ON, true);
+	radioSf = sf;
+}
+
+/**
+ * Set the channel for TX and RX
+ * @param channel
+ * 		Channel number, 0 is the rendezvous channel
+ */
+void radioSetChannel(uint8_t channel)
+{
+	radioGuard guard;
+	if (channel == radioChannel)
+	{
+		meshStatAdd(STAT_RADIO_SKIPPED);
+		return;
+	}
+	radioStandby();
+	meshStatAdd(STAT_RADIO_CMD);
+	Radio.SetChannel(RF_FREQUENCY + (uint32_t)channel * CHANNEL_SPACING);
+	radioChannel = channel;
+}
+
+/**
+ * Start listening
+ * @param continuous
+ * 		True to listen continuously, false for RX duty cycle
+ */
+void radioRx(bool continuous)
+{
+	radioGuard guard;
+	radioModes newMode = continuous ? RADIO_RX : RADIO_RX_DUTY;
+	if (radioMode == newMode)
+	{
+		meshStatAdd(STAT_RADIO_SKIPPED);
+		return;
+	}
+	radioStandby();
+	meshStatAdd(STAT_RADIO_CMD);
+	if (continuous)
+	{
+		Radio.Rx(0);
+	}
+	else
+	{
+		Radio.SetRxDutyCycle(RX_DUTY_RX_STEPS, RX_DUTY_SLEEP_STEPS);
+	}
+	radioSetMode(newMode);
+}
+
+/**
+ * Start channel activity detection on the common rate
+ */
+void radioStartCad(void)
+{
+	radioGuard guard;
+	radioStandby();
+	if (!radioCadReady)
+	{
+		meshStatAdd(STAT_RADIO_CMD);
+		Radio.SetCadParams(LORA_CAD_08_SYMBOL, LORA_SPREADING_FACTOR + 13, 10, LORA_CAD_ONLY, 0);
+		radioCadReady = true;
+	}
+	else
+	{
+		meshStatAdd(STAT_RADIO_SKIPPED);
+	}
+	meshStatAdd(STAT_RADIO_CMD);
+	Radio.StartCad();
+	radioSetMode(RADIO_CAD);
+}
+
+/**
+ * Send a package
+ * @param buffer
+ * 		Package
+ * @param size
+ * 		Size of the package
+ */
+void radioSend(uint8_t *buffer, uint8_t size)
+{
+	radioGuard guard;
+	radioStandby();
+	meshStatAdd(STAT_RADIO_CMD);
+	Radio.Send(buffer, size);
+	radioSetMode(RADIO_TX);
+}
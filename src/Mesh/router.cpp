@@ -64,6 +64,8 @@ boolean addNode(uint32_t id, uint32_t hop, uint8_t hopNum)
 	_newNode.firstHop = hop;
 	_newNode.timeStamp = millis();
 	_newNode.numHops = hopNum;
+	_newNode.snr = ADR_SNR_UNKNOWN;
+	_newNode.slot = TDMA_SLOT_UNKNOWN;
 
 	for (int idx = 0; idx < _numOfNodes; idx++)
 	{
@@ -121,7 +123,13 @@ boolean addNode(uint32_t id, uint32_t hop, uint8_t hopNum)
 	memcpy(&nodesMap[nodesMapIndex], &_newNode, sizeof(nodesList));
 	nodesMapIndex++;
 
+	if (!isShortAddressUnique(id))
+	{
+		myLog_w("Short address %04X of node %08X collides, using full header", shortAddress(id), id);
+	}
+
 	listChanged = true;
+	meshStatAdd(STAT_NODE_ADDED);
 	myLog_d("Added node %lX with hop %lX and num hops %d", id, hop, hopNum);
 	return listChanged;
 }
@@ -166,6 +174,7 @@ bool cleanMap(void)
 		{
 			// Node was not refreshed for inActiveTimeout milli seconds
 			myLog_e("Node %lX with hop %lX timed out or has too many hops", nodesMap[idx].nodeId, nodesMap[idx].firstHop);
+			meshStatAdd(STAT_NODE_TIMEOUT);
 			if (nodesMap[idx].firstHop == 0)
 			{
 				clearSubs(nodesMap[idx].nodeId);
@@ -273,6 +282,196 @@ bool getNode(uint8_t nodeNum, uint32_t &nodeId, uint32_t &firstHop, uint8_t &num
 	return true;
 }
 
+/**
+ * Update the link SNR of a direct node
+ * Must be called while holding accessNodeList
+ * @param id
+ * 		Node ID
+ * @param snr
+ * 		SNR of the last package received from the node
+ */
+void updateNodeSnr(uint32_t id, int8_t snr)
+{
+	for (int idx = 0; idx < nodesMapIndex; idx++)
+	{
+		if ((nodesMap[idx].nodeId == id) && (nodesMap[idx].firstHop == 0))
+		{
+			if (nodesMap[idx].snr == ADR_SNR_UNKNOWN)
+			{
+				nodesMap[idx].snr = snr;
+			}
+			else
+			{
+				// Smooth out changes, weight of the new value is 1/4
+				nodesMap[idx].snr = (3 * nodesMap[idx].snr + snr) / 4;
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * Get the fastest SF that can be used for the link to a direct node
+ * Must be called while holding accessNodeList
+ * @param id
+ * 		Node ID
+ * @return uint8_t
+ * 		Spreading factor, LORA_SPREADING_FACTOR if the node is not direct or the SNR is unknown
+ */
+uint8_t getLinkSf(uint32_t id)
+{
+	for (int idx = 0; idx < nodesMapIndex; idx++)
+	{
+		if ((nodesMap[idx].nodeId == id) && (nodesMap[idx].firstHop == 0))
+		{
+			if (nodesMap[idx].snr == ADR_SNR_UNKNOWN)
+			{
+				break;
+			}
+			for (uint8_t sf = ADR_MIN_SF; sf < LORA_SPREADING_FACTOR; sf++)
+			{
+				if (nodesMap[idx].snr >= (loraRequiredSnr(sf) + ADR_SNR_MARGIN))
+				{
+					return sf;
+				}
+			}
+			break;
+		}
+	}
+	return LORA_SPREADING_FACTOR;
+}
+
+/**
+ * Update the slot a direct node announced in its map
+ * Must be called while holding accessNodeList
+ * @param id
+ * 		Node ID
+ * @param slot
+ * 		Slot of the node
+ */
+void updateNodeSlot(uint32_t id, uint8_t slot)
+{
+	for (int idx = 0; idx < nodesMapIndex; idx++)
+	{
+		if ((nodesMap[idx].nodeId == id) && (nodesMap[idx].firstHop == 0))
+		{
+			nodesMap[idx].slot = slot;
+			return;
+		}
+	}
+}
+
+/**
+ * Check if a slot is used by a node with a lower ID up to two hops away
+ * Direct nodes are checked with the slot they announced,
+ * nodes two hops away with their preferred slot.
+ * Must be called while holding accessNodeList
+ * @param slot
+ * 		Slot to check
+ * @return bool
+ * 		True if the slot is taken
+ */
+bool isSlotTaken(uint8_t slot)
+{
+	for (int idx = 0; idx < nodesMapIndex; idx++)
+	{
+		if ((nodesMap[idx].nodeId >= deviceID) || (nodesMap[idx].numHops > 1))
+		{
+			continue;
+		}
+		uint8_t nodeSlot = nodesMap[idx].slot;
+		if ((nodesMap[idx].firstHop != 0) || (nodeSlot == TDMA_SLOT_UNKNOWN))
+		{
+			nodeSlot = tdmaBaseSlot(nodesMap[idx].nodeId);
+		}
+		if (nodeSlot == slot)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Get the 16 bit short address of a node
+ * @param id
+ * 		Node ID
+ * @return uint16_t
+ * 		Short address, 0 is reserved for ID 0
+ */
+uint16_t shortAddress(uint32_t id)
+{
+	return (uint16_t)((id ^ (id >> 16)) & 0x0000FFFF);
+}
+
+/**
+ * Check if the short address of a node is unique in the nodes map
+ * Must be called while holding accessNodeList
+ * @param id
+ * 		Node ID
+ * @return bool
+ * 		True if no other known node uses the same short address
+ */
+bool isShortAddressUnique(uint32_t id)
+{
+	uint16_t idShort = shortAddress(id);
+	if (id == 0)
+	{
+		return true;
+	}
+	if (idShort == 0)
+	{
+		// Reserved for ID 0
+		return false;
+	}
+	if ((id != deviceID) && (shortAddress(deviceID) == idShort))
+	{
+		return false;
+	}
+	for (int idx = 0; idx < nodesMapIndex; idx++)
+	{
+		if ((nodesMap[idx].nodeId != id) && (shortAddress(nodesMap[idx].nodeId) == idShort))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Get the node ID for a short address
+ * Must be called while holding accessNodeList
+ * @param idShort
+ * 		Short address
+ * @param id
+ * 		Pointer to an uint32_t to save the node ID to
+ * @return bool
+ * 		True if exactly one known node uses the short address
+ */
+bool getFullAddress(uint16_t idShort, uint32_t &id)
+{
+	uint8_t found = 0;
+	if (idShort == 0)
+	{
+		id = 0;
+		return true;
+	}
+	if (shortAddress(deviceID) == idShort)
+	{
+		id = deviceID;
+		found++;
+	}
+	for (int idx = 0; idx < nodesMapIndex; idx++)
+	{
+		if (shortAddress(nodesMap[idx].nodeId) == idShort)
+		{
+			id = nodesMap[idx].nodeId;
+			found++;
+		}
+	}
+	return found == 1;
+}
+
 /**
  * Get next broadcast ID
  * @return
@@ -319,4 +518,57 @@ bool isOldBroadcast(uint32_t broadcastID)
 		broadcastIndex = 0;
 	}
 	return false;
+}
+
+byte linkPackageIndex = 0;
+#define NUM_OF_LAST_LINK_PACKAGES 10
+struct linkPackage
+{
+	uint32_t orig;
+	uint32_t from;
+	uint32_t hop;
+	uint8_t seq;
+};
+linkPackage linkPackageList[NUM_OF_LAST_LINK_PACKAGES] = {{0L, 0L, 0L, 0}};
+/**
+ * Handle link sequence numbers
+ * to avoid handling a retransmitted package twice
+ * if our link ACK got lost
+ * 
+ * @param orig
+ * 			Originator of the package
+ * @param from
+ * 			From field of the package
+ * @param hop
+ * 			Node that sent the package, the link sequence numbers are its own
+ * @param seq
+ * 			Link sequence number of the package
+ * @return bool
+ * 			True if the package was already received, else false
+ */
+bool isOldLinkPackage(uint32_t orig, uint32_t from, uint32_t hop, uint8_t seq)
+{
+	for (int idx = 0; idx < NUM_OF_LAST_LINK_PACKAGES; idx++)
+	{
+		if ((linkPackageList[idx].orig == orig) &&
+			(linkPackageList[idx].from == from) &&
+			(linkPackageList[idx].hop == hop) &&
+			(linkPackageList[idx].seq == seq))
+		{
+			// Package is already in the list
+			return true;
+		}
+	}
+	// This is a new package
+	linkPackageList[linkPackageIndex].orig = orig;
+	linkPackageList[linkPackageIndex].from = from;
+	linkPackageList[linkPackageIndex].hop = hop;
+	linkPackageList[linkPackageIndex].seq = seq;
+	linkPackageIndex++;
+	if (linkPackageIndex == NUM_OF_LAST_LINK_PACKAGES)
+	{
+		// Index overflow, reset to 0
+		linkPackageIndex = 0;
+	}
+	return false;
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "main.h"
+
+/**
+ * Mesh statistics
+ * Counters are plain uint32_t in one array, incremented with a relaxed
+ * atomic add from any task. They never take accessNodeList, so they can be
+ * used while the nodes list is locked.
+ * The radio time and energy values are computed by the radio accounting
+ * when they are read.
+ * Export formats:
+ * CSV, one "name,value" line per counter
+ * Binary, [version][number of counters][counter 0 LE32][counter 1 LE32]...
+ */
+
+/** Version of the binary statistics format */
+#define STATS_VERSION 3
+
+/** The counters */
+uint32_t meshStats[STAT_NUM] = {0};
+
+/** Names of the counters, in the order of meshStatId */
+static const char *statNames[] = {
+	"rx_direct",
+	"rx_forward",
+	"rx_broadcast",
+	"rx_map",
+	"rx_ack",
+	"rx_rate",
+	"rx_echo",
+	"rx_echo_reply",
+	"rx_invalid",
+	"rx_unresolved",
+	"rx_not_neighbour",
+	"rx_legacy",
+	"rx_ring_drop",
+	"rx_crc_error",
+	"rx_duplicate",
+	"ttl_drop",
+	"tx_done",
+	"tx_timeout",
+	"tx_stuck",
+	"cad_busy",
+	"cad_give_up",
+	"link_give_up",
+	"queue_full",
+	"map_applied",
+	"node_added",
+	"node_timeout",
+	"radio_cmd",
+	"radio_skipped",
+	"flood_rebroadcast",
+	"flood_suppressed",
+	"radio_tx_ms",
+	"radio_rx_ms",
+	"radio_rx_duty_ms",
+	"radio_cad_ms",
+	"radio_standby_ms",
+	"radio_charge_uah",
+	"radio_uah_per_hour",
+	"radio_uj_per_packet",
+};
+
+static_assert(sizeof(statNames) / sizeof(statNames[0]) == STAT_NUM, "A name is needed for each counter");
+static_assert(LORA_ACK - LORA_DIRECT == STAT_RX_ACK - STAT_RX_DIRECT, "RX counters must be in the order of the package types");
+static_assert(LORA_RATE - LORA_DIRECT == STAT_RX_RATE - STAT_RX_DIRECT, "RX counters must be in the order of the package types");
+static_assert(LORA_ECHO_REPLY - LORA_DIRECT == STAT_RX_ECHO_REPLY - STAT_RX_DIRECT, "RX counters must be in the order of the package types");
+
+/**
+ * Get a counter
+ * @param id
+ * 		Counter ID
+ * @return uint32_t
+ * 		Counter value, 0 if the ID is invalid
+ */
+uint32_t meshStatGet(uint8_t id)
+{
+	if (id >= STAT_NUM)
+	{
+		return 0;
+	}
+	if (id >= STAT_RADIO_TX_MS)
+	{
+		// Computed by the radio accounting
+		return radioStat(id);
+	}
+	return __atomic_load_n(&meshStats[id], __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the name of a counter
+ * @param id
+ * 		Counter ID
+ * @return const char*
+ * 		Name, NULL if the ID is invalid
+ */
+const char *meshStatName(uint8_t id)
+{
+	if (id >= STAT_NUM)
+	{
+		return NULL;
+	}
+	return statNames[id];
+}
+
+/**
+ * Reset all counters
+ */
+void meshStatsReset(void)
+{
+	for (int idx = 0; idx < STAT_NUM; idx++)
+	{
+		__atomic_store_n(&meshStats[idx], 0, __ATOMIC_RELAXED);
+	}
+	radioAccountReset();
+}
+
+/**
+ * Write counters as CSV lines
+ * Writes only complete lines, call again with the updated index until it returns 0
+ * @param buffer
+ * 		Buffer for the text
+ * @param size
+ * 		Size of the buffer
+ * @param next
+ * 		Index of the first counter to write, updated to the next counter
+ * @return uint16_t
+ * 		Length of the text
+ */
+uint16_t meshStatsCsv(char *buffer, uint16_t size, uint8_t &next)
+{
+	uint16_t len = 0;
+	while (next < STAT_NUM)
+	{
+		int lineLen = snprintf(&buffer[len], size - len, "%s,%lu\n", statNames[next], (unsigned long)meshStatGet(next));
+		if ((lineLen < 0) || (lineLen >= (size - len)))
+		{
+			break;
+		}
+		len += lineLen;
+		next++;
+	}
+	if (len < size)
+	{
+		buffer[len] = 0;
+	}
+	return len;
+}
+
+/**
+ * Write all counters in the binary format
+ * @param buffer
+ * 		Buffer for the data, needs 2 + 4 * STAT_NUM bytes
+ * @param size
+ * 		Size of the buffer
+ * @return uint16_t
+ * 		Length of the data, 0 if the buffer is too small
+ */
+uint16_t meshStatsBinary(uint8_t *buffer, uint16_t size)
+{
+	if (size < 2 + 4 * STAT_NUM)
+	{
+		return 0;
+	}
+	uint16_t len = 0;
+	buffer[len++] = STATS_VERSION;
+	buffer[len++] = STAT_NUM;
+	for (int idx = 0; idx < STAT_NUM; idx++)
+	{
+		uint32_t value = meshStatGet(idx);
+		buffer[len++] = value & 0xFF;
+		buffer[len++] = (value >> 8) & 0xFF;
+		buffer[len++] = (value >> 16) & 0xFF;
+		buffer[len++] = (value >> 24) & 0xFF;
+	}
+	return len;
+}
@@ -0,0 +1,133 @@
+#include "main.h"
+
+/**
+ * Slotted channel access.
+ * The mesh time is the local time plus an offset. Every node map carries
+ * the slot and the mesh time of the sender in a trailer after the end
+ * marker. A receiver moves its mesh time forward if the sender is ahead,
+ * so all nodes follow the node with the fastest clock.
+ * Trailer:
+ * [0] slot of the sender
+ * [1..4] mesh time of the sender when the map was sent
+ */
+
+/** Offset of the mesh time to millis() */
+uint32_t tdmaOffset = 0;
+/** Slot of this node */
+uint8_t tdmaOwnSlot = 0;
+
+/**
+ * Initialize the slotted mode with the preferred slot of this node
+ */
+void initTdma(void)
+{
+	tdmaOffset = 0;
+	tdmaOwnSlot = tdmaBaseSlot(deviceID);
+	myLog_d("TDMA slot %d of %d, slot time %d ms", tdmaOwnSlot, TDMA_SLOTS, TDMA_SLOT_TIME);
+}
+
+/**
+ * Get the mesh time
+ * @return uint32_t
+ * 		Mesh time in ms
+ */
+uint32_t tdmaTime(void)
+{
+	return millis() + tdmaOffset;
+}
+
+/**
+ * Get the slot of this node
+ * @return uint8_t
+ * 		Slot number
+ */
+uint8_t tdmaSlot(void)
+{
+	return tdmaOwnSlot;
+}
+
+/**
+ * Select the slot of this node
+ * Starts with the preferred slot and takes the next one
+ * that is not used by a node with lower ID up to two hops away.
+ * Must be called while holding accessNodeList
+ */
+void tdmaUpdateSlot(void)
+{
+	uint8_t slot = tdmaBaseSlot(deviceID);
+	for (int idx = 0; idx < TDMA_SLOTS; idx++)
+	{
+		if (!isSlotTaken(slot))
+		{
+			break;
+		}
+		slot = (slot + 1) % TDMA_SLOTS;
+	}
+	if (slot != tdmaOwnSlot)
+	{
+		myLog_d("TDMA slot changed from %d to %d", tdmaOwnSlot, slot);
+		tdmaOwnSlot = slot;
+	}
+}
+
+/**
+ * Get the time until a package may be sent
+ * @param len
+ * 		Package size
+ * @return int32_t
+ * 		0 if the package fits into the rest of the own slot,
+ * 		else time in ms until the own slot starts
+ */
+int32_t tdmaWait(uint16_t len)
+{
+#if MESH_TDMA > 0
+	uint32_t framePos = tdmaTime() % TDMA_FRAME_TIME;
+	uint32_t slotStart = tdmaOwnSlot * TDMA_SLOT_TIME;
+
+	if ((framePos >= slotStart) && ((framePos + tdmaBusyTime(len)) <= (slotStart + TDMA_SLOT_TIME)))
+	{
+		return 0;
+	}
+	if (framePos < slotStart)
+	{
+		return slotStart - framePos;
+	}
+	return TDMA_FRAME_TIME - framePos + slotStart;
+#else
+	(void)len;
+	return 0;
+#endif
+}
+
+/**
+ * Synchronize the mesh time with the time of a received node map
+ * @param remoteTime
+ * 		Mesh time of the sender when the map was sent
+ * @param len
+ * 		Size of the map package
+ */
+void tdmaSync(uint32_t remoteTime, uint16_t len)
+{
+	// The sender time stamp is taken when the transmission starts
+	int32_t diff = (int32_t)(remoteTime + meshTimeOnAirUs(len) / 1000 - tdmaTime());
+	if (diff > 0)
+	{
+		myLog_v("TDMA time moved by %d ms", diff);
+		tdmaOffset += diff;
+	}
+}
+
+/**
+ * Write the slot and the mesh time trailer of a node map
+ * @param trailer
+ * 		Buffer for TDMA_TRAILER_SIZE bytes
+ */
+void tdmaTrailer(uint8_t *trailer)
+{
+	uint32_t now = tdmaTime();
+	trailer[0] = tdmaOwnSlot;
+	trailer[1] = now & 0xFF;
+	trailer[2] = (now >> 8) & 0xFF;
+	trailer[3] = (now >> 16) & 0xFF;
+	trailer[4] = (now >> 24) & 0xFF;
+}
@@ -0,0 +1,180 @@
+#include "main.h"
+
+/**
+ * Node telemetry
+ * Builds the own telemetry block for the node map and keeps the latest
+ * block of the neighbors. The table is only written by the mesh task,
+ * entries are replaced if the node is already known, else an empty or
+ * the oldest entry is used.
+ */
+
+/** Latest telemetry of the neighbors */
+static telemetryData telemetryTable[TELEMETRY_NODES];
+
+/** Write a little endian 16 bit value */
+static void telemetrySet16(uint8_t *pos, uint32_t value)
+{
+	pos[0] = value & 0xFF;
+	pos[1] = (value >> 8) & 0xFF;
+}
+
+/** Read a little endian 16 bit value */
+static uint16_t telemetryGet16(const uint8_t *pos)
+{
+	return pos[0] | (pos[1] << 8);
+}
+
+/**
+ * Write the own telemetry block
+ * @param block
+ * 		Buffer for the block, padded with 0 to full map entries
+ * @param battery
+ * 		Battery voltage [mV], 0 if unknown
+ * @return uint8_t
+ * 		Number of map entries used
+ */
+uint8_t telemetryBlock(uint8_t *block, uint16_t battery)
+{
+	uint32_t rxPackets = 0;
+	for (int idx = STAT_RX_DIRECT; idx <= STAT_RX_ECHO_REPLY; idx++)
+	{
+		rxPackets += meshStatGet(idx);
+	}
+	uint32_t uptime = millis() / 1000;
+
+	memset(block, 0, TELEMETRY_ENTRIES * FRAME_MAP_ENTRY);
+	block[0] = TELEMETRY_VERSION;
+	block[1] = TELEMETRY_SIZE;
+	block[2] = uptime & 0xFF;
+	block[3] = (uptime >> 8) & 0xFF;
+	block[4] = (uptime >> 16) & 0xFF;
+	block[5] = (uptime >> 24) & 0xFF;
+	telemetrySet16(&block[6], battery);
+	telemetrySet16(&block[8], rxPackets);
+	telemetrySet16(&block[10], meshStatGet(STAT_TX_DONE));
+	telemetrySet16(&block[12], meshStatGet(STAT_QUEUE_FULL));
+	telemetrySet16(&block[14], meshStatGet(STAT_CAD_GIVE_UP));
+	telemetrySet16(&block[16], meshStatGet(STAT_RX_INVALID) + meshStatGet(STAT_RX_CRC_ERROR));
+	telemetrySet16(&block[18], meshStatGet(STAT_RX_RING_DROP));
+	return TELEMETRY_ENTRIES;
+}
+
+/**
+ * Store a received telemetry block
+ * Blocks shorter than version 1 are ignored, fields added by later
+ * versions are skipped.
+ * @param fromID
+ * 		Node that sent the map
+ * @param block
+ * 		Telemetry block
+ * @param size
+ * 		Size of the block from its length byte
+ * @param rssi
+ * 		RSSI of the map
+ * @param snr
+ * 		SNR of the map
+ */
+void telemetryRx(uint32_t fromID, const uint8_t *block, uint8_t size, int16_t rssi, int8_t snr)
+{
+	if ((block[0] < TELEMETRY_VERSION) || (size < TELEMETRY_SIZE))
+	{
+		myLog_d("Unknown telemetry version %d size %d", block[0], size);
+		return;
+	}
+
+	// Same node, else an empty or the oldest entry
+	uint8_t use = 0;
+	for (int idx = 0; idx < TELEMETRY_NODES; idx++)
+	{
+		if (telemetryTable[idx].nodeId == fromID)
+		{
+			use = idx;
+			break;
+		}
+		if (telemetryTable[use].nodeId == 0)
+		{
+			continue;
+		}
+		if ((telemetryTable[idx].nodeId == 0) ||
+			((millis() - telemetryTable[idx].rxTime) > (millis() - telemetryTable[use].rxTime)))
+		{
+			use = idx;
+		}
+	}
+
+	telemetryData *entry = &telemetryTable[use];
+	entry->nodeId = fromID;
+	entry->rxTime = millis();
+	entry->rssi = rssi;
+	entry->snr = snr;
+	entry->version = block[0];
+	entry->uptime = block[2] | (block[3] << 8) | (block[4] << 16) | ((uint32_t)block[5] << 24);
+	entry->battery = telemetryGet16(&block[6]);
+	entry->rxPackets = telemetryGet16(&block[8]);
+	entry->txPackets = telemetryGet16(&block[10]);
+	entry->queueFull = telemetryGet16(&block[12]);
+	entry->cadGiveUp = telemetryGet16(&block[14]);
+	entry->rxErrors = telemetryGet16(&block[16]);
+	entry->rxDrops = telemetryGet16(&block[18]);
+}
+
+/**
+ * Get an entry of the telemetry table
+ * @param idx
+ * 		Index of the entry
+ * @param entry
+ * 		Copy of the entry
+ * @return bool
+ * 		True if the entry is used
+ */
+bool telemetryGet(uint8_t idx, telemetryData *entry)
+{
+	if ((idx >= TELEMETRY_NODES) || (telemetryTable[idx].nodeId == 0))
+	{
+		return false;
+	}
+	memcpy(entry, &telemetryTable[idx], sizeof(telemetryData));
+	return true;
+}
+
+/**
+ * Write the telemetry table as CSV lines
+ * node,age [s],version,uptime [s],battery [mV],rx,tx,queue_full,cad_give_up,rx_errors,rx_drops,rssi,snr
+ * Writes only complete lines, call again with the updated index until it returns 0
+ * @param buffer
+ * 		Buffer for the text
+ * @param size
+ * 		Size of the buffer
+ * @param next
+ * 		Index of the first entry to write, updated to the next entry
+ * @return uint16_t
+ * 		Length of the text
+ */
+uint16_t telemetryCsv(char *buffer, uint16_t size, uint8_t &next)
+{
+	uint16_t len = 0;
+	while (next < TELEMETRY_NODES)
+	{
+		telemetryData entry;
+		if (!telemetryGet(next, &entry))
+		{
+			next++;
+			continue;
+		}
+		int lineLen = snprintf(&buffer[len], size - len, "%08lX,%lu,%d,%lu,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+							   (unsigned long)entry.nodeId, (unsigned long)((millis() - entry.rxTime) / 1000), entry.version,
+							   (unsigned long)entry.uptime, entry.battery, entry.rxPackets, entry.txPackets, entry.queueFull,
+							   entry.cadGiveUp, entry.rxErrors, entry.rxDrops, entry.rssi, entry.snr);
+		if ((lineLen < 0) || (lineLen >= (size - len)))
+		{
+			break;
+		}
+		len += lineLen;
+		next++;
+	}
+	if (len < size)
+	{
+		buffer[len] = 0;
+	}
+	return len;
+}
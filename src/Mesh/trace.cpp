@@ -0,0 +1,268 @@
+#include "main.h"
+
+/**
+ * Per package latency tracing
+ * Every TRACE_SAMPLE th package is time stamped at each stage on the way
+ * through the mesh. The times between the stages are collected in
+ * histograms with fixed buckets.
+ * TX: enqueue -> dequeue -> CAD start -> CAD done -> send -> TX done
+ * RX: OnRxDone -> mesh task -> DataAvailable callback
+ * Only one package is sent at a time, so one TX trace is enough. The time
+ * of the enqueue is kept per send queue slot.
+ * traceEnqueue() can be called from any task, traceRxStart() is called
+ * from OnRxDone in the radio task, all other functions only from the
+ * mesh task.
+ */
+
+/** Upper limits of the histogram buckets [us], the last bucket takes the rest */
+static const uint32_t traceLimits[TRACE_BUCKETS - 1] = {
+	1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000};
+
+/** Names of the intervals, in the order of traceInterval */
+static const char *traceNames[] = {
+	"queue",
+	"prepare",
+	"cad",
+	"cad_to_send",
+	"on_air",
+	"tx_total",
+	"rx_ring",
+	"rx_callback",
+};
+
+static_assert(sizeof(traceNames) / sizeof(traceNames[0]) == TRACE_NUM, "A name is needed for each interval");
+
+/** The histograms */
+traceHistogram traceHist[TRACE_NUM];
+
+/** Time of the enqueue per send queue slot, 0 if not sampled */
+static uint32_t traceQueued[SEND_QUEUE_SIZE];
+/** Time stamps of the traced package in transmission */
+static uint32_t txTrace[TRACE_STAGES];
+/** Flag if the package in transmission is traced */
+static bool txTraced = false;
+/** Sample counters */
+static uint8_t txSample = 0;
+static uint8_t rxSample = 0;
+
+/**
+ * Add a time to a histogram
+ * @param interval
+ * 		Histogram
+ * @param time
+ * 		Time [us]
+ */
+static void traceAdd(traceInterval interval, uint32_t time)
+{
+	traceHistogram *hist = &traceHist[interval];
+	uint8_t bucket = 0;
+	while ((bucket < (TRACE_BUCKETS - 1)) && (time >= traceLimits[bucket]))
+	{
+		bucket++;
+	}
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sum += time;
+	if (time > hist->max)
+	{
+		hist->max = time;
+	}
+}
+
+/**
+ * Package was added to the send queue
+ * @param slot
+ * 		Send queue slot of the package
+ */
+void traceEnqueue(uint8_t slot)
+{
+	if (slot >= SEND_QUEUE_SIZE)
+	{
+		return;
+	}
+	txSample++;
+	if (txSample >= TRACE_SAMPLE)
+	{
+		txSample = 0;
+		// 0 marks a package that is not traced
+		traceQueued[slot] = micros() | 1;
+	}
+	else
+	{
+		traceQueued[slot] = 0;
+	}
+}
+
+/**
+ * Package was taken from the send queue, starts the TX trace if the package is sampled
+ * @param slot
+ * 		Send queue slot of the package
+ */
+void traceDequeue(uint8_t slot)
+{
+	txTraced = false;
+	if ((slot >= SEND_QUEUE_SIZE) || (traceQueued[slot] == 0))
+	{
+		return;
+	}
+	txTrace[TRACE_ENQUEUE] = traceQueued[slot];
+	traceQueued[slot] = 0;
+	for (int idx = TRACE_DEQUEUE; idx < TRACE_STAGES; idx++)
+	{
+		txTrace[idx] = 0;
+	}
+	txTrace[TRACE_DEQUEUE] = micros();
+	txTraced = true;
+}
+
+/**
+ * The traced package in transmission reached a stage
+ * TRACE_TX_DONE finishes the trace and adds the intervals to the histograms
+ * @param stage
+ * 		Stage reached
+ */
+void traceTx(traceStage stage)
+{
+	if (!txTraced)
+	{
+		return;
+	}
+	txTrace[stage] = micros();
+	if (stage != TRACE_TX_DONE)
+	{
+		return;
+	}
+	txTraced = false;
+	if ((txTrace[TRACE_CAD_START] == 0) || (txTrace[TRACE_CAD_DONE] == 0) || (txTrace[TRACE_SEND] == 0))
+	{
+		// Incomplete trace
+		return;
+	}
+	traceAdd(TRACE_QUEUE, txTrace[TRACE_DEQUEUE] - txTrace[TRACE_ENQUEUE]);
+	traceAdd(TRACE_PREPARE, txTrace[TRACE_CAD_START] - txTrace[TRACE_DEQUEUE]);
+	traceAdd(TRACE_CAD, txTrace[TRACE_CAD_DONE] - txTrace[TRACE_CAD_START]);
+	traceAdd(TRACE_CAD_TO_SEND, txTrace[TRACE_SEND] - txTrace[TRACE_CAD_DONE]);
+	traceAdd(TRACE_ON_AIR, txTrace[TRACE_TX_DONE] - txTrace[TRACE_SEND]);
+	traceAdd(TRACE_TX_TOTAL, txTrace[TRACE_TX_DONE] - txTrace[TRACE_ENQUEUE]);
+}
+
+/**
+ * Transmission failed, drop the TX trace
+ */
+void traceTxAbort(void)
+{
+	txTraced = false;
+}
+
+/**
+ * Package was received, called from OnRxDone in the radio task
+ * @return uint32_t
+ * 		Start time of the RX trace, 0 if the package is not sampled
+ */
+uint32_t traceRxStart(void)
+{
+	rxSample++;
+	if (rxSample < TRACE_SAMPLE)
+	{
+		return 0;
+	}
+	rxSample = 0;
+	return micros() | 1;
+}
+
+/**
+ * Received package reached a stage
+ * @param interval
+ * 		TRACE_RX_RING or TRACE_RX_CALLBACK
+ * @param start
+ * 		Start time returned by traceRxStart()
+ */
+void traceRx(traceInterval interval, uint32_t start)
+{
+	if (start != 0)
+	{
+		traceAdd(interval, micros() - start);
+	}
+}
+
+/**
+ * Get the name of an interval
+ * @param interval
+ * 		Interval ID
+ * @return const char*
+ * 		Name, NULL if the ID is invalid
+ */
+const char *traceName(uint8_t interval)
+{
+	if (interval >= TRACE_NUM)
+	{
+		return NULL;
+	}
+	return traceNames[interval];
+}
+
+/**
+ * Get the upper limit of a histogram bucket
+ * @param bucket
+ * 		Bucket index
+ * @return uint32_t
+ * 		Upper limit [us], 0xFFFFFFFF for the last bucket
+ */
+uint32_t traceBucketLimit(uint8_t bucket)
+{
+	if (bucket >= (TRACE_BUCKETS - 1))
+	{
+		return 0xFFFFFFFF;
+	}
+	return traceLimits[bucket];
+}
+
+/**
+ * Reset all histograms
+ */
+void traceReset(void)
+{
+	memset(traceHist, 0, sizeof(traceHist));
+}
+
+/**
+ * Write the histograms as CSV lines
+ * name,count,avg [us],max [us],bucket 0,...,bucket TRACE_BUCKETS-1
+ * Writes only complete lines, call again with the updated index until it returns 0
+ * @param buffer
+ * 		Buffer for the text
+ * @param size
+ * 		Size of the buffer
+ * @param next
+ * 		Index of the first histogram to write, updated to the next histogram
+ * @return uint16_t
+ * 		Length of the text
+ */
+uint16_t traceCsv(char *buffer, uint16_t size, uint8_t &next)
+{
+	uint16_t len = 0;
+	while (next < TRACE_NUM)
+	{
+		traceHistogram *hist = &traceHist[next];
+		char line[192];
+		int lineLen = snprintf(line, sizeof(line), "%s,%lu,%lu,%lu", traceNames[next], (unsigned long)hist->count,
+							   (unsigned long)(hist->count != 0 ? hist->sum / hist->count : 0), (unsigned long)hist->max);
+		for (int idx = 0; idx < TRACE_BUCKETS; idx++)
+		{
+			lineLen += snprintf(&line[lineLen], sizeof(line) - lineLen, ",%lu", (unsigned long)hist->buckets[idx]);
+		}
+		lineLen += snprintf(&line[lineLen], sizeof(line) - lineLen, "\n");
+		if ((lineLen >= (int)sizeof(line)) || (lineLen >= (size - len)))
+		{
+			break;
+		}
+		memcpy(&buffer[len], line, lineLen);
+		len += lineLen;
+		next++;
+	}
+	if (len < size)
+	{
+		buffer[len] = 0;
+	}
+	return len;
+}
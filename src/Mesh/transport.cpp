@@ -0,0 +1,649 @@
+#include "main.h"
+
+/**
+ * Optional end-to-end reliable transport on top of the mesh.
+ * Messages are numbered per destination, up to TRANSPORT_WINDOW
+ * messages can be on the way to one destination. The receiver answers
+ * every message with a selective ACK (next expected number + bitmap
+ * of messages received beyond it). Messages are delivered to the
+ * application once, but not necessarily in order.
+ */
+
+/** Transport package types (first byte of the mesh payload) */
+#define TRANSPORT_DATA 1
+#define TRANSPORT_SACK 2
+
+/** Size of transport data header: type, seq, base */
+#define TRANSPORT_DATA_HEADER 5
+/** Size of transport SACK package: type, cumulative ACK, bitmap */
+#define TRANSPORT_SACK_SIZE 5
+
+/** Initial retransmission timeout */
+#define TRANSPORT_INITIAL_RTO 3000
+/** Min retransmission timeout */
+#define TRANSPORT_MIN_RTO 500
+/** Max retransmission timeout */
+#define TRANSPORT_MAX_RTO 30000
+/** Number of retransmissions before a message is reported as failed */
+#define TRANSPORT_RETRY 5
+/** Sequence gap that is treated as a new session of the sender */
+#define TRANSPORT_RESYNC 64
+/** Send queue slots the transport messages leave free for SACKs and forwarded packages */
+#define TRANSPORT_QUEUE_RESERVE 1
+
+/** Message waiting for a SACK */
+struct transportSlot
+{
+	boolean inUse;
+	uint16_t seq;
+	uint8_t retries;
+	uint8_t size;
+	time_t sentTime;
+	/** Retransmission timeout of the last transmission in ms */
+	int32_t rto;
+	uint8_t data[TRANSPORT_MAX_PAYLOAD];
+};
+
+/** Sender state per destination */
+struct transportTxPeer
+{
+	uint32_t nodeId;
+	uint16_t nextSeq;
+	/** Smoothed round trip time in ms */
+	int32_t srtt;
+	/** Round trip time variance in ms */
+	int32_t rttvar;
+	/** Retransmission timeout in ms */
+	int32_t rto;
+	/** Time of the last back off, messages sent before it timed out in the same event */
+	time_t backoffTime;
+	transportSlot slots[TRANSPORT_WINDOW];
+};
+
+/** Receiver state per source */
+struct transportRxPeer
+{
+	uint32_t nodeId;
+	/** Next expected sequence number */
+	uint16_t cumAck;
+	/** Bit n set if cumAck + 1 + n was received */
+	uint16_t bitmap;
+};
+
+/** Sender state table */
+transportTxPeer txPeers[TRANSPORT_PEERS];
+/** Receiver state table */
+transportRxPeer rxPeers[TRANSPORT_PEERS];
+/** Index of the next receiver state to be replaced */
+uint8_t rxPeerReplace = 0;
+
+/** Mux used to enter critical code part (access to transport tables) */
+SemaphoreHandle_t accessTransport = NULL;
+
+/** Transport callback variable */
+static MeshEvents_t *_TransportEvents;
+
+/** Finished messages, callbacks are called after the tables are released */
+struct transportResult
+{
+	uint32_t nodeId;
+	uint16_t seq;
+	boolean delivered;
+};
+
+/**
+ * Initialize the transport layer
+ * @param events
+ * 		Structure of event callbacks, DataAvailable and TransportDone are used
+ */
+void initTransport(MeshEvents_t *events)
+{
+	_TransportEvents = events;
+	memset(txPeers, 0, sizeof(txPeers));
+	memset(rxPeers, 0, sizeof(rxPeers));
+
+	// Create blocking semaphore for transport tables access
+	accessTransport = xSemaphoreCreateBinary();
+	xSemaphoreGive(accessTransport);
+}
+
+/**
+ * Send a message as transport data package
+ * @param peer
+ * 		Sender state of the destination
+ * @param slot
+ * 		Slot with the message
+ * @return bool
+ * 		True if the package could be queued
+ * 		False if the send queue has no room left
+ */
+static bool transportSendSlot(transportTxPeer *peer, transportSlot *slot)
+{
+	uint8_t pckg[TRANSPORT_DATA_HEADER + TRANSPORT_MAX_PAYLOAD];
+
+	// The window is paced by the send queue, a message is only queued after the last one left
+	if (uxQueueSpacesAvailable(sendQueue) <= TRANSPORT_QUEUE_RESERVE)
+	{
+		return false;
+	}
+
+	// Oldest message still waiting for an ACK
+	uint16_t base = slot->seq;
+	for (int idx = 0; idx < TRANSPORT_WINDOW; idx++)
+	{
+		if (peer->slots[idx].inUse && ((int16_t)(peer->slots[idx].seq - base) < 0))
+		{
+			base = peer->slots[idx].seq;
+		}
+	}
+
+	pckg[0] = TRANSPORT_DATA;
+	pckg[1] = slot->seq & 0xFF;
+	pckg[2] = slot->seq >> 8;
+	pckg[3] = base & 0xFF;
+	pckg[4] = base >> 8;
+	memcpy(&pckg[TRANSPORT_DATA_HEADER], slot->data, slot->size);
+
+	slot->sentTime = millis();
+	return sendToNode(peer->nodeId, pckg, TRANSPORT_DATA_HEADER + slot->size, LORA_FLAG_TRANSPORT);
+}
+
+/**
+ * Send a message with end-to-end acknowledgement
+ * The result is reported through the TransportDone callback
+ * @param nodeId
+ * 		Destination node
+ * @param data
+ * 		Message to be sent
+ * @param size
+ * 		Size of the message, max TRANSPORT_MAX_PAYLOAD
+ * @param msgId
+ * 		Pointer to an uint16_t to save the message ID to, can be NULL
+ * @return bool
+ * 		True if the message was accepted
+ * 		False if the window to the destination is full, the send queue has
+ * 		no room or no route is known
+ */
+bool transportSend(uint32_t nodeId, uint8_t *data, uint8_t size, uint16_t *msgId)
+{
+	if ((accessTransport == NULL) || (size > TRANSPORT_MAX_PAYLOAD))
+	{
+		return false;
+	}
+
+	if (xSemaphoreTake(accessTransport, (TickType_t)1000) != pdTRUE)
+	{
+		myLog_e("Could not access transport tables");
+		return false;
+	}
+
+	// Find the sender state of the destination or a free one
+	transportTxPeer *peer = NULL;
+	transportTxPeer *freePeer = NULL;
+	for (int idx = 0; idx < TRANSPORT_PEERS; idx++)
+	{
+		if (txPeers[idx].nodeId == nodeId)
+		{
+			peer = &txPeers[idx];
+			break;
+		}
+		if (freePeer == NULL)
+		{
+			boolean idle = true;
+			for (int slot = 0; slot < TRANSPORT_WINDOW; slot++)
+			{
+				idle &= !txPeers[idx].slots[slot].inUse;
+			}
+			if (idle)
+			{
+				freePeer = &txPeers[idx];
+			}
+		}
+	}
+	if (peer == NULL)
+	{
+		if (freePeer == NULL)
+		{
+			myLog_e("No free transport peer for %08X", nodeId);
+			xSemaphoreGive(accessTransport);
+			return false;
+		}
+		// Start a new session with a random sequence number
+		peer = freePeer;
+		peer->nodeId = nodeId;
+		peer->nextSeq = (uint16_t)random(0, 0xFFFF);
+		peer->srtt = 0;
+		peer->rttvar = 0;
+		peer->rto = TRANSPORT_INITIAL_RTO;
+		peer->backoffTime = millis();
+	}
+
+	// Find a free slot in the window
+	transportSlot *slot = NULL;
+	for (int idx = 0; idx < TRANSPORT_WINDOW; idx++)
+	{
+		if (!peer->slots[idx].inUse)
+		{
+			slot = &peer->slots[idx];
+			break;
+		}
+	}
+	if (slot == NULL)
+	{
+		myLog_w("Transport window to %08X is full", nodeId);
+		xSemaphoreGive(accessTransport);
+		return false;
+	}
+
+	slot->seq = peer->nextSeq;
+	slot->size = size;
+	slot->retries = 0;
+	memcpy(slot->data, data, size);
+
+	if (!transportSendSlot(peer, slot))
+	{
+		xSemaphoreGive(accessTransport);
+		return false;
+	}
+	slot->inUse = true;
+	slot->rto = peer->rto;
+	peer->nextSeq++;
+
+	if (msgId != NULL)
+	{
+		*msgId = slot->seq;
+	}
+	myLog_d("Transport msg #%d to %08X queued", slot->seq, nodeId);
+	xSemaphoreGive(accessTransport);
+	return true;
+}
+
+/**
+ * Update the retransmission timeout with a new round trip time sample
+ * @param peer
+ * 		Sender state of the destination
+ * @param rtt
+ * 		Measured round trip time in ms
+ */
+static void transportUpdateRto(transportTxPeer *peer, int32_t rtt)
+{
+	if (peer->srtt == 0)
+	{
+		peer->srtt = rtt;
+		peer->rttvar = rtt / 2;
+	}
+	else
+	{
+		int32_t delta = peer->srtt - rtt;
+		if (delta < 0)
+		{
+			delta = -delta;
+		}
+		peer->rttvar = (3 * peer->rttvar + delta) / 4;
+		peer->srtt = (7 * peer->srtt + rtt) / 8;
+	}
+	peer->rto = peer->srtt + 4 * peer->rttvar;
+	if (peer->rto < TRANSPORT_MIN_RTO)
+	{
+		peer->rto = TRANSPORT_MIN_RTO;
+	}
+	if (peer->rto > TRANSPORT_MAX_RTO)
+	{
+		peer->rto = TRANSPORT_MAX_RTO;
+	}
+}
+
+/**
+ * Report finished messages to the application
+ * @param results
+ * 		List of finished messages
+ * @param numResults
+ * 		Number of finished messages
+ */
+static void transportReport(transportResult *results, uint8_t numResults)
+{
+	for (int idx = 0; idx < numResults; idx++)
+	{
+		if ((_TransportEvents != NULL) && (_TransportEvents->TransportDone != NULL))
+		{
+			_TransportEvents->TransportDone(results[idx].nodeId, results[idx].seq, results[idx].delivered);
+		}
+	}
+}
+
+/**
+ * Handle a received SACK
+ * @param fromID
+ * 		Node that sent the SACK
+ * @param cumAck
+ * 		Next sequence number the receiver expects
+ * @param bitmap
+ * 		Bit n set if cumAck + 1 + n was received
+ */
+static void transportHandleSack(uint32_t fromID, uint16_t cumAck, uint16_t bitmap)
+{
+	transportResult results[TRANSPORT_WINDOW];
+	uint8_t numResults = 0;
+
+	if (xSemaphoreTake(accessTransport, (TickType_t)1000) != pdTRUE)
+	{
+		myLog_e("Could not access transport tables");
+		return;
+	}
+
+	for (int idx = 0; idx < TRANSPORT_PEERS; idx++)
+	{
+		if (txPeers[idx].nodeId != fromID)
+		{
+			continue;
+		}
+		transportTxPeer *peer = &txPeers[idx];
+		for (int slotIdx = 0; slotIdx < TRANSPORT_WINDOW; slotIdx++)
+		{
+			transportSlot *slot = &peer->slots[slotIdx];
+			if (!slot->inUse)
+			{
+				continue;
+			}
+			int16_t dist = (int16_t)(slot->seq - cumAck);
+			if ((dist < 0) || ((dist > 0) && (dist <= 16) && (bitmap & (1 << (dist - 1)))))
+			{
+				// Message was received
+				if (slot->retries == 0)
+				{
+					// Use only unambiguous samples for the round trip time
+					transportUpdateRto(peer, (int32_t)(millis() - slot->sentTime));
+				}
+				slot->inUse = false;
+				results[numResults].nodeId = fromID;
+				results[numResults].seq = slot->seq;
+				results[numResults].delivered = true;
+				numResults++;
+				myLog_d("Transport msg #%d to %08X delivered, RTO %ld", slot->seq, fromID, peer->rto);
+			}
+		}
+		break;
+	}
+	xSemaphoreGive(accessTransport);
+
+	transportReport(results, numResults);
+}
+
+/**
+ * Move the receive window over the message cumAck and all messages after it that arrived already
+ * @param peer
+ * 		Receiver state of the source
+ */
+static void transportAdvance(transportRxPeer *peer)
+{
+	peer->cumAck++;
+	while (true)
+	{
+		boolean received = (peer->bitmap & 1) != 0;
+		peer->bitmap >>= 1;
+		if (!received)
+		{
+			break;
+		}
+		peer->cumAck++;
+	}
+}
+
+/**
+ * Handle a received transport data package
+ * @param fromID
+ * 		Node that sent the package
+ * @param payload
+ * 		Transport package
+ * @param size
+ * 		Size of the transport package
+ * @param rssi
+ * 		Signal strength while the package was received
+ * @param snr
+ * 		Signal to noise ratio while the package was received
+ */
+static void transportHandleData(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	uint16_t seq = payload[1] | (payload[2] << 8);
+	uint16_t base = payload[3] | (payload[4] << 8);
+	boolean deliver = false;
+	uint8_t sack[TRANSPORT_SACK_SIZE];
+
+	if (xSemaphoreTake(accessTransport, (TickType_t)1000) != pdTRUE)
+	{
+		myLog_e("Could not access transport tables");
+		return;
+	}
+
+	// Find the receiver state of the source
+	transportRxPeer *peer = NULL;
+	for (int idx = 0; idx < TRANSPORT_PEERS; idx++)
+	{
+		if (rxPeers[idx].nodeId == fromID)
+		{
+			peer = &rxPeers[idx];
+			break;
+		}
+	}
+	if (peer == NULL)
+	{
+		// Replace the oldest receiver state
+		peer = &rxPeers[rxPeerReplace];
+		rxPeerReplace = (rxPeerReplace + 1) % TRANSPORT_PEERS;
+		peer->nodeId = fromID;
+		peer->cumAck = base;
+		peer->bitmap = 0;
+	}
+
+	int16_t baseDist = (int16_t)(base - peer->cumAck);
+	if ((baseDist > 0) || (baseDist < -TRANSPORT_RESYNC))
+	{
+		// Sender gave up on older messages or started a new session
+		boolean baseReceived = false;
+		if ((baseDist > 0) && (baseDist <= 16))
+		{
+			// Bit baseDist - 1 is the message base itself
+			baseReceived = (peer->bitmap & (1 << (baseDist - 1))) != 0;
+			peer->bitmap >>= baseDist;
+		}
+		else
+		{
+			peer->bitmap = 0;
+		}
+		peer->cumAck = base;
+		if (baseReceived)
+		{
+			transportAdvance(peer);
+		}
+	}
+
+	int16_t dist = (int16_t)(seq - peer->cumAck);
+	if (dist == 0)
+	{
+		deliver = true;
+		transportAdvance(peer);
+	}
+	else if ((dist > 0) && (dist <= 16))
+	{
+		if ((peer->bitmap & (1 << (dist - 1))) == 0)
+		{
+			deliver = true;
+			peer->bitmap |= (1 << (dist - 1));
+		}
+	}
+	else if (dist > 16)
+	{
+		// Out of window, let the sender retransmit
+		myLog_w("Transport msg #%d from %08X out of window", seq, fromID);
+		xSemaphoreGive(accessTransport);
+		return;
+	}
+
+	sack[0] = TRANSPORT_SACK;
+	sack[1] = peer->cumAck & 0xFF;
+	sack[2] = peer->cumAck >> 8;
+	sack[3] = peer->bitmap & 0xFF;
+	sack[4] = peer->bitmap >> 8;
+	xSemaphoreGive(accessTransport);
+
+	// Acknowledge duplicates as well, the last SACK might got lost
+	if (!sendToNode(fromID, sack, TRANSPORT_SACK_SIZE, LORA_FLAG_TRANSPORT))
+	{
+		myLog_e("Cannot send SACK to %08X", fromID);
+	}
+
+	if (deliver)
+	{
+		if ((_TransportEvents != NULL) && (_TransportEvents->DataAvailable != NULL))
+		{
+			_TransportEvents->DataAvailable(fromID, &payload[TRANSPORT_DATA_HEADER], size - TRANSPORT_DATA_HEADER, rssi, snr);
+		}
+	}
+	else
+	{
+		myLog_w("Got a duplicate transport msg #%d from %08X", seq, fromID);
+	}
+}
+
+/**
+ * Handle a received transport package
+ * Called by the mesh for packages with LORA_FLAG_TRANSPORT set
+ * @param fromID
+ * 		Node that sent the package
+ * @param payload
+ * 		Transport package
+ * @param size
+ * 		Size of the transport package
+ * @param rssi
+ * 		Signal strength while the package was received
+ * @param snr
+ * 		Signal to noise ratio while the package was received
+ */
+void transportRx(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	if (accessTransport == NULL)
+	{
+		return;
+	}
+
+	if ((payload[0] == TRANSPORT_SACK) && (size >= TRANSPORT_SACK_SIZE))
+	{
+		transportHandleSack(fromID, payload[1] | (payload[2] << 8), payload[3] | (payload[4] << 8));
+	}
+	else if ((payload[0] == TRANSPORT_DATA) && (size >= TRANSPORT_DATA_HEADER))
+	{
+		transportHandleData(fromID, payload, size, rssi, snr);
+	}
+	else
+	{
+		myLog_e("Invalid transport package from %08X", fromID);
+	}
+}
+
+/**
+ * Retransmit messages that were not acknowledged in time
+ * Called frequently by the mesh task
+ * @return int32_t
+ * 		Time in ms until the next retransmission is due
+ */
+int32_t transportHandler(void)
+{
+	int32_t nextTimeout = TRANSPORT_MAX_RTO;
+	transportResult results[TRANSPORT_PEERS * TRANSPORT_WINDOW];
+	uint8_t numResults = 0;
+
+	if (accessTransport == NULL)
+	{
+		return nextTimeout;
+	}
+
+	if (xSemaphoreTake(accessTransport, (TickType_t)10) != pdTRUE)
+	{
+		return 10;
+	}
+
+	for (int idx = 0; idx < TRANSPORT_PEERS; idx++)
+	{
+		transportTxPeer *peer = &txPeers[idx];
+		for (int slotIdx = 0; slotIdx < TRANSPORT_WINDOW; slotIdx++)
+		{
+			transportSlot *slot = &peer->slots[slotIdx];
+			if (!slot->inUse)
+			{
+				continue;
+			}
+			int32_t left = slot->rto - (int32_t)(millis() - slot->sentTime);
+			if (left <= 0)
+			{
+				if (slot->retries >= TRANSPORT_RETRY)
+				{
+					myLog_e("Transport msg #%d to %08X failed", slot->seq, peer->nodeId);
+					slot->inUse = false;
+					results[numResults].nodeId = peer->nodeId;
+					results[numResults].seq = slot->seq;
+					results[numResults].delivered = false;
+					numResults++;
+					continue;
+				}
+				// Messages sent before the last back off time out in the same event, back off once per event
+				if ((int32_t)(slot->sentTime - peer->backoffTime) >= 0)
+				{
+					peer->rto *= 2;
+					if (peer->rto > TRANSPORT_MAX_RTO)
+					{
+						peer->rto = TRANSPORT_MAX_RTO;
+					}
+					peer->backoffTime = millis();
+				}
+				time_t sentTime = slot->sentTime;
+				if (!transportSendSlot(peer, slot))
+				{
+					// Send queue is full, the message stays due and is tried again soon, this is not a retry
+					slot->sentTime = sentTime;
+					left = 100;
+				}
+				else
+				{
+					slot->retries++;
+					slot->rto = peer->rto;
+					myLog_w("Retransmit transport msg #%d to %08X, RTO %ld", slot->seq, peer->nodeId, peer->rto);
+					left = peer->rto;
+				}
+			}
+			if (left < nextTimeout)
+			{
+				nextTimeout = left;
+			}
+		}
+	}
+	xSemaphoreGive(accessTransport);
+
+	transportReport(results, numResults);
+	return nextTimeout;
+}
+
+/**
+ * Get the retransmission timeout to a destination
+ * @param nodeId
+ * 		Destination node
+ * @return int32_t
+ * 		Retransmission timeout in ms, -1 if there is no sender state for the node
+ */
+int32_t transportRto(uint32_t nodeId)
+{
+	int32_t rto = -1;
+	if ((accessTransport == NULL) || (xSemaphoreTake(accessTransport, (TickType_t)1000) != pdTRUE))
+	{
+		return rto;
+	}
+	for (int idx = 0; idx < TRANSPORT_PEERS; idx++)
+	{
+		if (txPeers[idx].nodeId == nodeId)
+		{
+			rto = txPeers[idx].rto;
+			break;
+		}
+	}
+	xSemaphoreGive(accessTransport);
+	return rto;
+}
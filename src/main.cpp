@@ -65,6 +65,228 @@ void ledOff(void)
 #endif
 }
 
+/** Buffer for a command line from Serial */
+char serialCmd[64];
+/** Length of the command line from Serial */
+uint8_t serialCmdLen = 0;
+/** Flag if a ping or traceroute waits for its result */
+bool echoWaiting = false;
+/** Flag if the ping or traceroute came over BLE UART */
+bool echoFromBle = false;
+
+/**
+ * Send a reply to Serial or BLE UART
+ * @param toBle
+ * 		True to send over BLE UART, false to send over Serial
+ * @param data
+ * 		Data to send
+ * @param len
+ * 		Size of the data
+ */
+void sendReply(bool toBle, char *data, size_t len)
+{
+	if (toBle)
+	{
+		if (bleUARTisConnected)
+		{
+			bleUartWrite(data, len);
+		}
+	}
+	else
+	{
+		Serial.write((uint8_t *)data, len);
+	}
+}
+
+/**
+ * Handle a command from Serial or BLE UART
+ * stats          statistics counters as CSV
+ * stats bin      statistics counters in binary format
+ * stats reset    reset the statistics counters
+ * trace          latency histograms as CSV
+ * trace reset    reset the latency histograms
+ * prof           task profiling and free stack as CSV
+ * prof reset     reset the task profiling
+ * telemetry      latest telemetry of the neighbors as CSV
+ * ping <id>      round trip time to a node, ID in hex
+ * traceroute <id> round trip time and path to a node, ID in hex
+ * @param cmd
+ * 		Command line without line end
+ * @param fromBle
+ * 		True if the command came over BLE UART
+ */
+void handleCommand(char *cmd, bool fromBle)
+{
+	if (strcmp(cmd, "stats") == 0)
+	{
+		// Split into chunks that fit into a BLE UART write
+		uint8_t next = 0;
+		while (next < STAT_NUM)
+		{
+			uint16_t len = meshStatsCsv(sendData, 240, next);
+			if (len == 0)
+			{
+				break;
+			}
+			sendReply(fromBle, sendData, len);
+		}
+	}
+	else if (strcmp(cmd, "stats bin") == 0)
+	{
+		uint16_t len = meshStatsBinary((uint8_t *)sendData, sizeof(sendData));
+		sendReply(fromBle, sendData, len);
+	}
+	else if (strcmp(cmd, "stats reset") == 0)
+	{
+		meshStatsReset();
+		int len = snprintf(sendData, 512, "Statistics reset\n");
+		sendReply(fromBle, sendData, len);
+	}
+	else if (strcmp(cmd, "trace") == 0)
+	{
+		uint8_t next = 0;
+		while (next < TRACE_NUM)
+		{
+			uint16_t len = traceCsv(sendData, 240, next);
+			if (len == 0)
+			{
+				break;
+			}
+			sendReply(fromBle, sendData, len);
+		}
+	}
+	else if (strcmp(cmd, "trace reset") == 0)
+	{
+		traceReset();
+		int len = snprintf(sendData, 512, "Latency histograms reset\n");
+		sendReply(fromBle, sendData, len);
+	}
+	else if (strcmp(cmd, "prof") == 0)
+	{
+		uint8_t next = 0;
+		while (true)
+		{
+			uint16_t len = profileCsv(sendData, 240, next);
+			if (len == 0)
+			{
+				break;
+			}
+			sendReply(fromBle, sendData, len);
+		}
+	}
+	else if (strcmp(cmd, "prof reset") == 0)
+	{
+		profileReset();
+		int len = snprintf(sendData, 512, "Profiling reset\n");
+		sendReply(fromBle, sendData, len);
+	}
+	else if ((strncmp(cmd, "ping ", 5) == 0) || (strncmp(cmd, "traceroute ", 11) == 0))
+	{
+		bool route = cmd[0] == 't';
+		uint32_t nodeId = strtoul(strchr(cmd, ' ') + 1, NULL, 16);
+		int len;
+		if (echoSend(nodeId, route))
+		{
+			// The result is reported by checkCommands()
+			echoWaiting = true;
+			echoFromBle = fromBle;
+			len = snprintf(sendData, 512, "%s %08lX\n", route ? "Traceroute to" : "Ping", (unsigned long)nodeId);
+		}
+		else
+		{
+			len = snprintf(sendData, 512, "Cannot send echo to %08lX\n", (unsigned long)nodeId);
+		}
+		sendReply(fromBle, sendData, len);
+	}
+	else if (strcmp(cmd, "telemetry") == 0)
+	{
+		uint8_t next = 0;
+		while (true)
+		{
+			uint16_t len = telemetryCsv(sendData, 240, next);
+			if (len == 0)
+			{
+				break;
+			}
+			sendReply(fromBle, sendData, len);
+		}
+	}
+	else
+	{
+		int len = snprintf(sendData, 512, "Unknown command %s\n", cmd);
+		sendReply(fromBle, sendData, len);
+	}
+}
+
+/**
+ * Check Serial and BLE UART for commands
+ */
+void checkCommands(void)
+{
+	while (Serial.available() > 0)
+	{
+		char c = Serial.read();
+		if ((c == '\n') || (c == '\r'))
+		{
+			if (serialCmdLen != 0)
+			{
+				serialCmd[serialCmdLen] = 0;
+				handleCommand(serialCmd, false);
+				serialCmdLen = 0;
+			}
+		}
+		else if (serialCmdLen < (sizeof(serialCmd) - 1))
+		{
+			serialCmd[serialCmdLen++] = c;
+		}
+	}
+
+	if (bleUartAvailable() > 0)
+	{
+		char bleCmd[64];
+		size_t len = bleUartRead(bleCmd, sizeof(bleCmd) - 1);
+		// Remove the line end
+		while ((len != 0) && ((bleCmd[len - 1] == '\n') || (bleCmd[len - 1] == '\r')))
+		{
+			len--;
+		}
+		bleCmd[len] = 0;
+		if (len != 0)
+		{
+			handleCommand(bleCmd, true);
+		}
+	}
+
+	if (echoWaiting)
+	{
+		echoResult result;
+		echoState state = echoGetResult(&result);
+		if (state == ECHO_DONE)
+		{
+			echoWaiting = false;
+			int len = snprintf(sendData, 512, "Reply from %08lX #%d rtt %lu ms\n", (unsigned long)result.nodeId, result.seq,
+							   (unsigned long)result.rtt);
+			sendReply(echoFromBle, sendData, len);
+			uint8_t next = 0;
+			while (true)
+			{
+				len = echoCsv(sendData, 240, next);
+				if (len == 0)
+				{
+					break;
+				}
+				sendReply(echoFromBle, sendData, len);
+			}
+		}
+		else if (state != ECHO_PENDING)
+		{
+			echoWaiting = false;
+			int len = snprintf(sendData, 512, "No echo reply\n");
+			sendReply(echoFromBle, sendData, len);
+		}
+	}
+}
+
 /**
  * Arduino setup
  */
@@ -80,6 +302,10 @@ void setup()
 
 	// Start Serial
 	Serial.begin(115200);
+#if MYLOG_DEFERRED > 0
+	// Start the task that prints the deferred log records
+	myLogInit();
+#endif
 
 // defined(_VARIANT_RAK4630_) || defined(ADAFRUIT)
 #if defined(_VARIANT_RAK4630_) || defined(ADAFRUIT)
@@ -136,6 +362,8 @@ void loop()
 {
 	delay(100);
 
+	checkCommands();
+
 	if ((millis() - sendRandom) >= 30000)
 	{
 		// Time to send a package
@@ -148,7 +376,7 @@ void loop()
 			// Prepare data
 			outData.mark1 = 'L';
 			outData.mark2 = 'o';
-			outData.mark3 = 'R';
+			outData.mark3 = DATA_MAGIC;
 			getNextBroadcastID();
 
 			outData.dest = getNextBroadcastID();
@@ -160,7 +388,7 @@ void loop()
 				int sendLen = snprintf(sendData, 512, "Queuing broadcast with id %08X\n", outData.dest);
 				bleUartWrite(sendData, sendLen);
 			}
-			int dataLen = MAP_HEADER_SIZE + sprintf((char *)outData.data, ">>BR from %08X<<", deviceID);
+			int dataLen = DATA_HEADER_SIZE + sprintf((char *)outData.data, ">>BR from %08X<<", deviceID);
 			// Add package to send queue
 			if (!addSendRequest(&outData, dataLen))
 			{
@@ -174,7 +402,7 @@ void loop()
 		}
 		else
 		{
-			if (xSemaphoreTake(accessNodeList, (TickType_t)1000) == pdTRUE)
+			if (nodeListTake((TickType_t)1000) == pdTRUE)
 			{
 				numElements = numOfNodes();
 				if (numOfNodes() >= 2)
@@ -182,15 +410,16 @@ void loop()
 					// Select random node to send a package
 					getRoute(nodeId[random(0, numElements)], &routeToNode);
 					// Release access to nodes list
-					xSemaphoreGive(accessNodeList);
+					nodeListGive();
 					// Prepare data
 					outData.mark1 = 'L';
 					outData.mark2 = 'o';
-					outData.mark3 = 'R';
+					outData.mark3 = DATA_MAGIC;
 					if (routeToNode.firstHop != 0)
 					{
 						outData.dest = routeToNode.firstHop;
 						outData.from = routeToNode.nodeId;
+						outData.orig = deviceID;
 						outData.type = LORA_FORWARD;
 						Serial.printf("Queuing msg to hop to %08X over %08X\n", outData.from, outData.dest);
 						if (bleUARTisConnected)
@@ -203,6 +432,7 @@ void loop()
 					{
 						outData.dest = routeToNode.nodeId;
 						outData.from = deviceID;
+						outData.orig = deviceID;
 						outData.type = LORA_DIRECT;
 						Serial.printf("Queuing msg direct to %08X\n", outData.dest);
 						if (bleUARTisConnected)
@@ -211,7 +441,7 @@ void loop()
 							bleUartWrite(sendData, sendLen);
 						}
 					}
-					int dataLen = MAP_HEADER_SIZE + sprintf((char *)outData.data, ">>%08X<<", deviceID);
+					int dataLen = DATA_HEADER_SIZE + sprintf((char *)outData.data, ">>%08X<<", deviceID);
 					// Add package to send queue
 					if (!addSendRequest(&outData, dataLen))
 					{
@@ -226,7 +456,7 @@ void loop()
 				else
 				{
 					// Release access to nodes list
-					xSemaphoreGive(accessNodeList);
+					nodeListGive();
 					myLog_d("Not enough nodes in the list");
 				}
 			}
@@ -242,7 +472,7 @@ void loop()
 		// Nodes list changed, update display and report it
 		nodesListChanged = false;
 		Serial.println("---------------------------------------------");
-		if (xSemaphoreTake(accessNodeList, (TickType_t)1000) == pdTRUE)
+		if (nodeListTake((TickType_t)1000) == pdTRUE)
 		{
 			numElements = numOfNodes();
 #ifdef HAS_DISPLAY
@@ -257,7 +487,7 @@ void loop()
 				getNode(idx, nodeId[idx], firstHop[idx], numHops[idx]);
 			}
 			// Release access to nodes list
-			xSemaphoreGive(accessNodeList);
+			nodeListGive();
 			// Display the nodes
 			Serial.printf("%d nodes in the map\n", numElements + 1);
 			Serial.printf("Node #01 id: %08X\n", deviceID);
@@ -9,6 +9,8 @@
 #include "nrf_timer.h"
 #include "nrf52Timer.h"
 #include <Log/my-log_nrf52.h>
+#elif defined(MESH_NATIVE)
+#include <Log/my-log_nrf52.h>
 #endif
 
 extern uint32_t deviceID;
@@ -19,6 +21,21 @@ extern uint32_t deviceID;
 #define LORA_FORWARD 2
 #define LORA_BROADCAST 3
 #define LORA_NODEMAP 4
+#define LORA_ACK 5
+#define LORA_RATE 6
+#define LORA_ECHO 7
+#define LORA_ECHO_REPLY 8
+
+/** Mask for the package type in the type byte */
+#define LORA_TYPE_MASK 0x0F
+/** Flag in the type byte, sender requests a link ACK */
+#define LORA_FLAG_ACK_REQ 0x80
+/** Flag in the type byte, payload is a transport package */
+#define LORA_FLAG_TRANSPORT 0x40
+/** Flag in the type byte, payload is a fragment of a larger message */
+#define LORA_FLAG_FRAGMENT 0x20
+/** Flag in the type byte, payload is compressed */
+#define LORA_FLAG_COMPRESSED 0x10
 
 // BLE
 #include "BLE/ble_uart.h"
@@ -0,0 +1,192 @@
+#ifndef __MESH_PEER_H__
+#define __MESH_PEER_H__
+
+/**
+ * Mesh under test with a simulated peer, shared by the test suites
+ * The test program runs the mesh as node 0 of the simulation, the peer
+ * is node 1 (see simPeerInit()). The peer has no mesh, the tests send
+ * and receive raw packages with it. It answers link ACK requests like
+ * a mesh node would.
+ */
+
+#include "main.h"
+
+/** Node IDs like in the node program of the simulation */
+#define TEST_NODE_ID 0x5A000101
+#define PEER_ID 0x5A000202
+
+/**
+ * Start the mesh and the peer
+ * @param events
+ * 		Mesh callbacks
+ * @return bool
+ * 		False if the simulated radios could not be started or the mesh
+ * 		did not send its first map
+ */
+static inline bool peerStart(MeshEvents_t *events)
+{
+	deviceID = TEST_NODE_ID;
+	if (!simRadioInit(0, 2, NULL) || !simPeerInit(1))
+	{
+		return false;
+	}
+	initMesh(events, 48);
+	// The mesh sends its map right after the start, it listens afterwards
+	uint8_t buffer[256];
+	return simPeerReceive(buffer, 2000) > 0;
+}
+
+/**
+ * Send a package from the peer
+ * Waits the turnaround time first, the mesh restarts RX after every
+ * package it sent or received.
+ */
+static inline void peerSend(uint8_t *buffer, uint8_t size)
+{
+	delay(LINK_ACK_TURNAROUND);
+	simPeerSend(buffer, size);
+}
+
+/**
+ * Send a map of the peer, the mesh adds the peer as direct node
+ * @return bool
+ * 		False if the mesh did not add the peer
+ */
+static inline bool peerSendMap(void)
+{
+	mapMsg map;
+	map.type = LORA_NODEMAP;
+	map.from = PEER_ID;
+	mapFrame<uint8_t>((uint8_t *)&map, sizeof(map)).setEndMarker(0);
+	peerSend((uint8_t *)&map, MAP_HEADER_SIZE + FRAME_MAP_ENTRY);
+	delay(100);
+	return numOfNodes() == 1;
+}
+
+/**
+ * Send a direct data package from the peer to the mesh
+ * @param flags
+ * 		Flags of the type byte
+ * @param data
+ * 		Payload
+ * @param size
+ * 		Size of the payload
+ */
+static inline void peerSendData(uint8_t flags, uint8_t *data, uint8_t size)
+{
+	dataMsg msg;
+	msg.type = LORA_DIRECT | flags;
+	msg.dest = TEST_NODE_ID;
+	msg.from = PEER_ID;
+	msg.orig = PEER_ID;
+	msg.hop = PEER_ID;
+	memcpy(msg.data, data, size);
+	peerSend((uint8_t *)&msg, DATA_HEADER_SIZE + size);
+}
+
+/**
+ * Full ID of a short address of the mesh or the peer
+ */
+static inline uint32_t peerFullAddress(uint16_t idShort)
+{
+	return idShort == shortAddress(PEER_ID) ? PEER_ID : (idShort == shortAddress(TEST_NODE_ID) ? TEST_NODE_ID : 0);
+}
+
+/**
+ * Convert a received package in place into a package with full header and uncompressed payload
+ * @param buffer
+ * 		Package, 256 bytes buffer
+ * @param size
+ * 		Size of the package
+ * @return int16_t
+ * 		Size of the converted package
+ */
+static inline int16_t peerDecode(uint8_t *buffer, int16_t size)
+{
+	uint8_t pckg[DATA_MAX_SIZE];
+	if ((size >= COMPACT_HEADER_SIZE) && (buffer[0] != 'L'))
+	{
+		// Compact header, only the mesh and the peer are known
+		dataMsg msg;
+		msg.type = buffer[1];
+		msg.dest = peerFullAddress(buffer[2] | (buffer[3] << 8));
+		msg.from = peerFullAddress(buffer[4] | (buffer[5] << 8));
+		msg.orig = peerFullAddress(buffer[6] | (buffer[7] << 8));
+		msg.hop = peerFullAddress(buffer[8] | (buffer[9] << 8));
+		msg.seq = buffer[COMPACT_HEADER_SIZE - 2];
+		msg.ttl = buffer[COMPACT_HEADER_SIZE - 1];
+		memcpy(msg.data, &buffer[COMPACT_HEADER_SIZE], size - COMPACT_HEADER_SIZE);
+		size = size - COMPACT_HEADER_SIZE + DATA_HEADER_SIZE;
+		memcpy(buffer, &msg, size);
+	}
+	dataFrame<uint8_t> frame(buffer, size);
+	if (frame.valid() && ((frame.type() & LORA_FLAG_COMPRESSED) != 0))
+	{
+		int16_t len = meshDecompress(frame.payload(), frame.payloadSize(), pckg, DATA_MAX_SIZE);
+		if ((len >= 0) && ((DATA_HEADER_SIZE + len) <= 256))
+		{
+			frame.setType(frame.type() & ~LORA_FLAG_COMPRESSED);
+			memcpy(frame.payload(), pckg, len);
+			size = DATA_HEADER_SIZE + len;
+		}
+	}
+	return size;
+}
+
+/**
+ * Receive the next package the mesh sent
+ * Compact headers and compressed payloads are converted.
+ * Packages to the peer that request a link ACK are acknowledged.
+ * @param buffer
+ * 		Buffer for the package, 256 bytes
+ * @param timeout
+ * 		Max time to wait [ms]
+ * @return int16_t
+ * 		Size of the package, -1 after the timeout
+ */
+static inline int16_t peerReceive(uint8_t *buffer, uint32_t timeout)
+{
+	int16_t airSize = simPeerReceive(buffer, timeout);
+	if (airSize < 0)
+	{
+		return -1;
+	}
+	int16_t size = peerDecode(buffer, airSize);
+	dataFrame<uint8_t> frame(buffer, size);
+	if (frame.valid() && (frame.dest() == PEER_ID) && ((frame.type() & LORA_FLAG_ACK_REQ) != 0))
+	{
+		ackMsg ack;
+		ack.dest = frame.hop();
+		ack.from = PEER_ID;
+		ack.seq = frame.seq();
+		peerSend((uint8_t *)&ack, ACK_MSG_SIZE);
+	}
+	return size;
+}
+
+/**
+ * Receive the next transport package to the peer, other packages are skipped
+ * @param buffer
+ * 		Buffer for the package, 256 bytes
+ * @param timeout
+ * 		Max time to wait [ms]
+ * @return dataFrame<uint8_t>
+ * 		Data frame of the transport package, invalid after the timeout
+ */
+static inline dataFrame<uint8_t> peerReceiveTransport(uint8_t *buffer, uint32_t timeout)
+{
+	uint32_t start = millis();
+	while ((millis() - start) < timeout)
+	{
+		int16_t size = peerReceive(buffer, timeout - (millis() - start));
+		dataFrame<uint8_t> frame(buffer, size < 0 ? 0 : size);
+		if (frame.valid() && (frame.msgType() == LORA_DIRECT) && (frame.dest() == PEER_ID) &&
+			((frame.type() & LORA_FLAG_TRANSPORT) != 0))
+		{
+			return frame;
+		}
+	}
+	return dataFrame<uint8_t>(buffer, 0);
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "main.h"
+#include <unity.h>
+
+/**
+ * Payload compression tests
+ * Compresses typical payloads and reports the ratio and time, checks
+ * random round trips and that the decoder rejects garbage.
+ */
+
+/** Number of random payloads for the round trip and garbage tests */
+#define COMPRESS_RUNS 200000
+/** Number of compressions per sample for the time */
+#define COMPRESS_BENCH 100000
+
+/** Output buffer, the size fits into the uint8_t of meshCompress */
+static uint8_t out[255];
+static uint8_t back[256];
+
+/**
+ * Compress a sample, check the round trip and report size and time
+ * @param name
+ * 		Name of the sample
+ * @param text
+ * 		Sample payload
+ * @return uint8_t
+ * 		Compressed size, 0 if sent uncompressed
+ */
+static uint8_t checkSample(const char *name, const char *text)
+{
+	uint8_t len = strlen(text);
+	uint8_t size = meshCompress((uint8_t *)text, len, out, sizeof(out));
+	if (size != 0)
+	{
+		TEST_ASSERT_TRUE(size < len);
+		TEST_ASSERT_EQUAL(len, meshDecompress(out, size, back, sizeof(back)));
+		TEST_ASSERT_EQUAL_MEMORY(text, back, len);
+	}
+
+	uint32_t start = micros();
+	volatile uint32_t sink = 0;
+	for (int idx = 0; idx < COMPRESS_BENCH; idx++)
+	{
+		sink += meshCompress((uint8_t *)text, len, out, sizeof(out));
+	}
+	uint32_t elapsed = micros() - start;
+
+	char msg[120];
+	if (size != 0)
+	{
+		snprintf(msg, sizeof(msg), "%s: %d -> %d bytes, %lu ns", name, len, size,
+				 (unsigned long)((uint64_t)elapsed * 1000 / COMPRESS_BENCH));
+	}
+	else
+	{
+		snprintf(msg, sizeof(msg), "%s: %d bytes sent uncompressed", name, len);
+	}
+	TEST_MESSAGE(msg);
+	return size;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_samples(void)
+{
+	// Too short and without repetitions
+	TEST_ASSERT_EQUAL(0, checkSample("node ID", ">>5A000101<<"));
+	// Sensor record as JSON
+	checkSample("JSON record",
+				"{\"id\":\"5A000101\",\"temp\":21.5,\"hum\":48.2,\"press\":1013.2,\"bat\":3.91,\"rssi\":-87,\"snr\":9,\"seq\":1234}");
+	// Repeated keys compress well
+	uint8_t size = checkSample("key=value", "temp=21.5;temp=21.6;temp=21.6;temp=21.7;temp=21.7;temp=21.8;"
+											"temp=21.8;temp=21.9;temp=21.9;temp=22.0;");
+	TEST_ASSERT_TRUE((size != 0) && (size < 50));
+}
+
+void test_random_round_trip(void)
+{
+	uint8_t in[255];
+	randomSeed(1);
+	for (uint32_t run = 0; run < COMPRESS_RUNS; run++)
+	{
+		uint8_t len = random(1, sizeof(in) + 1);
+		// Few symbols, so matches are found
+		uint8_t symbols = random(1, 256);
+		for (int idx = 0; idx < len; idx++)
+		{
+			in[idx] = random(0, symbols);
+		}
+		uint8_t size = meshCompress(in, len, out, sizeof(out));
+		if (size != 0)
+		{
+			TEST_ASSERT_EQUAL(len, meshDecompress(out, size, back, sizeof(back)));
+			TEST_ASSERT_EQUAL_MEMORY(in, back, len);
+		}
+	}
+}
+
+void test_garbage_rejected(void)
+{
+	uint8_t in[255];
+	randomSeed(2);
+	for (uint32_t run = 0; run < COMPRESS_RUNS; run++)
+	{
+		uint8_t len = random(1, sizeof(in) + 1);
+		for (int idx = 0; idx < len; idx++)
+		{
+			in[idx] = random(0, 256);
+		}
+		// Must stay within the buffer, the result is either invalid or fits
+		int16_t size = meshDecompress(in, len, back, 64);
+		TEST_ASSERT_TRUE((size == -1) || ((size >= 0) && (size <= 64)));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_samples);
+	RUN_TEST(test_random_round_trip);
+	RUN_TEST(test_garbage_rejected);
+	return UNITY_END();
+}
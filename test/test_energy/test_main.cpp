@@ -0,0 +1,117 @@
+#include "../mesh_peer.h"
+#include <unity.h>
+
+/**
+ * Radio energy accounting tests against the simulated peer
+ * The simulated radio takes the LoRa time on air for every package, so
+ * the accounted TX time must match it and the charge must follow the
+ * currents of the modes.
+ */
+
+/** Number of packages sent by the TX test */
+#define ENERGY_PACKAGES 10
+
+/** Current of the RX duty cycle [uA], like radio.cpp */
+#define ENERGY_CURRENT_RX_DUTY                                                                                         \
+	(((uint64_t)RADIO_CURRENT_RX * RX_DUTY_RX_STEPS + (uint64_t)RADIO_CURRENT_SLEEP * RX_DUTY_SLEEP_STEPS) /           \
+	 (RX_DUTY_RX_STEPS + RX_DUTY_SLEEP_STEPS))
+
+static MeshEvents_t events;
+
+/** Sum of the accounted mode times [ms] */
+static uint32_t modeTimeSum(void)
+{
+	return meshStatGet(STAT_RADIO_TX_MS) + meshStatGet(STAT_RADIO_RX_MS) + meshStatGet(STAT_RADIO_RX_DUTY_MS) +
+		   meshStatGet(STAT_RADIO_CAD_MS) + meshStatGet(STAT_RADIO_STANDBY_MS);
+}
+
+/** Charge from the accounted mode times [uA * ms] */
+static uint64_t expectedCharge(void)
+{
+	return (uint64_t)meshStatGet(STAT_RADIO_TX_MS) * RADIO_CURRENT_TX +
+		   (uint64_t)meshStatGet(STAT_RADIO_RX_MS) * RADIO_CURRENT_RX +
+		   (uint64_t)meshStatGet(STAT_RADIO_RX_DUTY_MS) * ENERGY_CURRENT_RX_DUTY +
+		   (uint64_t)meshStatGet(STAT_RADIO_CAD_MS) * RADIO_CURRENT_CAD +
+		   (uint64_t)meshStatGet(STAT_RADIO_STANDBY_MS) * RADIO_CURRENT_STANDBY;
+}
+
+void setUp(void)
+{
+	meshStatsReset();
+}
+
+void tearDown(void)
+{
+}
+
+void test_idle_accounting(void)
+{
+	uint32_t start = millis();
+	delay(2000);
+	uint32_t elapsed = millis() - start;
+
+	// Every microsecond is accounted in exactly one mode
+	TEST_ASSERT_UINT32_WITHIN(10, elapsed, modeTimeSum());
+	TEST_ASSERT_EQUAL(0, meshStatGet(STAT_RADIO_TX_MS));
+
+	// Without traffic the radio listens, the average current is between RX duty cycle and RX
+	uint32_t average = meshStatGet(STAT_RADIO_UAH_PER_HOUR);
+	TEST_ASSERT_TRUE(average >= ENERGY_CURRENT_RX_DUTY - 1);
+	TEST_ASSERT_TRUE(average <= RADIO_CURRENT_RX);
+	TEST_ASSERT_UINT32_WITHIN(average / 100 + 1, expectedCharge() / modeTimeSum(), average);
+	TEST_ASSERT_EQUAL(0, meshStatGet(STAT_RADIO_UJ_PER_PACKET));
+}
+
+void test_tx_accounting(void)
+{
+	uint8_t buffer[256];
+	uint8_t data[4] = {1, 2, 3, 4};
+	uint32_t start = millis();
+	for (int idx = 0; idx < ENERGY_PACKAGES; idx++)
+	{
+		TEST_ASSERT_TRUE(sendToNode(PEER_ID, data, sizeof(data), 0));
+		TEST_ASSERT_TRUE(peerReceive(buffer, 2000) > 0);
+		// Wait for the link ACK to be received
+		delay(100);
+	}
+	uint32_t elapsed = millis() - start;
+	uint32_t packets = meshStatGet(STAT_TX_DONE);
+	TEST_ASSERT_EQUAL(ENERGY_PACKAGES, packets);
+
+	// TX time is the time on air of the packages with compact header, the radio thread adds a little
+	uint32_t onAir = meshTimeOnAirUs(COMPACT_HEADER_SIZE + sizeof(data));
+	uint32_t txMs = meshStatGet(STAT_RADIO_TX_MS);
+	TEST_ASSERT_UINT32_WITHIN(2 * ENERGY_PACKAGES, packets * onAir / 1000, txMs);
+	TEST_ASSERT_TRUE(meshStatGet(STAT_RADIO_CAD_MS) > 0);
+	TEST_ASSERT_UINT32_WITHIN(10, elapsed, modeTimeSum());
+
+	// Charge and average current follow the currents of the modes
+	uint64_t charge = expectedCharge();
+	uint32_t average = meshStatGet(STAT_RADIO_UAH_PER_HOUR);
+	TEST_ASSERT_UINT32_WITHIN(average / 100 + 1, charge / modeTimeSum(), average);
+	TEST_ASSERT_UINT32_WITHIN(1, charge / 3600000, meshStatGet(STAT_RADIO_CHARGE_UAH));
+
+	// Energy of TX and CAD per sent package
+	uint64_t txCharge = (uint64_t)txMs * RADIO_CURRENT_TX + (uint64_t)meshStatGet(STAT_RADIO_CAD_MS) * RADIO_CURRENT_CAD;
+	uint32_t expected = txCharge * RADIO_VOLTAGE / packets / 1000000;
+	uint32_t perPacket = meshStatGet(STAT_RADIO_UJ_PER_PACKET);
+	TEST_ASSERT_UINT32_WITHIN(expected / 20 + 1, expected, perPacket);
+
+	char text[80];
+	snprintf(text, sizeof(text), "TX %lu ms, %lu uJ per package, average %lu uA", (unsigned long)txMs,
+			 (unsigned long)perPacket, (unsigned long)average);
+	TEST_MESSAGE(text);
+}
+
+int main(int argc, char **argv)
+{
+	if (!peerStart(&events) || !peerSendMap())
+	{
+		return 1;
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(test_idle_accounting);
+	RUN_TEST(test_tx_accounting);
+	return UNITY_END();
+}
@@ -0,0 +1,130 @@
+#include "../mesh_peer.h"
+#include <unity.h>
+
+/**
+ * Fragmentation tests against the simulated peer
+ * The peer sends fragments to the mesh, or the mesh sends a large
+ * message to the peer while other packages are queued.
+ */
+
+/** Fragment header and sizes, see fragment.cpp */
+#define FRAGMENT_HEADER_SIZE 5
+#define FRAGMENT_DATA_SIZE (DATA_MAX_SIZE - FRAGMENT_HEADER_SIZE)
+
+static MeshEvents_t events;
+/** Number and size of the messages delivered to the application */
+static volatile int delivered = 0;
+static volatile uint16_t deliveredSize = 0;
+static volatile bool deliveredOk = false;
+
+static void onDataAvailable(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	delivered++;
+	deliveredSize = size;
+	deliveredOk = true;
+	for (int idx = 0; idx < size; idx++)
+	{
+		deliveredOk &= payload[idx] == (uint8_t)idx;
+	}
+}
+
+/**
+ * Send a fragment of a message with the bytes 0, 1, 2, ... from the peer
+ * @param msgId
+ * 		Message ID
+ * @param fragIdx
+ * 		Index of the fragment
+ * @param numFrags
+ * 		Number of fragments of the message
+ * @param msgSize
+ * 		Size of the message
+ * @param fragSize
+ * 		Size of the data in the fragment
+ */
+static void sendFragment(uint8_t msgId, uint8_t fragIdx, uint8_t numFrags, uint16_t msgSize, uint16_t fragSize)
+{
+	uint8_t pckg[FRAGMENT_HEADER_SIZE + FRAGMENT_DATA_SIZE];
+	pckg[0] = msgId;
+	pckg[1] = fragIdx;
+	pckg[2] = numFrags;
+	pckg[3] = msgSize & 0xFF;
+	pckg[4] = msgSize >> 8;
+	for (int idx = 0; idx < fragSize; idx++)
+	{
+		pckg[FRAGMENT_HEADER_SIZE + idx] = (uint8_t)(fragIdx * FRAGMENT_DATA_SIZE + idx);
+	}
+	peerSendData(LORA_FLAG_FRAGMENT, pckg, FRAGMENT_HEADER_SIZE + fragSize);
+	delay(100);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_reassembly(void)
+{
+	delivered = 0;
+	sendFragment(1, 1, 2, FRAGMENT_DATA_SIZE + 10, 10);
+	sendFragment(1, 0, 2, FRAGMENT_DATA_SIZE + 10, FRAGMENT_DATA_SIZE);
+	TEST_ASSERT_EQUAL(1, delivered);
+	TEST_ASSERT_EQUAL(FRAGMENT_DATA_SIZE + 10, deliveredSize);
+	TEST_ASSERT_TRUE(deliveredOk);
+}
+
+void test_short_fragment_rejected(void)
+{
+	delivered = 0;
+	// A first fragment of 10 bytes would leave a gap in the message
+	sendFragment(2, 0, 2, FRAGMENT_DATA_SIZE + 10, 10);
+	sendFragment(2, 1, 2, FRAGMENT_DATA_SIZE + 10, 10);
+	TEST_ASSERT_EQUAL(0, delivered);
+
+	// The complete first fragment finishes the message
+	sendFragment(2, 0, 2, FRAGMENT_DATA_SIZE + 10, FRAGMENT_DATA_SIZE);
+	TEST_ASSERT_EQUAL(1, delivered);
+	TEST_ASSERT_TRUE(deliveredOk);
+}
+
+void test_queue_slot_left_free(void)
+{
+	static uint8_t msg[FRAGMENT_MAX_SIZE];
+	uint8_t buffer[256];
+	uint32_t queueFull = meshStatGet(STAT_QUEUE_FULL);
+
+	// The peer does not ACK, the fragments wait long in the queue
+	TEST_ASSERT_TRUE(fragmentSend(PEER_ID, msg, sizeof(msg)));
+	uint32_t start = millis();
+	UBaseType_t minSpaces = SEND_QUEUE_SIZE;
+	while ((millis() - start) < 2000)
+	{
+		UBaseType_t spaces = uxQueueSpacesAvailable(sendQueue);
+		minSpaces = spaces < minSpaces ? spaces : minSpaces;
+		simPeerReceive(buffer, 10);
+	}
+	TEST_ASSERT_EQUAL(1, minSpaces);
+	// Waiting for room in the queue is not a full queue
+	TEST_ASSERT_EQUAL(queueFull, meshStatGet(STAT_QUEUE_FULL));
+
+	// Other packages still get into the queue
+	uint8_t data[4] = {1, 2, 3, 4};
+	TEST_ASSERT_TRUE(sendToNode(PEER_ID, data, sizeof(data), 0));
+}
+
+int main(int argc, char **argv)
+{
+	events.DataAvailable = onDataAvailable;
+	if (!peerStart(&events) || !peerSendMap())
+	{
+		return 1;
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(test_reassembly);
+	RUN_TEST(test_short_fragment_rejected);
+	RUN_TEST(test_queue_slot_left_free);
+	return UNITY_END();
+}
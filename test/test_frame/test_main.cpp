@@ -0,0 +1,226 @@
+#include "main.h"
+#include <unity.h>
+
+/**
+ * Frame view tests
+ * Parses frames built byte by byte and with the structs, checks that
+ * short and malformed frames are rejected, and measures the time to
+ * check and parse a received data package.
+ */
+
+/** Number of packages parsed by the benchmark */
+#define BENCH_PACKAGES 1000000
+
+/**
+ * Build a data frame with the structs
+ * @return uint16_t
+ * 		Size of the frame
+ */
+static uint16_t buildData(uint8_t *buffer, uint8_t payloadSize)
+{
+	dataMsg msg;
+	msg.type = LORA_FORWARD | LORA_FLAG_ACK_REQ;
+	msg.dest = 0x11223344;
+	msg.from = 0x55667788;
+	msg.orig = 0x99AABBCC;
+	msg.hop = 0xDDEEFF00;
+	msg.seq = 42;
+	msg.ttl = 7;
+	for (int idx = 0; idx < payloadSize; idx++)
+	{
+		msg.data[idx] = idx;
+	}
+	memcpy(buffer, &msg, DATA_HEADER_SIZE + payloadSize);
+	return DATA_HEADER_SIZE + payloadSize;
+}
+
+/**
+ * Check and parse a received frame like meshRxProcess()
+ * @return uint32_t
+ * 		Sum of the parsed fields, 0 if the frame is invalid
+ */
+static uint32_t parseFrame(uint8_t *buffer, uint16_t size)
+{
+	frameView<uint8_t> frame(buffer, size);
+	if (!frame.valid(FRAME_FROM + 4))
+	{
+		return 0;
+	}
+	switch (frame.msgType())
+	{
+	case LORA_DIRECT:
+	case LORA_FORWARD:
+	case LORA_BROADCAST:
+	{
+		dataFrame<uint8_t> data(buffer, size);
+		if (!data.valid())
+		{
+			return 0;
+		}
+		return data.dest() + data.from() + data.orig() + data.hop() + data.seq() + data.ttl() + data.payloadSize();
+	}
+	case LORA_ACK:
+	{
+		ackFrame<uint8_t> ack(buffer, size);
+		return ack.valid() ? ack.dest() + ack.from() + ack.seq() : 0;
+	}
+	default:
+		return 0;
+	}
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_data_fields(void)
+{
+	uint8_t buffer[256];
+	uint16_t size = buildData(buffer, 10);
+	dataFrame<uint8_t> frame(buffer, size);
+	TEST_ASSERT_TRUE(frame.valid());
+	TEST_ASSERT_EQUAL(LORA_FORWARD, frame.msgType());
+	TEST_ASSERT_EQUAL(LORA_FORWARD | LORA_FLAG_ACK_REQ, frame.type());
+	TEST_ASSERT_EQUAL_HEX32(0x11223344, frame.dest());
+	TEST_ASSERT_EQUAL_HEX32(0x55667788, frame.from());
+	TEST_ASSERT_EQUAL_HEX32(0x99AABBCC, frame.orig());
+	TEST_ASSERT_EQUAL_HEX32(0xDDEEFF00, frame.hop());
+	TEST_ASSERT_EQUAL(42, frame.seq());
+	TEST_ASSERT_EQUAL(7, frame.ttl());
+	TEST_ASSERT_EQUAL(10, frame.payloadSize());
+	TEST_ASSERT_EQUAL(9, frame.payload()[9]);
+}
+
+void test_data_little_endian(void)
+{
+	uint8_t buffer[DATA_HEADER_SIZE] = {'L', 'o', DATA_MAGIC, LORA_DIRECT};
+	dataFrame<uint8_t> frame(buffer, sizeof(buffer));
+	frame.setDest(0x01020304);
+	frame.setHop(0xA1B2C3D4);
+	TEST_ASSERT_EQUAL_HEX8(0x04, buffer[FRAME_DEST]);
+	TEST_ASSERT_EQUAL_HEX8(0x01, buffer[FRAME_DEST + 3]);
+	TEST_ASSERT_EQUAL_HEX8(0xD4, buffer[FRAME_HOP]);
+	TEST_ASSERT_EQUAL_HEX8(0xA1, buffer[FRAME_HOP + 3]);
+	TEST_ASSERT_EQUAL_HEX32(0x01020304, frame.dest());
+}
+
+void test_data_rejected(void)
+{
+	uint8_t buffer[256];
+	uint16_t size = buildData(buffer, 0);
+	TEST_ASSERT_TRUE(dataFrame<uint8_t>(buffer, size).valid());
+	// Header cut off
+	TEST_ASSERT_FALSE(dataFrame<uint8_t>(buffer, size - 1).valid());
+	TEST_ASSERT_FALSE(dataFrame<uint8_t>(buffer, 0).valid());
+	// Magic of the data frames of older firmware, the header is converted before
+	buffer[2] = 'R';
+	TEST_ASSERT_FALSE(dataFrame<uint8_t>(buffer, size).valid());
+	// Wrong magic
+	buffer[2] = 'X';
+	TEST_ASSERT_FALSE(dataFrame<uint8_t>(buffer, size).valid());
+	TEST_ASSERT_EQUAL(0, parseFrame(buffer, size));
+}
+
+void test_ack_and_rate(void)
+{
+	ackMsg ack;
+	ack.dest = 0x01020304;
+	ack.from = 0x05060708;
+	ack.seq = 9;
+	ackFrame<uint8_t> ackView((uint8_t *)&ack, ACK_MSG_SIZE);
+	TEST_ASSERT_TRUE(ackView.valid());
+	TEST_ASSERT_EQUAL_HEX32(0x01020304, ackView.dest());
+	TEST_ASSERT_EQUAL(9, ackView.seq());
+	TEST_ASSERT_FALSE(ackFrame<uint8_t>((uint8_t *)&ack, ACK_MSG_SIZE - 1).valid());
+
+	rateMsg rate;
+	rate.sf = 9;
+	rate.channel = 2;
+	rateFrame<uint8_t> rateView((uint8_t *)&rate, RATE_MSG_SIZE);
+	TEST_ASSERT_TRUE(rateView.valid());
+	TEST_ASSERT_EQUAL(9, rateView.sf());
+	TEST_ASSERT_EQUAL(2, rateView.channel());
+	TEST_ASSERT_FALSE(rateFrame<uint8_t>((uint8_t *)&rate, RATE_MSG_SIZE - 1).valid());
+}
+
+void test_map(void)
+{
+	mapMsg map;
+	map.type = LORA_NODEMAP;
+	map.from = 0x01020304;
+	uint8_t *buffer = (uint8_t *)&map;
+	mapFrame<uint8_t> frame(buffer, MAP_HEADER_SIZE + 3 * FRAME_MAP_ENTRY);
+	frame.setU32(MAP_HEADER_SIZE, 0x11111111);
+	buffer[MAP_HEADER_SIZE + 4] = 1;
+	frame.setU32(MAP_HEADER_SIZE + FRAME_MAP_ENTRY, 0x22222222);
+	buffer[MAP_HEADER_SIZE + FRAME_MAP_ENTRY + 4] = 2;
+	frame.setEndMarker(2);
+	TEST_ASSERT_TRUE(frame.valid());
+	TEST_ASSERT_EQUAL(2, frame.numNodes());
+	TEST_ASSERT_EQUAL_HEX32(0x22222222, frame.nodeId(1));
+	TEST_ASSERT_EQUAL(2, frame.nodeHops(1));
+
+	// Partial entry
+	TEST_ASSERT_FALSE(mapFrame<uint8_t>(buffer, MAP_HEADER_SIZE + 3 * FRAME_MAP_ENTRY - 1).valid());
+	// End marker cut off
+	TEST_ASSERT_FALSE(mapFrame<uint8_t>(buffer, MAP_HEADER_SIZE + 2 * FRAME_MAP_ENTRY).valid());
+}
+
+void test_echo(void)
+{
+	uint8_t buffer[256];
+	uint16_t size = buildData(buffer, ECHO_HEADER_SIZE);
+	buffer[FRAME_TYPE] = LORA_ECHO;
+	echoFrame<uint8_t> frame(buffer, size);
+	frame.setTarget(0x01020304);
+	frame.setFlags(0);
+	frame.clearHops();
+	TEST_ASSERT_TRUE(frame.valid());
+	frame.addHop(0x0A0B0C0D, 1000);
+	TEST_ASSERT_TRUE(frame.valid());
+	TEST_ASSERT_EQUAL(1, frame.numHops());
+	TEST_ASSERT_EQUAL_HEX32(0x0A0B0C0D, frame.hopId(0));
+	TEST_ASSERT_EQUAL(1000, frame.hopTime(0));
+
+	// Number of hops does not match the size
+	TEST_ASSERT_FALSE(echoFrame<uint8_t>(buffer, size).valid());
+}
+
+void test_parse_benchmark(void)
+{
+	uint8_t buffer[256];
+	uint16_t size = buildData(buffer, 50);
+	volatile uint32_t sink = 0;
+
+	uint32_t start = micros();
+	for (uint32_t idx = 0; idx < BENCH_PACKAGES; idx++)
+	{
+		// Vary the frame so the parsing is not moved out of the loop
+		buffer[FRAME_SEQ] = idx;
+		sink += parseFrame(buffer, size);
+	}
+	uint32_t elapsed = micros() - start;
+	TEST_ASSERT_TRUE(sink != 0);
+
+	char text[80];
+	snprintf(text, sizeof(text), "Check and parse of a data package: %lu ns",
+			 (unsigned long)((uint64_t)elapsed * 1000 / BENCH_PACKAGES));
+	TEST_MESSAGE(text);
+}
+
+int main(int argc, char **argv)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_data_fields);
+	RUN_TEST(test_data_little_endian);
+	RUN_TEST(test_data_rejected);
+	RUN_TEST(test_ack_and_rate);
+	RUN_TEST(test_map);
+	RUN_TEST(test_echo);
+	RUN_TEST(test_parse_benchmark);
+	return UNITY_END();
+}
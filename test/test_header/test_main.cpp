@@ -0,0 +1,217 @@
+#include "../mesh_peer.h"
+#include <unity.h>
+
+/**
+ * Compact header tests against the simulated peer
+ * Checks which packages of the mesh use the compact header and that
+ * compact packages with unknown short addresses or from a node that is not
+ * a direct node are dropped and counted. Data packages of older firmware
+ * with the 16 byte header are received.
+ */
+
+/** A node that neither the mesh nor the peer announced */
+#define UNKNOWN_ID 0x5A000909
+/** A node behind the peer, announced in its map */
+#define FAR_ID 0x5A000505
+
+static MeshEvents_t events;
+/** Number of messages delivered to the application */
+static volatile int delivered = 0;
+
+static void onDataAvailable(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	delivered++;
+}
+
+/**
+ * Receive the next data package of the mesh without converting it, maps are skipped
+ * @return int16_t
+ * 		Size of the package, -1 after the timeout
+ */
+static int16_t receiveRaw(uint8_t *buffer, uint32_t timeout)
+{
+	uint32_t start = millis();
+	while ((millis() - start) < timeout)
+	{
+		int16_t size = simPeerReceive(buffer, timeout - (millis() - start));
+		if ((size > 0) && ((buffer[0] != 'L') || ((buffer[FRAME_TYPE] & LORA_TYPE_MASK) != LORA_NODEMAP)))
+		{
+			return size;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Send the link ACK for a package of the mesh
+ */
+static void sendAck(uint8_t seq)
+{
+	ackMsg ack;
+	ack.dest = TEST_NODE_ID;
+	ack.from = PEER_ID;
+	ack.seq = seq;
+	peerSend((uint8_t *)&ack, ACK_MSG_SIZE);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_broadcast_full_header(void)
+{
+	uint8_t buffer[256];
+	uint8_t data[4] = {1, 2, 3, 4};
+	TEST_ASSERT_TRUE(sendBroadcast(data, sizeof(data), 1));
+	int16_t size = receiveRaw(buffer, 2000);
+	TEST_ASSERT_EQUAL(DATA_HEADER_SIZE + sizeof(data), size);
+	TEST_ASSERT_EQUAL('L', buffer[0]);
+	TEST_ASSERT_EQUAL(LORA_BROADCAST, buffer[FRAME_TYPE] & LORA_TYPE_MASK);
+}
+
+void test_direct_compact_retransmission_full(void)
+{
+	uint8_t buffer[256];
+	uint8_t data[4] = {1, 2, 3, 4};
+	TEST_ASSERT_TRUE(sendToNode(PEER_ID, data, sizeof(data), 0));
+
+	// Direct node that knows all addresses, the compact header is used
+	int16_t size = receiveRaw(buffer, 2000);
+	TEST_ASSERT_EQUAL(COMPACT_HEADER_SIZE + sizeof(data), size);
+	TEST_ASSERT_NOT_EQUAL('L', buffer[0]);
+
+	// Without link ACK the retransmission uses the full header
+	size = receiveRaw(buffer, 2000);
+	TEST_ASSERT_EQUAL(DATA_HEADER_SIZE + sizeof(data), size);
+	dataFrame<uint8_t> frame(buffer, size);
+	TEST_ASSERT_TRUE(frame.valid());
+	TEST_ASSERT_EQUAL_HEX32(PEER_ID, frame.dest());
+	TEST_ASSERT_EQUAL_HEX32(TEST_NODE_ID, frame.hop());
+	sendAck(frame.seq());
+}
+
+void test_unknown_orig_full_header(void)
+{
+	uint8_t buffer[256];
+
+	// Package of an unknown node that the mesh relays back to the peer
+	dataMsg msg;
+	msg.type = LORA_FORWARD;
+	msg.dest = TEST_NODE_ID;
+	msg.from = PEER_ID;
+	msg.orig = UNKNOWN_ID;
+	msg.hop = PEER_ID;
+	memcpy(msg.data, "test", 4);
+	peerSend((uint8_t *)&msg, DATA_HEADER_SIZE + 4);
+
+	int16_t size = receiveRaw(buffer, 2000);
+	TEST_ASSERT_EQUAL(DATA_HEADER_SIZE + 4, size);
+	dataFrame<uint8_t> frame(buffer, size);
+	TEST_ASSERT_TRUE_MESSAGE(frame.valid(), "compact header with unknown orig");
+	TEST_ASSERT_EQUAL_HEX32(UNKNOWN_ID, frame.orig());
+	sendAck(frame.seq());
+}
+
+void test_unresolved_counted(void)
+{
+	uint8_t buffer[256];
+	delivered = 0;
+	uint32_t unresolved = meshStatGet(STAT_RX_UNRESOLVED);
+
+	// Compact package with orig of an unknown node
+	uint16_t dest = shortAddress(TEST_NODE_ID);
+	uint16_t peer = shortAddress(PEER_ID);
+	uint16_t orig = shortAddress(UNKNOWN_ID);
+	uint8_t pckg[COMPACT_HEADER_SIZE + 4] = {0xA3, LORA_DIRECT,
+											 (uint8_t)(dest & 0xFF), (uint8_t)(dest >> 8),
+											 (uint8_t)(peer & 0xFF), (uint8_t)(peer >> 8),
+											 (uint8_t)(orig & 0xFF), (uint8_t)(orig >> 8),
+											 (uint8_t)(peer & 0xFF), (uint8_t)(peer >> 8),
+											 0, MESH_DEFAULT_TTL, 't', 'e', 's', 't'};
+	peerSend(pckg, sizeof(pckg));
+	delay(200);
+	TEST_ASSERT_EQUAL(0, delivered);
+	TEST_ASSERT_EQUAL(unresolved + 1, meshStatGet(STAT_RX_UNRESOLVED));
+
+	// Same package with a known orig is delivered
+	pckg[6] = peer & 0xFF;
+	pckg[7] = peer >> 8;
+	peerSend(pckg, sizeof(pckg));
+	delay(200);
+	TEST_ASSERT_EQUAL(1, delivered);
+}
+
+void test_not_neighbour_counted(void)
+{
+	delivered = 0;
+	uint32_t notNeighbour = meshStatGet(STAT_RX_NOT_NEIGHBOUR);
+
+	// The peer announces FAR_ID one hop behind it
+	mapMsg map;
+	map.type = LORA_NODEMAP;
+	map.from = PEER_ID;
+	uint8_t *mapBuffer = (uint8_t *)&map;
+	mapFrame<uint8_t> mapView(mapBuffer, MAP_HEADER_SIZE + 2 * FRAME_MAP_ENTRY);
+	mapView.setU32(MAP_HEADER_SIZE, FAR_ID);
+	mapBuffer[MAP_HEADER_SIZE + 4] = 1;
+	mapView.setEndMarker(1);
+	peerSend(mapBuffer, MAP_HEADER_SIZE + 2 * FRAME_MAP_ENTRY);
+	delay(100);
+	TEST_ASSERT_EQUAL(2, numOfNodes());
+
+	// Compact package sent by FAR_ID, a node with our short address near it meant another node
+	uint16_t dest = shortAddress(TEST_NODE_ID);
+	uint16_t far = shortAddress(FAR_ID);
+	uint8_t pckg[COMPACT_HEADER_SIZE + 4] = {0xA3, LORA_DIRECT,
+											 (uint8_t)(dest & 0xFF), (uint8_t)(dest >> 8),
+											 (uint8_t)(far & 0xFF), (uint8_t)(far >> 8),
+											 (uint8_t)(far & 0xFF), (uint8_t)(far >> 8),
+											 (uint8_t)(far & 0xFF), (uint8_t)(far >> 8),
+											 0, MESH_DEFAULT_TTL, 't', 'e', 's', 't'};
+	peerSend(pckg, sizeof(pckg));
+	delay(200);
+	TEST_ASSERT_EQUAL(0, delivered);
+	TEST_ASSERT_EQUAL(notNeighbour + 1, meshStatGet(STAT_RX_NOT_NEIGHBOUR));
+}
+
+void test_legacy_received(void)
+{
+	uint8_t buffer[256];
+	delivered = 0;
+	uint32_t legacy = meshStatGet(STAT_RX_LEGACY);
+
+	// Direct package of older firmware: magic, type, dest, from, orig and the payload
+	uint8_t pckg[LEGACY_HEADER_SIZE + 4] = {'L', 'o', 'R', LORA_DIRECT};
+	dataFrame<uint8_t> header(pckg, sizeof(pckg));
+	header.setDest(TEST_NODE_ID);
+	header.setFrom(PEER_ID);
+	header.setOrig(PEER_ID);
+	memcpy(&pckg[LEGACY_HEADER_SIZE], "test", 4);
+	peerSend(pckg, sizeof(pckg));
+	delay(200);
+	TEST_ASSERT_EQUAL(1, delivered);
+	TEST_ASSERT_EQUAL(legacy + 1, meshStatGet(STAT_RX_LEGACY));
+	TEST_ASSERT_TRUE(receiveRaw(buffer, 200) < 0);
+}
+
+int main(int argc, char **argv)
+{
+	events.DataAvailable = onDataAvailable;
+	if (!peerStart(&events) || !peerSendMap())
+	{
+		return 1;
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(test_broadcast_full_header);
+	RUN_TEST(test_direct_compact_retransmission_full);
+	RUN_TEST(test_unknown_orig_full_header);
+	RUN_TEST(test_unresolved_counted);
+	RUN_TEST(test_not_neighbour_counted);
+	RUN_TEST(test_legacy_received);
+	return UNITY_END();
+}
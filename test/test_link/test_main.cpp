@@ -0,0 +1,178 @@
+#include "../mesh_peer.h"
+#include <unity.h>
+
+/**
+ * Link ACK tests against the simulated peer
+ * The peer relays packages of other nodes to the mesh and checks the link
+ * ACKs, or receives packages of the mesh without ever sending a link ACK.
+ */
+
+/** Nodes behind the peer, the peer relays their packages */
+#define ORIG_ID 0x5A000303
+#define OTHER_HOP_ID 0x5A000404
+
+static MeshEvents_t events;
+/** Number of messages delivered to the application */
+static volatile int delivered = 0;
+/** Destination reported by the send failed callback */
+static volatile uint32_t failedId = 0;
+
+static void onDataAvailable(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	delivered++;
+}
+
+static void onSendFailed(uint32_t nodeId)
+{
+	failedId = nodeId;
+}
+
+/**
+ * Send a package of ORIG_ID to the mesh that requests a link ACK
+ * @param hop
+ * 		Node that sends the package on the link
+ * @param seq
+ * 		Link sequence number
+ */
+static void sendRelayed(uint32_t hop, uint8_t seq)
+{
+	dataMsg msg;
+	msg.type = LORA_DIRECT | LORA_FLAG_ACK_REQ;
+	msg.dest = TEST_NODE_ID;
+	msg.from = ORIG_ID;
+	msg.orig = ORIG_ID;
+	msg.hop = hop;
+	msg.seq = seq;
+	memcpy(msg.data, "test", 4);
+	peerSend((uint8_t *)&msg, DATA_HEADER_SIZE + 4);
+}
+
+/**
+ * Wait for the link ACK of the mesh
+ * @return ackFrame<uint8_t>
+ * 		Link ACK, invalid after the timeout
+ */
+static ackFrame<uint8_t> receiveAck(uint8_t *buffer)
+{
+	uint32_t start = millis();
+	while ((millis() - start) < 1000)
+	{
+		int16_t size = simPeerReceive(buffer, 1000 - (millis() - start));
+		ackFrame<uint8_t> ack(buffer, size < 0 ? 0 : size);
+		if (ack.valid() && (ack.msgType() == LORA_ACK))
+		{
+			return ack;
+		}
+	}
+	return ackFrame<uint8_t>(buffer, 0);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_ack_to_previous_hop(void)
+{
+	uint8_t buffer[256];
+	sendRelayed(PEER_ID, 10);
+	ackFrame<uint8_t> ack = receiveAck(buffer);
+	TEST_ASSERT_TRUE_MESSAGE(ack.valid(), "no link ACK");
+	TEST_ASSERT_EQUAL_HEX32(PEER_ID, ack.dest());
+	TEST_ASSERT_EQUAL_HEX32(TEST_NODE_ID, ack.from());
+	TEST_ASSERT_EQUAL(10, ack.seq());
+}
+
+void test_duplicate_per_hop(void)
+{
+	uint8_t buffer[256];
+	delivered = 0;
+	uint32_t duplicates = meshStatGet(STAT_RX_DUPLICATE);
+
+	// Retransmission after a lost link ACK
+	sendRelayed(PEER_ID, 20);
+	TEST_ASSERT_TRUE(receiveAck(buffer).valid());
+	sendRelayed(PEER_ID, 20);
+	TEST_ASSERT_TRUE_MESSAGE(receiveAck(buffer).valid(), "duplicate not acknowledged");
+	TEST_ASSERT_EQUAL(1, delivered);
+	TEST_ASSERT_EQUAL(duplicates + 1, meshStatGet(STAT_RX_DUPLICATE));
+
+	// Same package and link sequence number from another relay is new
+	sendRelayed(OTHER_HOP_ID, 20);
+	ackFrame<uint8_t> ack = receiveAck(buffer);
+	TEST_ASSERT_TRUE(ack.valid());
+	TEST_ASSERT_EQUAL_HEX32(OTHER_HOP_ID, ack.dest());
+	TEST_ASSERT_EQUAL(2, delivered);
+}
+
+void test_give_up_reported(void)
+{
+	uint8_t buffer[256];
+	uint8_t data[4] = {1, 2, 3, 4};
+	uint32_t giveUps = meshStatGet(STAT_LINK_GIVE_UP);
+	failedId = 0;
+
+	// The peer never sends the link ACK
+	TEST_ASSERT_TRUE(sendToNode(PEER_ID, data, sizeof(data), 0));
+	int transmissions = 0;
+	uint32_t start = millis();
+	while (((millis() - start) < 5000) && (failedId == 0))
+	{
+		int16_t size = simPeerReceive(buffer, 100);
+		dataFrame<uint8_t> frame(buffer, size < 0 ? 0 : size);
+		if ((size > 0) && (buffer[0] != 'L'))
+		{
+			// Compact header, the mesh and the peer are the only nodes
+			transmissions++;
+		}
+		else if (frame.valid() && (frame.msgType() == LORA_DIRECT))
+		{
+			transmissions++;
+		}
+	}
+	TEST_ASSERT_EQUAL(1 + LINK_ACK_RETRY, transmissions);
+	TEST_ASSERT_EQUAL_HEX32(PEER_ID, failedId);
+	TEST_ASSERT_EQUAL(giveUps + 1, meshStatGet(STAT_LINK_GIVE_UP));
+}
+
+void test_cad_give_up_reported(void)
+{
+	uint8_t jam[255];
+	uint8_t data[4] = {1, 2, 3, 4};
+	uint32_t cadGiveUps = meshStatGet(STAT_CAD_GIVE_UP);
+	uint32_t giveUps = meshStatGet(STAT_LINK_GIVE_UP);
+	memset(jam, 0, sizeof(jam));
+	failedId = 0;
+
+	// The peer keeps the channel busy until the mesh gives up the CAD
+	simPeerSend(jam, sizeof(jam));
+	TEST_ASSERT_TRUE(sendToNode(PEER_ID, data, sizeof(data), 0));
+	uint32_t start = millis();
+	while (((millis() - start) < (CAD_RETRY * CAD_RETRY_DELAY + 1000)) && (failedId == 0))
+	{
+		simPeerSend(jam, sizeof(jam));
+	}
+	TEST_ASSERT_EQUAL(cadGiveUps + 1, meshStatGet(STAT_CAD_GIVE_UP));
+	TEST_ASSERT_EQUAL_HEX32(PEER_ID, failedId);
+	TEST_ASSERT_EQUAL(giveUps + 1, meshStatGet(STAT_LINK_GIVE_UP));
+}
+
+int main(int argc, char **argv)
+{
+	events.DataAvailable = onDataAvailable;
+	events.SendFailed = onSendFailed;
+	if (!peerStart(&events) || !peerSendMap())
+	{
+		return 1;
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(test_ack_to_previous_hop);
+	RUN_TEST(test_duplicate_per_hop);
+	RUN_TEST(test_give_up_reported);
+	RUN_TEST(test_cad_give_up_reported);
+	return UNITY_END();
+}
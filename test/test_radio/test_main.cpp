@@ -0,0 +1,124 @@
+#include "../mesh_peer.h"
+#include <unity.h>
+
+/**
+ * Radio control layer tests against the simulated radio
+ * The simulated radio counts the commands that reach it, each is an SPI
+ * transaction on the SX126x. The counters of the radio control layer
+ * must match them, and redundant commands must not reach the radio.
+ */
+
+/** Number of cycles per test */
+#define RADIO_CYCLES 10
+
+static MeshEvents_t events;
+/** Number of messages delivered to the application */
+static volatile int delivered = 0;
+
+static void onDataAvailable(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	delivered++;
+}
+
+/** Commands at the start of a test */
+static uint32_t startCommands;
+static uint32_t startCmd;
+static uint32_t startSkipped;
+
+/**
+ * Check that the counted commands reached the radio and report them per cycle
+ * @param name
+ * 		Name of the cycle
+ * @return uint32_t
+ * 		Commands sent to the radio
+ */
+static uint32_t checkCommands(const char *name)
+{
+	uint32_t commands = simRadioCommands() - startCommands;
+	uint32_t cmd = meshStatGet(STAT_RADIO_CMD) - startCmd;
+	uint32_t skipped = meshStatGet(STAT_RADIO_SKIPPED) - startSkipped;
+	TEST_ASSERT_EQUAL_MESSAGE(cmd, commands, name);
+
+	char text[100];
+	snprintf(text, sizeof(text), "%s: %lu.%lu commands per cycle, %lu.%lu without skipping", name,
+			 (unsigned long)(commands / RADIO_CYCLES), (unsigned long)(commands % RADIO_CYCLES),
+			 (unsigned long)((commands + skipped) / RADIO_CYCLES), (unsigned long)((commands + skipped) % RADIO_CYCLES));
+	TEST_MESSAGE(text);
+	return commands;
+}
+
+void setUp(void)
+{
+	// Let the radio settle in RX after the last test
+	delay(100);
+	startCommands = simRadioCommands();
+	startCmd = meshStatGet(STAT_RADIO_CMD);
+	startSkipped = meshStatGet(STAT_RADIO_SKIPPED);
+}
+
+void tearDown(void)
+{
+}
+
+void test_tx_cycle(void)
+{
+	uint8_t buffer[256];
+	uint8_t data[4] = {1, 2, 3, 4};
+	for (int idx = 0; idx < RADIO_CYCLES; idx++)
+	{
+		TEST_ASSERT_TRUE(sendToNode(PEER_ID, data, sizeof(data), 0));
+		TEST_ASSERT_TRUE(peerReceive(buffer, 2000) > 0);
+		// Wait for the link ACK to be received
+		delay(100);
+	}
+
+	// Standby, CAD, send and RX again, then the RX restart after the link ACK
+	TEST_ASSERT_EQUAL(5 * RADIO_CYCLES, checkCommands("TX cycle with link ACK"));
+}
+
+void test_rx_cycle(void)
+{
+	uint8_t data[4] = {1, 2, 3, 4};
+	delivered = 0;
+	for (int idx = 0; idx < RADIO_CYCLES; idx++)
+	{
+		peerSendData(0, data, sizeof(data));
+		delay(50);
+	}
+	TEST_ASSERT_EQUAL(RADIO_CYCLES, delivered);
+
+	// Only the RX restart, the SX126x is in standby after RX done already
+	TEST_ASSERT_EQUAL(RADIO_CYCLES, checkCommands("RX cycle"));
+}
+
+void test_reset_resends(void)
+{
+	radioReset();
+	radioSetRate(LORA_SPREADING_FACTOR);
+	radioSetChannel(0);
+	radioRx(true);
+	// Standby, TX and RX config, channel and RX reach the radio after a reset
+	TEST_ASSERT_EQUAL(5, simRadioCommands() - startCommands);
+
+	// Nothing changes, nothing is sent
+	radioSetRate(LORA_SPREADING_FACTOR);
+	radioSetChannel(0);
+	radioRx(true);
+	TEST_ASSERT_EQUAL(5, simRadioCommands() - startCommands);
+	TEST_ASSERT_EQUAL(5, meshStatGet(STAT_RADIO_CMD) - startCmd);
+}
+
+int main(int argc, char **argv)
+{
+	events.DataAvailable = onDataAvailable;
+	if (!peerStart(&events) || !peerSendMap())
+	{
+		return 1;
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(test_tx_cycle);
+	RUN_TEST(test_rx_cycle);
+	RUN_TEST(test_reset_resends);
+	return UNITY_END();
+}
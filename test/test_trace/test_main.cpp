@@ -0,0 +1,130 @@
+#include "../mesh_peer.h"
+#include <unity.h>
+
+/**
+ * Latency tracing tests against the simulated peer
+ * The simulated radio takes the LoRa time on air for every package, so
+ * the on air interval of the traces must match it.
+ */
+
+/** Number of packages per test, a multiple of TRACE_SAMPLE */
+#define TRACE_PACKAGES (2 * TRACE_SAMPLE)
+
+static MeshEvents_t events;
+/** Number of messages delivered to the application */
+static volatile int delivered = 0;
+
+static void onDataAvailable(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	delivered++;
+}
+
+/**
+ * Check the histogram of an interval
+ * @param interval
+ * 		Interval to check
+ * @param count
+ * 		Expected number of traced packages
+ */
+static void checkHistogram(traceInterval interval, uint32_t count)
+{
+	traceHistogram *hist = &traceHist[interval];
+	TEST_ASSERT_EQUAL_MESSAGE(count, hist->count, traceName(interval));
+	uint32_t bucketSum = 0;
+	for (int idx = 0; idx < TRACE_BUCKETS; idx++)
+	{
+		bucketSum += hist->buckets[idx];
+	}
+	TEST_ASSERT_EQUAL_MESSAGE(count, bucketSum, traceName(interval));
+	TEST_ASSERT_TRUE(hist->max <= hist->sum);
+}
+
+/** Average of an interval [us] */
+static uint32_t average(traceInterval interval)
+{
+	return traceHist[interval].count != 0 ? traceHist[interval].sum / traceHist[interval].count : 0;
+}
+
+void setUp(void)
+{
+	traceReset();
+}
+
+void tearDown(void)
+{
+}
+
+void test_tx_trace(void)
+{
+	uint8_t buffer[256];
+	uint8_t data[4] = {1, 2, 3, 4};
+	for (int idx = 0; idx < TRACE_PACKAGES; idx++)
+	{
+		TEST_ASSERT_TRUE(sendToNode(PEER_ID, data, sizeof(data), 0));
+		TEST_ASSERT_TRUE(peerReceive(buffer, 2000) > 0);
+		// Wait for the link ACK to be received
+		delay(100);
+	}
+
+	for (int interval = TRACE_QUEUE; interval <= TRACE_TX_TOTAL; interval++)
+	{
+		checkHistogram((traceInterval)interval, TRACE_PACKAGES / TRACE_SAMPLE);
+	}
+
+	// On air time of the package with compact header, the radio thread adds a little
+	uint32_t onAir = meshTimeOnAirUs(COMPACT_HEADER_SIZE + sizeof(data));
+	TEST_ASSERT_UINT32_WITHIN(2000, onAir + 1000, average(TRACE_ON_AIR));
+	// The total covers all stages
+	TEST_ASSERT_TRUE(average(TRACE_TX_TOTAL) >= average(TRACE_QUEUE) + average(TRACE_PREPARE) + average(TRACE_CAD) +
+													 average(TRACE_CAD_TO_SEND) + average(TRACE_ON_AIR) - 10);
+}
+
+void test_rx_trace(void)
+{
+	uint8_t data[4] = {1, 2, 3, 4};
+	delivered = 0;
+	for (int idx = 0; idx < TRACE_PACKAGES; idx++)
+	{
+		peerSendData(0, data, sizeof(data));
+		delay(50);
+	}
+	delay(200);
+	TEST_ASSERT_EQUAL(TRACE_PACKAGES, delivered);
+
+	checkHistogram(TRACE_RX_RING, TRACE_PACKAGES / TRACE_SAMPLE);
+	checkHistogram(TRACE_RX_CALLBACK, TRACE_PACKAGES / TRACE_SAMPLE);
+	checkHistogram(TRACE_ON_AIR, 0);
+	// The callback comes after the mesh task took the package
+	TEST_ASSERT_TRUE(average(TRACE_RX_CALLBACK) >= average(TRACE_RX_RING));
+}
+
+void test_csv(void)
+{
+	char buffer[256];
+	uint8_t next = 0;
+	int lines = 0;
+	uint16_t len;
+	while ((len = traceCsv(buffer, sizeof(buffer), next)) != 0)
+	{
+		for (int idx = 0; idx < len; idx++)
+		{
+			lines += buffer[idx] == '\n' ? 1 : 0;
+		}
+	}
+	TEST_ASSERT_EQUAL(TRACE_NUM, lines);
+}
+
+int main(int argc, char **argv)
+{
+	events.DataAvailable = onDataAvailable;
+	if (!peerStart(&events) || !peerSendMap())
+	{
+		return 1;
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(test_tx_trace);
+	RUN_TEST(test_rx_trace);
+	RUN_TEST(test_csv);
+	return UNITY_END();
+}
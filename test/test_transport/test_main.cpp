@@ -0,0 +1,134 @@
+#include "../mesh_peer.h"
+#include <unity.h>
+
+/**
+ * Transport tests against the simulated peer
+ * The peer sends transport data packages and checks the SACKs of the
+ * mesh, or receives transport messages without ever sending a SACK.
+ */
+
+/** Transport package types and sizes, see transport.cpp */
+#define TRANSPORT_DATA 1
+#define TRANSPORT_SACK 2
+#define TRANSPORT_DATA_HEADER 5
+#define TRANSPORT_SACK_SIZE 5
+#define TRANSPORT_INITIAL_RTO 3000
+
+static MeshEvents_t events;
+/** Number of messages delivered to the application */
+static volatile int delivered = 0;
+
+static void onDataAvailable(uint32_t fromID, uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+	delivered++;
+}
+
+/**
+ * Send a transport data package from the peer
+ */
+static void sendData(uint16_t seq, uint16_t base)
+{
+	uint8_t pckg[TRANSPORT_DATA_HEADER + 4] = {TRANSPORT_DATA, (uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8),
+											   (uint8_t)(base & 0xFF), (uint8_t)(base >> 8), 't', 'e', 's', 't'};
+	peerSendData(LORA_FLAG_TRANSPORT, pckg, sizeof(pckg));
+}
+
+/**
+ * Wait for the SACK of the mesh
+ */
+static void receiveSack(uint16_t &cumAck, uint16_t &bitmap)
+{
+	uint8_t buffer[256];
+	dataFrame<uint8_t> frame = peerReceiveTransport(buffer, 3000);
+	TEST_ASSERT_TRUE_MESSAGE(frame.valid(), "no SACK");
+	TEST_ASSERT_EQUAL(TRANSPORT_SACK_SIZE, frame.payloadSize());
+	TEST_ASSERT_EQUAL(TRANSPORT_SACK, frame.payload()[0]);
+	cumAck = frame.payload()[1] | (frame.payload()[2] << 8);
+	bitmap = frame.payload()[3] | (frame.payload()[4] << 8);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_in_order(void)
+{
+	uint16_t cumAck, bitmap;
+	delivered = 0;
+	sendData(100, 100);
+	receiveSack(cumAck, bitmap);
+	TEST_ASSERT_EQUAL(101, cumAck);
+	TEST_ASSERT_EQUAL(0, bitmap);
+	TEST_ASSERT_EQUAL(1, delivered);
+}
+
+void test_base_moves_over_received(void)
+{
+	uint16_t cumAck, bitmap;
+	delivered = 0;
+	// 101 is lost, 102 arrives
+	sendData(102, 101);
+	receiveSack(cumAck, bitmap);
+	TEST_ASSERT_EQUAL(101, cumAck);
+	TEST_ASSERT_EQUAL(0x0001, bitmap);
+
+	// Sender gave up on 101, the window moves over 102 that arrived already
+	sendData(103, 102);
+	receiveSack(cumAck, bitmap);
+	TEST_ASSERT_EQUAL(104, cumAck);
+	TEST_ASSERT_EQUAL(0, bitmap);
+	TEST_ASSERT_EQUAL(2, delivered);
+
+	// A late copy of 102 is a duplicate
+	sendData(102, 102);
+	receiveSack(cumAck, bitmap);
+	TEST_ASSERT_EQUAL(104, cumAck);
+	TEST_ASSERT_EQUAL(2, delivered);
+}
+
+void test_backoff_once_per_timeout(void)
+{
+	uint8_t buffer[256];
+	uint8_t msg[4] = {1, 2, 3, 4};
+	uint32_t start = millis();
+
+	// A full window of messages that are never acknowledged times out in one event
+	for (int idx = 0; idx < TRANSPORT_WINDOW; idx++)
+	{
+		TEST_ASSERT_TRUE(transportSend(PEER_ID, msg, sizeof(msg), NULL));
+		TEST_ASSERT_TRUE_MESSAGE(peerReceiveTransport(buffer, 1000).valid(), "message not sent");
+	}
+	TEST_ASSERT_EQUAL(TRANSPORT_INITIAL_RTO, transportRto(PEER_ID));
+
+	// Count the retransmissions after the first timeout
+	int retransmissions = 0;
+	while ((millis() - start) < (TRANSPORT_INITIAL_RTO * 2 + 500))
+	{
+		dataFrame<uint8_t> frame = peerReceiveTransport(buffer, 100);
+		if (frame.valid() && (frame.payload()[0] == TRANSPORT_DATA) && ((millis() - start) > TRANSPORT_INITIAL_RTO))
+		{
+			retransmissions++;
+		}
+	}
+	TEST_ASSERT_EQUAL(TRANSPORT_WINDOW, retransmissions);
+	TEST_ASSERT_EQUAL(TRANSPORT_INITIAL_RTO * 2, transportRto(PEER_ID));
+}
+
+int main(int argc, char **argv)
+{
+	events.DataAvailable = onDataAvailable;
+	if (!peerStart(&events) || !peerSendMap())
+	{
+		return 1;
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(test_in_order);
+	RUN_TEST(test_base_moves_over_received);
+	RUN_TEST(test_backoff_once_per_timeout);
+	return UNITY_END();
+}
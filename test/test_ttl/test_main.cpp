@@ -0,0 +1,154 @@
+#include "../mesh_peer.h"
+#include <unity.h>
+
+/**
+ * Routing loop tests against the simulated peer
+ * The peer announces a node behind it, but sends every package for that
+ * node back to the mesh, like a relay with an outdated map. The loop
+ * wastes transmissions until the TTL runs out.
+ */
+
+/** Node that the peer announces, packages to it loop between the mesh and the peer */
+#define LOOP_ID 0x5A000909
+/** Originator of the looping package */
+#define ORIG_ID 0x5A000303
+/** Time the loop runs without TTL [ms] */
+#define LOOP_TIME 5000
+
+static MeshEvents_t events;
+
+/**
+ * Send a map of the peer with LOOP_ID behind it
+ * @return bool
+ * 		False if the mesh did not add both nodes
+ */
+static bool sendLoopMap(void)
+{
+	mapMsg map;
+	map.type = LORA_NODEMAP;
+	map.from = PEER_ID;
+	uint8_t *buffer = (uint8_t *)&map;
+	mapFrame<uint8_t> frame(buffer, MAP_HEADER_SIZE + 2 * FRAME_MAP_ENTRY);
+	frame.setU32(MAP_HEADER_SIZE, LOOP_ID);
+	buffer[MAP_HEADER_SIZE + 4] = 1;
+	frame.setEndMarker(1);
+	peerSend(buffer, MAP_HEADER_SIZE + 2 * FRAME_MAP_ENTRY);
+	delay(100);
+	return numOfNodes() == 2;
+}
+
+/**
+ * Send a package for LOOP_ID from the peer to the mesh
+ * @param seq
+ * 		Link sequence number
+ * @param ttl
+ * 		Time to live
+ */
+static void sendLooping(uint8_t seq, uint8_t ttl)
+{
+	dataMsg msg;
+	msg.type = LORA_FORWARD;
+	msg.dest = TEST_NODE_ID;
+	msg.from = LOOP_ID;
+	msg.orig = ORIG_ID;
+	msg.hop = PEER_ID;
+	msg.seq = seq;
+	msg.ttl = ttl;
+	memcpy(msg.data, "loop", 4);
+	peerSend((uint8_t *)&msg, DATA_HEADER_SIZE + 4);
+}
+
+/**
+ * Receive the package the mesh forwards for LOOP_ID
+ * @return uint8_t
+ * 		TTL of the package, 0 if the mesh did not forward it
+ */
+static uint8_t receiveLooping(uint8_t *buffer, uint32_t timeout)
+{
+	uint32_t start = millis();
+	while ((millis() - start) < timeout)
+	{
+		int16_t size = peerReceive(buffer, timeout - (millis() - start));
+		dataFrame<uint8_t> frame(buffer, size < 0 ? 0 : size);
+		if (frame.valid() && (frame.msgType() == LORA_FORWARD) && (frame.dest() == PEER_ID))
+		{
+			return frame.ttl();
+		}
+	}
+	return 0;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_loop_ends_with_ttl(void)
+{
+	uint8_t buffer[256];
+	uint32_t ttlDrops = meshStatGet(STAT_TTL_DROP);
+
+	// The package comes from one hop before the peer, both sides decrement the TTL
+	uint8_t ttl = MESH_DEFAULT_TTL - 1;
+	uint8_t seq = 0;
+	int transmissions = 0;
+	uint32_t start = millis();
+	sendLooping(seq++, ttl);
+	while ((ttl = receiveLooping(buffer, 1000)) != 0)
+	{
+		transmissions++;
+		TEST_ASSERT_TRUE(ttl > 1);
+		sendLooping(seq++, ttl - 1);
+	}
+	uint32_t elapsed = millis() - start;
+
+	// The mesh forwards with TTL 14, 12, ... 2 and drops the package that arrives with TTL 1
+	TEST_ASSERT_EQUAL((MESH_DEFAULT_TTL - 2) / 2, transmissions);
+	TEST_ASSERT_EQUAL(ttlDrops + 1, meshStatGet(STAT_TTL_DROP));
+
+	char text[80];
+	snprintf(text, sizeof(text), "With TTL: loop ended after %d transmissions of the mesh, %lu ms", transmissions,
+			 (unsigned long)(elapsed - 1000));
+	TEST_MESSAGE(text);
+}
+
+void test_loop_without_ttl(void)
+{
+	uint8_t buffer[256];
+
+	// The peer does not decrement the TTL, like a node without TTL
+	uint8_t seq = 0;
+	int transmissions = 0;
+	uint32_t start = millis();
+	sendLooping(seq++, MESH_DEFAULT_TTL);
+	while ((millis() - start) < LOOP_TIME)
+	{
+		TEST_ASSERT_TRUE_MESSAGE(receiveLooping(buffer, 1000) != 0, "loop ended");
+		transmissions++;
+		sendLooping(seq++, MESH_DEFAULT_TTL);
+	}
+	// The last package is not sent back, the mesh forwards it once more
+	TEST_ASSERT_TRUE(receiveLooping(buffer, 1000) != 0);
+	TEST_ASSERT_TRUE(transmissions > MESH_DEFAULT_TTL);
+
+	char text[80];
+	snprintf(text, sizeof(text), "Without TTL: %d transmissions of the mesh in %d ms, still looping", transmissions,
+			 LOOP_TIME);
+	TEST_MESSAGE(text);
+}
+
+int main(int argc, char **argv)
+{
+	if (!peerStart(&events) || !sendLoopMap())
+	{
+		return 1;
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(test_loop_ends_with_ttl);
+	RUN_TEST(test_loop_without_ttl);
+	return UNITY_END();
+}